@@ -0,0 +1,50 @@
+/* Reports MRAM allocator throughput on a fragmented heap.
+
+   The heap of 2,560 DPUs (a full 20-rank system) is first filled with
+   vectors of random sizes, and every other one is freed to leave holes of
+   mixed sizes. The timed loop then frees a random live vector and allocates a
+   new one of random size, so that every allocation searches the free blocks.
+*/
+
+#include <allocator.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+
+int main(void) {
+  const uint32_t nr_of_dpus = 2560;
+  const size_t heap_per_dpu = 64 * 1024 * 1024;
+  const uint32_t live = 4096;
+  const uint32_t iterations = 100000;
+
+  allocator alloc(0, heap_per_dpu * nr_of_dpus, nr_of_dpus);
+  auto random_elements = [&] {
+    return (rand() % 1024 + 1) * nr_of_dpus + rand() % nr_of_dpus;
+  };
+
+  vector<vector_desc> vectors;
+  for (uint32_t i = 0; i < 2 * live; i++) {
+    vectors.push_back(alloc.allocate_upmem_vector(random_elements(), 4));
+  }
+  for (uint32_t i = 0; i < live; i++) {
+    alloc.deallocate_upmem_vector(vectors[2 * i]);
+    vectors[i] = std::move(vectors[2 * i + 1]);
+  }
+  vectors.resize(live);
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) {
+    vector_desc& v = vectors[rand() % live];
+    alloc.deallocate_upmem_vector(v);
+    v = alloc.allocate_upmem_vector(random_elements(), 4);
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  std::printf("%u DPUs, %u live vectors: %.0f alloc+free/s (%.2f us each)\n",
+              nr_of_dpus, live, iterations / elapsed.count(),
+              elapsed.count() * 1e6 / iterations);
+  return 0;
+}
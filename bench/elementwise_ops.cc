@@ -0,0 +1,99 @@
+/* Reports the throughput of every elementwise op.
+
+   Each op is evaluated into a preallocated vector spread over all DPUs. The
+   cycle count is that of the slowest DPU, divided by the number of elements
+   it processed; the throughput is elements per second of host wall time,
+   including the launch. Integer multiplies are run on operands of 8, 16 and
+   32 bits, and vector-scalar multiply, divide and modulo by a power of two
+   and by another scalar, to show the fast paths.
+*/
+
+#include <runtime.h>
+#include <vectordpu.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+template <typename F>
+void bench_op(const char* type, const char* op, uint32_t n, F run) {
+  auto& runtime = DpuRuntime::get();
+  runtime.get_event_queue().wait();
+  auto start = std::chrono::steady_clock::now();
+  run();
+  uint64_t cycles = runtime.last_kernel_cycles();  // waits for the queue
+  std::chrono::duration<double> wall =
+      std::chrono::steady_clock::now() - start;
+
+  uint32_t per_dpu = (n + runtime.num_dpus() - 1) / runtime.num_dpus();
+  std::printf("%-6s %-12s %10u %10.2f %14.0f\n", type, op, n,
+              static_cast<double>(cycles) / per_dpu, n / wall.count());
+}
+
+// Random values of magnitude below range, never 0
+template <typename T>
+vector<T> operand(uint32_t n, int range) {
+  vector<T> v(n);
+  for (uint32_t i = 0; i < n; i++) {
+    int x = rand() % range - range / 2;
+    v[i] = static_cast<T>(x == 0 ? 1 : x);
+  }
+  return v;
+}
+
+template <typename T>
+void bench_type(const char* type, uint32_t n) {
+  auto dpu_a = dpu_vector<T>::from_cpu(operand<T>(n, 1 << 15));
+  auto dpu_b = dpu_vector<T>::from_cpu(operand<T>(n, 1 << 15));
+  dpu_vector<T> res(n);
+
+  bench_op(type, "add", n, [&] { res = dpu_a + dpu_b; });
+  bench_op(type, "sub", n, [&] { res = dpu_a - dpu_b; });
+  bench_op(type, "mul", n, [&] { res = dpu_a * dpu_b; });
+  bench_op(type, "div", n, [&] { res = dpu_a / dpu_b; });
+  if constexpr (std::is_integral_v<T>) {
+    bench_op(type, "mod", n, [&] { res = dpu_a % dpu_b; });
+  }
+  bench_op(type, "min", n, [&] { res = min(dpu_a, dpu_b); });
+  bench_op(type, "max", n, [&] { res = max(dpu_a, dpu_b); });
+  bench_op(type, "lt", n, [&] { res = dpu_a < dpu_b; });
+  bench_op(type, "eq", n, [&] { res = dpu_a == dpu_b; });
+  bench_op(type, "gt", n, [&] { res = dpu_a > dpu_b; });
+  bench_op(type, "mul scalar", n, [&] { res = dpu_a * T(3); });
+  bench_op(type, "div scalar", n, [&] { res = dpu_a / T(3); });
+}
+
+void bench_int_paths(uint32_t n) {
+  dpu_vector<int> res(n);
+  const struct {
+    const char* name;
+    int range;
+  } widths[] = {{"mul 8-bit", 1 << 8}, {"mul 16-bit", 1 << 16},
+                {"mul 32-bit", RAND_MAX}};
+  for (const auto& w : widths) {
+    auto dpu_a = dpu_vector<int>::from_cpu(operand<int>(n, w.range));
+    auto dpu_b = dpu_vector<int>::from_cpu(operand<int>(n, w.range));
+    bench_op("int", w.name, n, [&] { res = dpu_a * dpu_b; });
+  }
+
+  auto dpu_a = dpu_vector<int>::from_cpu(operand<int>(n, RAND_MAX));
+  bench_op("int", "mul x8", n, [&] { res = dpu_a * 8; });
+  bench_op("int", "mul x7", n, [&] { res = dpu_a * 7; });
+  bench_op("int", "div /8", n, [&] { res = dpu_a / 8; });
+  bench_op("int", "div /7", n, [&] { res = dpu_a / 7; });
+  bench_op("int", "mod %8", n, [&] { res = dpu_a % 8; });
+  bench_op("int", "mod %7", n, [&] { res = dpu_a % 7; });
+}
+
+int main(void) {
+  std::printf("%-6s %-12s %10s %10s %14s\n", "type", "op", "elements",
+              "cyc/elem", "elements/s");
+  for (uint32_t n : {1u << 16, 1u << 20, 1u << 22}) {
+    bench_type<int>("int", n);
+    bench_type<float>("float", n);
+    bench_int_paths(n);
+  }
+
+  DpuRuntime::get().shutdown();
+  return 0;
+}
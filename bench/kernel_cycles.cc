@@ -0,0 +1,60 @@
+/* Reports DPU cycles per element for the vector kernels.
+
+   Every kernel is launched once on a vector spread over all DPUs. The cycle
+   count is that of the slowest DPU, read back from the perfcounter the DPU
+   program samples around each launch, and divided by the number of elements
+   that DPU processed.
+*/
+
+#include <runtime.h>
+#include <vectordpu.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+void report(const char* type, const char* kernel, uint32_t n) {
+  auto& runtime = DpuRuntime::get();
+  uint64_t cycles = runtime.last_kernel_cycles();
+  uint32_t per_dpu = (n + runtime.num_dpus() - 1) / runtime.num_dpus();
+  std::printf("%-6s %-10s %10u %12llu %10.2f\n", type, kernel, n,
+              static_cast<unsigned long long>(cycles),
+              static_cast<double>(cycles) / per_dpu);
+}
+
+template <typename T>
+void bench_type(const char* type, uint32_t n) {
+  vector<T> a(n), b(n), c(n);
+  for (uint32_t i = 0; i < n; i++) {
+    a[i] = static_cast<T>(rand() % 100);
+    b[i] = static_cast<T>(rand() % 100);
+    c[i] = static_cast<T>(rand() % 100);
+  }
+  auto dpu_a = dpu_vector<T>::from_cpu(a);
+  auto dpu_b = dpu_vector<T>::from_cpu(b);
+  auto dpu_c = dpu_vector<T>::from_cpu(c);
+
+  dpu_vector<T> res = dpu_a + dpu_b;
+  report(type, "add", n);
+  res = -dpu_a;
+  report(type, "negate", n);
+  res = abs(dpu_a + dpu_b - dpu_c);
+  report(type, "fused", n);
+  volatile T sum = reduce_sum(dpu_a);
+  (void)sum;
+  report(type, "sum", n);
+  volatile T d = dot(dpu_a, dpu_b);
+  (void)d;
+  report(type, "dot", n);
+}
+
+int main(void) {
+  std::printf("%-6s %-10s %10s %12s %10s\n", "type", "kernel", "elements",
+              "cycles", "cyc/elem");
+  for (uint32_t n : {1u << 16, 1u << 20, 1u << 22}) {
+    bench_type<int>("int", n);
+    bench_type<float>("float", n);
+  }
+
+  DpuRuntime::get().shutdown();
+  return 0;
+}
@@ -0,0 +1,298 @@
+/* Reports what logging costs the host per op.
+
+   Times c = a + b, alone and followed by reading c back, on vectors of a
+   few sizes, in nanoseconds per op at the level the library was built with:
+   wall time, and the CPU time of every host thread (submitting, completion
+   callbacks, log formatting), which leaves out the time the host only waits
+   for the DPUs.
+   The level is fixed at build time, so `make logging` rebuilds the library
+   at every LOG_LEVELS value and runs this each time with the same FILE: the
+   rows are appended to it, and every op is compared with the level 0 row of
+   the same op and size already there. The library logs to stdout, which
+   `make logging` discards so that only the host's cost counts; the tables
+   go to stderr.
+
+   A second table times Logger alone against a mutex around an ostream,
+   which is how lines used to be written, with lines shaped like those the
+   library logs per op at levels 1 and 2, from 1 and 4 threads.
+
+   Usage: logging [--output=FILE]
+*/
+
+#include <logger.h>
+#include <runtime.h>
+#include <vectordpu.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+constexpr uint32_t OPS = 64;
+constexpr uint32_t REPS = 5;  // best of
+constexpr uint32_t OPS_PER_THREAD = 1 << 14;
+constexpr uint32_t NUM_DPUS = 64;  // lines of launch arguments at level 2
+
+// ============================
+// The library's ops
+// ============================
+struct op_result {
+  std::string op;
+  uint32_t elements;
+  double wall_ns;  // per op
+  double cpu_ns;
+};
+
+double process_cpu_seconds() {
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Best wall and CPU time per op of REPS runs of OPS ops
+template <typename F>
+op_result best_per_op(const char* op, uint32_t n, F&& run) {
+  op_result best{op, n, 1e30, 1e30};
+  for (uint32_t r = 0; r < REPS; r++) {
+    double cpu_start = process_cpu_seconds();
+    auto start = std::chrono::steady_clock::now();
+    run();
+    std::chrono::duration<double> wall =
+        std::chrono::steady_clock::now() - start;
+    double cpu = process_cpu_seconds() - cpu_start;
+    best.wall_ns = std::min(best.wall_ns, wall.count() * 1e9 / OPS);
+    best.cpu_ns = std::min(best.cpu_ns, cpu * 1e9 / OPS);
+  }
+  return best;
+}
+
+std::vector<op_result> bench_ops(uint32_t n) {
+  vector<int> a(n), b(n), out(n);
+  for (uint32_t i = 0; i < n; i++) {
+    a[i] = static_cast<int>(i % 1000);
+    b[i] = static_cast<int>(i % 7);
+  }
+  auto da = dpu_vector<int>::from_cpu(a);
+  auto db = dpu_vector<int>::from_cpu(b);
+  dpu_vector<int> dc = da + db;
+  auto& queue = dc.stream().get_event_queue();
+  queue.wait();
+
+  op_result add = best_per_op("add", n, [&] {
+    for (uint32_t i = 0; i < OPS; i++) dc = da + db;
+    queue.wait();
+  });
+  op_result round_trip = best_per_op("add+to_cpu", n, [&] {
+    for (uint32_t i = 0; i < OPS; i++) {
+      dc = da + db;
+      dc.to_cpu_into(out);
+    }
+  });
+  return {add, round_trip};
+}
+
+// By op and size
+using op_baseline = std::map<std::pair<std::string, uint32_t>, op_result>;
+
+// Level 0 rows of output
+op_baseline read_baseline(const std::string& output) {
+  op_baseline baseline;
+  std::ifstream in(output);
+  std::string line;
+  while (std::getline(in, line)) {
+    char op[32];
+    int level;
+    op_result r;
+    if (std::sscanf(line.c_str(), "%d,%31[^,],%u,%lf,%lf", &level, op,
+                    &r.elements, &r.wall_ns, &r.cpu_ns) == 5 &&
+        level == 0) {
+      r.op = op;
+      baseline[{op, r.elements}] = r;
+    }
+  }
+  return baseline;
+}
+
+void write_results(const std::vector<op_result>& results,
+                   const std::string& output) {
+  FILE* out = std::fopen(output.c_str(), "a");
+  if (out == nullptr) {
+    std::perror(output.c_str());
+    std::exit(1);
+  }
+  std::fseek(out, 0, SEEK_END);
+  if (std::ftell(out) == 0) {
+    std::fprintf(out, "level,op,elements,wall_ns_per_op,cpu_ns_per_op\n");
+  }
+  for (const op_result& r : results) {
+    std::fprintf(out, "%d,%s,%u,%.6g,%.6g\n", Logger::level(), r.op.c_str(),
+                 r.elements, r.wall_ns, r.cpu_ns);
+  }
+  std::fclose(out);
+}
+
+// ============================
+// Logger alone
+// ============================
+std::ostream& operator<<(std::ostream& out, log_hex hex) {
+  return out << "0x" << std::hex << std::setfill('0') << std::setw(8)
+             << hex.value << std::dec << std::setfill(' ');
+}
+
+// Every line formatted by the thread logging it, under a lock
+class LockedLogger {
+ public:
+  explicit LockedLogger(std::ostream& out) : out_(out) {}
+
+  template <typename... Args>
+  void log(const Args&... args) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    (out_ << ... << args) << std::endl;
+  }
+
+ private:
+  std::mutex mtx_;
+  std::ostream& out_;
+};
+
+template <int Level, typename L>
+void log_op(L& logger, uint32_t op) {
+  logger.log("[EventQueue] Processing ", "COMPUTE", " event.");
+  logger.log("[task-logger] kernel=", "BINARY_INT_ADD",
+             " nr_of_dpus=", NUM_DPUS);
+  logger.log("[Event] Added completion callback.");
+  logger.log("[Event] Callback finished: ", "COMPUTE", " started=", true,
+             ", finished=1");
+  if constexpr (Level >= 2) {
+    for (uint32_t d = 0; d < NUM_DPUS; d++) {
+      logger.log("[task-logger] DPU[", d, "]\tkernel=", "BINARY_INT_ADD",
+                 " is_binary=1 num_elements=", op, " size_type=", 4,
+                 " lhs_offset=", log_hex{d * 64}, " rhs_offset=",
+                 log_hex{d * 64 + 16}, " res_offset=", log_hex{d * 64 + 32});
+    }
+  }
+}
+
+template <int Level>
+constexpr uint32_t lines_per_op() {
+  return Level == 1 ? 4 : 4 + NUM_DPUS;
+}
+
+// Nanoseconds per op of the slowest thread. With burst, every thread logs as
+// many ops as fit in half its ring and then flushes the logger, untimed, so
+// that it never waits for the formatting.
+template <int Level, typename L>
+double ns_per_op(L& logger, uint32_t num_threads, bool burst = false) {
+  uint32_t ops_per_burst = OPS_PER_THREAD;
+  if constexpr (std::is_same_v<L, Logger>) {
+    if (burst) {
+      ops_per_burst =
+          std::max<uint32_t>(Logger::RING_RECORDS / 2 / lines_per_op<Level>(),
+                             1);
+    }
+  }
+
+  std::vector<double> seconds(num_threads);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t] {
+      std::chrono::duration<double> elapsed{0};
+      for (uint32_t op = 0; op < OPS_PER_THREAD;) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < ops_per_burst; i++, op++) {
+          log_op<Level>(logger, op);
+        }
+        elapsed += std::chrono::steady_clock::now() - start;
+        if constexpr (std::is_same_v<L, Logger>) {
+          if (burst) logger.flush();
+        }
+      }
+      seconds[t] = elapsed.count();
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  double slowest = 0;
+  for (double s : seconds) slowest = std::max(slowest, s);
+  return slowest * 1e9 / OPS_PER_THREAD;
+}
+
+template <int Level>
+void bench_logger(uint32_t num_threads) {
+  std::ofstream null("/dev/null");
+  double locked, sustained, burst;
+  {
+    LockedLogger logger(null);
+    locked = ns_per_op<Level>(logger, num_threads);
+  }
+  {
+    Logger logger(null);
+    sustained = ns_per_op<Level>(logger, num_threads);
+    burst = ns_per_op<Level>(logger, num_threads, true);
+  }
+  std::fprintf(stderr, "%6d %8u %10u %14.1f %14.1f %14.1f\n", Level,
+               num_threads, lines_per_op<Level>(), locked, sustained, burst);
+}
+
+int main(int argc, char** argv) {
+  std::string output;
+  for (int i = 1; i < argc; i++) {
+    if (std::strncmp(argv[i], "--output=", 9) == 0) {
+      output = argv[i] + 9;
+    } else {
+      std::fprintf(stderr, "usage: %s [--output=FILE]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<op_result> results;
+  for (uint32_t n : {1u << 10, 1u << 16, 1u << 20}) {
+    for (const op_result& r : bench_ops(n)) results.push_back(r);
+  }
+  op_baseline baseline;
+  if (!output.empty()) {
+    baseline = read_baseline(output);
+    write_results(results, output);
+  }
+
+  std::fprintf(stderr, "library built at level %d\n", Logger::level());
+  std::fprintf(stderr, "%-12s %10s %12s %12s %12s %12s\n", "op",
+               "elements", "wall ns/op", "vs level 0", "cpu ns/op",
+               "vs level 0");
+  for (const op_result& r : results) {
+    auto base = baseline.find({r.op, r.elements});
+    std::fprintf(stderr, "%-12s %10u %12.0f ", r.op.c_str(), r.elements,
+                 r.wall_ns);
+    if (base == baseline.end()) {
+      std::fprintf(stderr, "%12s %12.0f %12s\n", "-", r.cpu_ns, "-");
+    } else {
+      std::fprintf(stderr, "%+12.0f %12.0f %+12.0f\n",
+                   r.wall_ns - base->second.wall_ns, r.cpu_ns,
+                   r.cpu_ns - base->second.cpu_ns);
+    }
+  }
+
+  // sustained: every thread logs without pause, so on few cores the
+  // formatting thread sets the pace. burst: what a thread logging between
+  // other work pays.
+  std::fprintf(stderr, "\n%6s %8s %10s %14s %14s %14s\n", "level", "threads",
+               "lines/op", "locked ns/op", "sustained", "burst");
+  for (uint32_t threads : {1u, 4u}) {
+    bench_logger<1>(threads);
+    bench_logger<2>(threads);
+  }
+
+  DpuRuntime::get().shutdown();
+  return 0;
+}
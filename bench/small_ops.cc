@@ -0,0 +1,51 @@
+/* Reports the throughput of chains of small elementwise ops.
+
+   With only a few elements per DPU the kernels themselves are short and
+   the host-side cost of every launch dominates. Each chain is run once with
+   one launch per op and once inside a dpu_batch, where the DPUs run up to
+   BATCH_MAX_COMMANDS ops per launch.
+*/
+
+#include <runtime.h>
+#include <vectordpu.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+template <typename F>
+double ops_per_second(uint32_t ops, F&& run) {
+  auto& queue = DpuRuntime::get().get_event_queue();
+  auto start = std::chrono::steady_clock::now();
+  run();
+  queue.wait();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return ops / elapsed.count();
+}
+
+void bench_size(uint32_t n, uint32_t ops) {
+  vector<int> a(n);
+  for (uint32_t i = 0; i < n; i++) a[i] = rand() % 100;
+  auto dpu_a = dpu_vector<int>::from_cpu(a);
+  dpu_vector<int> acc = dpu_a + 0;
+
+  double unbatched = ops_per_second(ops, [&] {
+    for (uint32_t i = 0; i < ops; i++) acc = acc + 1;
+  });
+  double batched = ops_per_second(ops, [&] {
+    dpu_batch batch;
+    for (uint32_t i = 0; i < ops; i++) acc = acc + 1;
+  });
+  std::printf("%10u %8u %14.0f %14.0f %8.2fx\n", n, ops, unbatched, batched,
+              batched / unbatched);
+}
+
+int main(void) {
+  std::printf("%10s %8s %14s %14s %9s\n", "elements", "ops", "ops/s",
+              "batched ops/s", "speedup");
+  for (uint32_t n : {1u << 8, 1u << 12, 1u << 16}) bench_size(n, 1024);
+
+  DpuRuntime::get().shutdown();
+  return 0;
+}
@@ -0,0 +1,65 @@
+/* Reports how fast host threads can submit work to one event queue.
+
+   Every thread owns its vectors and submits a chain of small elementwise
+   ops to the default stream. The submission rate only counts the time spent
+   in the submitting calls; waiting for the DPUs to run the ops is timed
+   separately, as it does not change with the number of threads.
+*/
+
+#include <runtime.h>
+#include <vectordpu.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+constexpr uint32_t ELEMENTS = 1 << 10;
+constexpr uint32_t OPS_PER_THREAD = 512;
+
+void bench_threads(uint32_t num_threads) {
+  vector<int> ones(ELEMENTS, 1);
+  vector<dpu_vector<int>> vecs;
+  for (uint32_t t = 0; t < num_threads; t++) {
+    vecs.push_back(dpu_vector<int>::from_cpu(ones));
+  }
+  auto& queue = vecs.front().stream().get_event_queue();
+  queue.wait();
+
+  vector<double> submit_seconds(num_threads);
+  vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t] {
+      auto begin = std::chrono::steady_clock::now();
+      for (uint32_t i = 0; i < OPS_PER_THREAD; i++) vecs[t] += 1;
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - begin;
+      submit_seconds[t] = elapsed.count();
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  std::chrono::duration<double> submitted =
+      std::chrono::steady_clock::now() - start;
+  queue.wait();
+  std::chrono::duration<double> total =
+      std::chrono::steady_clock::now() - start;
+
+  uint32_t ops = num_threads * OPS_PER_THREAD;
+  double slowest =
+      *std::max_element(submit_seconds.begin(), submit_seconds.end());
+  std::printf("%8u %10u %16.0f %16.0f %12.3f\n", num_threads, ops,
+              ops / submitted.count(), OPS_PER_THREAD / slowest,
+              (total - submitted).count() * 1e3);
+}
+
+int main(void) {
+  std::printf("%8s %10s %16s %16s %12s\n", "threads", "ops", "submitted/s",
+              "per thread/s", "drain ms");
+  for (uint32_t threads : {1u, 2u, 4u, 8u, 16u, 32u, 64u}) {
+    bench_threads(threads);
+  }
+
+  DpuRuntime::get().shutdown();
+  return 0;
+}
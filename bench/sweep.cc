@@ -0,0 +1,271 @@
+/* Sweeps vector size and element type over the host-side costs of the
+   library, for tracking regressions across builds.
+
+   For every size and type this reports:
+   - host->DPU and DPU->host bandwidth, with our from_cpu()/to_cpu() and
+     with the standard approach: the whole DPU set in a single synchronous
+     dpu_push_xfer, with the host array cut into one equal, padded chunk
+     per DPU;
+   - elementwise throughput of an add, a multiply and a fused a * b + a;
+   - the cost of allocating and freeing a vector.
+
+   It also reports the latency of an empty launch (one element per DPU),
+   issued alone and back to back. The DPU count comes from
+   VECTORDPU_NR_DPUS and the tasklet count from the build; `make sweep`
+   runs this for every combination of SWEEP_DPUS and SWEEP_TASKLETS. Sizes
+   that do not fit in the MRAM of the DPUs are skipped.
+
+   Usage: sweep [--csv | --json] [--output=FILE] [--sizes=N,N,...]
+   CSV and JSON (one object per line) rows are appended to FILE, with the
+   CSV header only when FILE is new, so that runs build one file.
+*/
+
+#include <runtime.h>
+#include <vectordpu.h>
+
+#include <dpu>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+constexpr uint32_t TRANSFER_REPS = 5;  // best of
+constexpr uint32_t OP_REPS = 8;
+constexpr uint32_t ALLOC_REPS = 1000;
+constexpr uint32_t LAUNCH_REPS = 256;
+// Vectors of a size live at once, with room to spare for fragmentation
+constexpr uint64_t LIVE_VECTORS = 8;
+
+struct result {
+  std::string benchmark;
+  std::string impl;
+  std::string type;
+  uint64_t elements;
+  double value;
+  std::string unit;
+};
+
+std::vector<result> results;
+
+template <typename F>
+double seconds(F&& run) {
+  auto start = std::chrono::steady_clock::now();
+  run();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+template <typename F>
+double best_seconds(uint32_t reps, F&& run) {
+  double best = 1e30;
+  for (uint32_t r = 0; r < reps; r++) best = std::min(best, seconds(run));
+  return best;
+}
+
+template <typename T>
+void bench_transfers(const char* type, uint32_t n) {
+  auto& runtime = DpuRuntime::get();
+  auto& queue = runtime.get_event_queue();
+  double gb = static_cast<double>(n) * sizeof(T) / 1e9;
+
+  vector<T> host(n), back(n);
+  for (uint32_t i = 0; i < n; i++) host[i] = static_cast<T>(i % 1000);
+
+  double h2d = best_seconds(TRANSFER_REPS, [&] {
+    dpu_vector<T> vec = dpu_vector<T>::from_cpu(host);
+    queue.wait();
+  });
+  dpu_vector<T> vec = dpu_vector<T>::from_cpu(host);
+  double d2h = best_seconds(TRANSFER_REPS, [&] { vec.to_cpu_into(back); });
+  results.push_back({"h2d", "vectordpu", type, n, gb / h2d, "GB/s"});
+  results.push_back({"d2h", "vectordpu", type, n, gb / d2h, "GB/s"});
+
+  // One chunk per DPU, padded to whole 8-byte words, at the MRAM offset of a
+  // vector large enough to hold them
+  uint32_t num_dpus = runtime.num_dpus();
+  uint32_t per_word = 8 / sizeof(T);
+  uint32_t chunk = ((n + num_dpus - 1) / num_dpus + per_word - 1) / per_word *
+                   per_word;
+  vector<T> padded(static_cast<size_t>(chunk) * num_dpus);
+  std::copy(host.begin(), host.end(), padded.begin());
+  dpu_vector<T> target(padded.size());
+  uint32_t offset = target.data_desc().first[0];
+  queue.wait();
+
+  auto push = [&](dpu_xfer_t direction) {
+    dpu_set_t dpu;
+    uint32_t idx_dpu;
+    DPU_FOREACH(runtime.dpu_set(), dpu, idx_dpu) {
+      DPU_ASSERT(dpu_prepare_xfer(dpu, &padded[idx_dpu * chunk]));
+    }
+    DPU_ASSERT(dpu_push_xfer(runtime.dpu_set(), direction,
+                             DPU_MRAM_HEAP_POINTER_NAME, offset,
+                             chunk * sizeof(T), DPU_XFER_DEFAULT));
+  };
+  h2d = best_seconds(TRANSFER_REPS, [&] { push(DPU_XFER_TO_DPU); });
+  d2h = best_seconds(TRANSFER_REPS, [&] { push(DPU_XFER_FROM_DPU); });
+  results.push_back({"h2d", "baseline", type, n, gb / h2d, "GB/s"});
+  results.push_back({"d2h", "baseline", type, n, gb / d2h, "GB/s"});
+}
+
+template <typename T>
+void bench_ops(const char* type, uint32_t n) {
+  auto& queue = DpuRuntime::get().get_event_queue();
+  vector<T> host(n);
+  for (uint32_t i = 0; i < n; i++) host[i] = static_cast<T>(i % 100 + 1);
+  dpu_vector<T> a = dpu_vector<T>::from_cpu(host);
+  dpu_vector<T> b = dpu_vector<T>::from_cpu(host);
+  dpu_vector<T> c(n);
+  queue.wait();
+
+  auto elements_per_second = [&](const char* op, auto&& run) {
+    run();  // warm up
+    queue.wait();
+    double s = seconds([&] {
+      for (uint32_t r = 0; r < OP_REPS; r++) run();
+      queue.wait();
+    });
+    results.push_back({op, "vectordpu", type, n, n * OP_REPS / s, "elem/s"});
+  };
+  elements_per_second("add", [&] { c = a + b; });
+  elements_per_second("mul", [&] { c = a * b; });
+  elements_per_second("fused", [&] { c = a * b + a; });
+
+  double alloc = seconds([&] {
+    for (uint32_t r = 0; r < ALLOC_REPS; r++) dpu_vector<T> v(n);
+  });
+  results.push_back(
+      {"alloc_free", "vectordpu", type, n, alloc * 1e6 / ALLOC_REPS, "us"});
+}
+
+void bench_launches() {
+  auto& runtime = DpuRuntime::get();
+  auto& queue = runtime.get_event_queue();
+  uint32_t n = runtime.num_dpus();  // one element per DPU
+  vector<int> ones(n, 1);
+  dpu_vector<int> a = dpu_vector<int>::from_cpu(ones);
+  dpu_vector<int> c(n);
+  queue.wait();
+
+  double alone = seconds([&] {
+    for (uint32_t r = 0; r < LAUNCH_REPS; r++) {
+      c = a + a;
+      queue.wait();
+    }
+  });
+  double pipelined = seconds([&] {
+    for (uint32_t r = 0; r < LAUNCH_REPS; r++) c = a + a;
+    queue.wait();
+  });
+  results.push_back(
+      {"launch", "alone", "int", n, alone * 1e6 / LAUNCH_REPS, "us"});
+  results.push_back(
+      {"launch", "pipelined", "int", n, pipelined * 1e6 / LAUNCH_REPS, "us"});
+}
+
+void write_results(const std::string& format, const std::string& output) {
+  auto& runtime = DpuRuntime::get();
+  uint32_t dpus = runtime.num_dpus();
+  uint32_t tasklets = runtime.num_tasklets();
+
+  FILE* out = stdout;
+  bool header = true;
+  if (!output.empty()) {
+    out = std::fopen(output.c_str(), "a");
+    if (out == nullptr) {
+      std::perror(output.c_str());
+      std::exit(1);
+    }
+    std::fseek(out, 0, SEEK_END);
+    header = std::ftell(out) == 0;
+  }
+
+  if (format == "csv") {
+    if (header) {
+      std::fprintf(out, "benchmark,impl,type,elements,dpus,tasklets,value,"
+                        "unit\n");
+    }
+    for (const result& r : results) {
+      std::fprintf(out, "%s,%s,%s,%llu,%u,%u,%.6g,%s\n", r.benchmark.c_str(),
+                   r.impl.c_str(), r.type.c_str(),
+                   static_cast<unsigned long long>(r.elements), dpus,
+                   tasklets, r.value, r.unit.c_str());
+    }
+  } else if (format == "json") {
+    for (const result& r : results) {
+      std::fprintf(out,
+                   "{\"benchmark\":\"%s\",\"impl\":\"%s\",\"type\":\"%s\","
+                   "\"elements\":%llu,\"dpus\":%u,\"tasklets\":%u,"
+                   "\"value\":%.6g,\"unit\":\"%s\"}\n",
+                   r.benchmark.c_str(), r.impl.c_str(), r.type.c_str(),
+                   static_cast<unsigned long long>(r.elements), dpus,
+                   tasklets, r.value, r.unit.c_str());
+    }
+  } else {
+    std::fprintf(out, "%u DPUs, %u tasklets\n", dpus, tasklets);
+    std::fprintf(out, "%-12s %-10s %-6s %12s %14s %-6s\n", "benchmark",
+                 "impl", "type", "elements", "value", "unit");
+    for (const result& r : results) {
+      std::fprintf(out, "%-12s %-10s %-6s %12llu %14.3f %-6s\n",
+                   r.benchmark.c_str(), r.impl.c_str(), r.type.c_str(),
+                   static_cast<unsigned long long>(r.elements), r.value,
+                   r.unit.c_str());
+    }
+  }
+  if (out != stdout) std::fclose(out);
+}
+
+int main(int argc, char** argv) {
+  std::string format = "table";
+  std::string output;
+  std::vector<uint32_t> sizes = {1u << 16, 1u << 20, 1u << 24};
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--csv") == 0) {
+      format = "csv";
+    } else if (std::strcmp(argv[i], "--json") == 0) {
+      format = "json";
+    } else if (std::strncmp(argv[i], "--output=", 9) == 0) {
+      output = argv[i] + 9;
+    } else if (std::strncmp(argv[i], "--sizes=", 8) == 0) {
+      sizes.clear();
+      for (char* s = argv[i] + 8; *s != '\0';) {
+        sizes.push_back(std::strtoul(s, &s, 0));
+        if (*s == ',') s++;
+      }
+    } else {
+      std::fprintf(stderr,
+                   "usage: %s [--csv | --json] [--output=FILE] "
+                   "[--sizes=N,N,...]\n",
+                   argv[0]);
+      return 1;
+    }
+  }
+
+  // The baseline pushes to every DPU at once, so the vectors must be spread
+  // over all of them
+  auto& runtime = DpuRuntime::get();
+  runtime.init();
+  runtime.partition(0);
+
+  bench_launches();
+  for (uint32_t n : sizes) {
+    uint64_t per_dpu = (n + runtime.num_dpus() - 1) / runtime.num_dpus();
+    if (LIVE_VECTORS * per_dpu * sizeof(int) > runtime.heap_bytes()) {
+      std::fprintf(stderr, "skipping %u elements: not enough MRAM\n", n);
+      continue;
+    }
+    bench_transfers<int>("int", n);
+    bench_transfers<float>("float", n);
+    bench_ops<int>("int", n);
+    bench_ops<float>("float", n);
+  }
+  write_results(format, output);
+
+  runtime.shutdown();
+  return 0;
+}
@@ -0,0 +1,60 @@
+/* Compares sleeping and spinning while waiting for the DPUs.
+
+   Every round launches a kernel, reads the result back and waits for it. The
+   latency is the wall time of a round; the CPU share is the CPU time the
+   waiting thread used over that wall time. With WaitMode::SPIN the waiting
+   thread polls the event and keeps a core busy, with WaitMode::BLOCK it
+   sleeps until the completion callback wakes it.
+*/
+
+#include <runtime.h>
+#include <vectordpu.h>
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+
+constexpr uint32_t ROUNDS = 64;
+
+double thread_cpu_seconds() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void bench_wait(const char* name, WaitMode mode, uint32_t n) {
+  Event::set_wait_mode(mode);
+
+  vector<int> a(n, 1), out(n);
+  auto acc = dpu_vector<int>::from_cpu(a);
+  auto& queue = acc.stream().get_event_queue();
+  queue.wait();
+
+  double cpu_start = thread_cpu_seconds();
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < ROUNDS; i++) {
+    acc += 1;
+    queue.wait(acc.to_cpu_async(out));
+  }
+  std::chrono::duration<double> wall =
+      std::chrono::steady_clock::now() - start;
+  double cpu = thread_cpu_seconds() - cpu_start;
+
+  std::printf("%10u %8s %14.1f %10.1f%%\n", n, name,
+              wall.count() / ROUNDS * 1e6, 100.0 * cpu / wall.count());
+}
+
+int main(void) {
+  // Up front, so that initializing the runtime (with VECTORDPU_WAIT set)
+  // cannot change the modes set below
+  DpuRuntime::get().init();
+  std::printf("%10s %8s %14s %11s\n", "elements", "wait", "round (us)",
+              "waiter cpu");
+  for (uint32_t n : {1u << 10, 1u << 16, 1u << 20}) {
+    bench_wait("spin", WaitMode::SPIN, n);
+    bench_wait("block", WaitMode::BLOCK, n);
+  }
+
+  DpuRuntime::get().shutdown();
+  return 0;
+}
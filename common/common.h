@@ -7,8 +7,30 @@
 #include <stdint.h>
 #endif
 
-#define BLOCK_SIZE_LOG2 5              // e.g., 32 elements per block
-#define BLOCK_SIZE (1U << BLOCK_SIZE_LOG2)
+// Stack of every tasklet, as the DPU program is built with (the Makefile
+// passes the same value to the host)
+#ifndef STACK_SIZE_DEFAULT
+#define STACK_SIZE_DEFAULT 1024
+#endif
+
+#define WRAM_BYTES (64 * 1024)
+// Globals of the DPU program and of its runtime; the program checks that its
+// own fit
+#define WRAM_GLOBAL_BYTES (4 * 1024)
+
+// WRAM set aside for the kernels' DMA buffers, shared by all tasklets: what
+// the tasklet stacks and the globals leave of the 64 KB.
+#define WRAM_BUFFER_BYTES \
+    (WRAM_BYTES - NR_TASKLETS * STACK_SIZE_DEFAULT - WRAM_GLOBAL_BYTES)
+#define DMA_MAX_BYTES 2048             // largest single MRAM<->WRAM transfer
+#define DMA_ALIGN(bytes) (((bytes) + 7U) & ~7U)
+
+// Size of one WRAM block for a kernel that needs nr_buffers of them in each
+// tasklet: the tasklet's share of WRAM, capped at the largest DMA transfer.
+#define TASKLET_BLOCK_BYTES(nr_buffers)                                  \
+    ((WRAM_BUFFER_BYTES / NR_TASKLETS / (nr_buffers)) > DMA_MAX_BYTES    \
+         ? DMA_MAX_BYTES                                                 \
+         : ((WRAM_BUFFER_BYTES / NR_TASKLETS / (nr_buffers)) & ~7U))
 
 typedef enum {
     // Unary
@@ -17,15 +39,84 @@ typedef enum {
     K_UNARY_INT_NEGATE,
     K_UNARY_INT_ABS,
 
-    // Binary
+    // Binary. Comparisons write 1 where they hold and 0 elsewhere.
     K_BINARY_FLOAT_ADD,
     K_BINARY_FLOAT_SUB,
+    K_BINARY_FLOAT_MUL,
+    K_BINARY_FLOAT_DIV,
+    K_BINARY_FLOAT_MIN,
+    K_BINARY_FLOAT_MAX,
+    K_BINARY_FLOAT_LT,
+    K_BINARY_FLOAT_EQ,
+    K_BINARY_FLOAT_GT,
     K_BINARY_INT_ADD,
     K_BINARY_INT_SUB,
+    K_BINARY_INT_MUL,
+    K_BINARY_INT_DIV,
+    K_BINARY_INT_MOD,
+    K_BINARY_INT_MIN,
+    K_BINARY_INT_MAX,
+    K_BINARY_INT_LT,
+    K_BINARY_INT_EQ,
+    K_BINARY_INT_GT,
+
+    // Vector-scalar. Integer multiply, divide and modulo by a power of two
+    // become shifts and masks.
+    K_SCALAR_FLOAT_ADD,
+    K_SCALAR_FLOAT_SUB,
+    K_SCALAR_FLOAT_RSUB,
+    K_SCALAR_FLOAT_MUL,
+    K_SCALAR_FLOAT_DIV,
+    K_SCALAR_INT_ADD,
+    K_SCALAR_INT_SUB,
+    K_SCALAR_INT_RSUB,
+    K_SCALAR_INT_MUL,
+    K_SCALAR_INT_DIV,
+    K_SCALAR_INT_MOD,
+
+    // Fused elementwise programs
+    K_FUSED_FLOAT,
+    K_FUSED_INT,
+
+    // Reductions
+    K_REDUCE_FLOAT_SUM,
+    K_REDUCE_FLOAT_MIN,
+    K_REDUCE_FLOAT_MAX,
+    K_REDUCE_FLOAT_DOT,
+    K_REDUCE_INT_SUM,
+    K_REDUCE_INT_MIN,
+    K_REDUCE_INT_MAX,
+    K_REDUCE_INT_DOT,
 
     KERNEL_COUNT
 } KernelID;
 
+// Opcodes of a fused elementwise program
+typedef enum {
+    F_NEGATE,
+    F_ABS,
+    F_ADD,
+    F_SUB,
+    F_MUL,
+    F_DIV,
+    F_MOD,  // int only
+    F_MIN,
+    F_MAX,
+    F_LT,
+    F_EQ,
+    F_GT,
+    F_COPY,
+    F_SELECT,  // dst = dst != 0 ? lhs : rhs
+
+    F_OP_COUNT
+} FusedOp;
+
+// A scalar operand, passed by value to the DPU
+typedef union {
+    int32_t i;
+    float f;
+} DPU_SCALAR;
+
 typedef struct {
     uint32_t kernel;       // 4
     uint32_t num_elements; // 4
@@ -42,11 +133,116 @@ typedef struct {
             uint32_t res_offset;
             uint32_t pad;   // pad unary to 12 bytes
         } unary;
+        struct {           // vector-scalar ops
+            uint32_t rhs_offset;
+            uint32_t res_offset;
+            DPU_SCALAR value;
+        } scalar;
+        struct {           // fused programs, see DPU_FUSED_PROGRAM
+            uint32_t res_offset;
+            uint32_t pad[2];
+        } fused;
+        struct {           // batched launches, see DPU_COMMAND
+            uint32_t num_commands;
+            uint32_t pad[2];
+        } batch;
     };
 
     uint8_t is_binary;     // 1
-    uint8_t pad[7];        // pad struct to 32 bytes
+    uint8_t pad0;          // 1
+    uint16_t block_bytes;  // 2, bytes per DMA block, 0 = kernel maximum
+    uint8_t pad[4];        // pad struct to 32 bytes
 } __attribute__((aligned(8))) DPU_LAUNCH_ARGS;
 
+// Per-DPU result of a reduction, combined across DPUs on the host
+typedef union {
+    int64_t i;             // int reductions
+    float f;               // float reductions
+} __attribute__((aligned(8))) DPU_REDUCE_RESULT;
+
+#define FUSED_MAX_INPUTS 4
+#define FUSED_MAX_REGS 8
+#define FUSED_MAX_INSTRS 16
+#define FUSED_MAX_CONSTANTS 4
+
+typedef struct {
+    uint8_t op;            // FusedOp
+    uint8_t dst;           // destination register
+    uint8_t lhs;           // first source register
+    uint8_t rhs;           // second source register (binary ops, select)
+} FUSED_INSTR;
+
+// A fused program works on registers that each hold one WRAM block. Input i
+// is read from MRAM into register i, constant c fills register num_inputs + c
+// once per launch, the instructions run over the whole block and result_reg
+// is written back to args.fused.res_offset.
+typedef struct {
+    uint32_t num_inputs;     // 4
+    uint32_t num_instrs;     // 4
+    uint32_t result_reg;     // 4
+    uint32_t num_constants;  // 4
+    uint32_t input_offsets[FUSED_MAX_INPUTS];  // 16
+    FUSED_INSTR code[FUSED_MAX_INSTRS];        // 64
+    DPU_SCALAR constants[FUSED_MAX_CONSTANTS]; // 16
+} __attribute__((aligned(8))) DPU_FUSED_PROGRAM;
+
+// A batched launch (args.kernel == K_BATCH) runs up to BATCH_MAX_COMMANDS
+// commands from the MRAM command buffer in order, with a tasklet barrier
+// between them. Each command is loaded into args, and into program for fused
+// kernels, before it runs.
+#define K_BATCH 0xFFFFFFFFU
+#define BATCH_MAX_COMMANDS 64
+
+typedef struct {
+    DPU_LAUNCH_ARGS args;                      // 32
+    DPU_FUSED_PROGRAM program;                 // 112, fused kernels only
+} __attribute__((aligned(8))) DPU_COMMAND;
+
+// Cycle counts of one command on one DPU, kept by the DPU program for every
+// command of the last launch. Tasklets interleave in the DPU pipeline, so a
+// tasklet's cycles are the time from its start to its end of the command,
+// including the cycles of the other tasklets in between.
+typedef struct {
+    uint32_t kernel;             // KernelID of the command
+    uint32_t cycles;             // from the command's start to its last tasklet
+    uint32_t tasklet_max_cycles; // slowest tasklet
+    uint32_t tasklet_min_cycles; // fastest tasklet
+    uint32_t busy_cycles;        // summed over tasklets
+    uint32_t dma_cycles;         // summed over tasklets, in MRAM transfers
+} __attribute__((aligned(8))) DPU_KERNEL_STATS;  // 24 bytes
+
+// WRAM blocks a kernel keeps per tasklet. The host and the DPU both bound
+// block_bytes by TASKLET_BLOCK_BYTES of this count.
+static inline uint32_t kernel_nr_buffers(uint32_t kernel) {
+    switch (kernel) {
+        case K_BINARY_FLOAT_ADD:
+        case K_BINARY_FLOAT_SUB:
+        case K_BINARY_FLOAT_MUL:
+        case K_BINARY_FLOAT_DIV:
+        case K_BINARY_FLOAT_MIN:
+        case K_BINARY_FLOAT_MAX:
+        case K_BINARY_FLOAT_LT:
+        case K_BINARY_FLOAT_EQ:
+        case K_BINARY_FLOAT_GT:
+        case K_BINARY_INT_ADD:
+        case K_BINARY_INT_SUB:
+        case K_BINARY_INT_MUL:
+        case K_BINARY_INT_DIV:
+        case K_BINARY_INT_MOD:
+        case K_BINARY_INT_MIN:
+        case K_BINARY_INT_MAX:
+        case K_BINARY_INT_LT:
+        case K_BINARY_INT_EQ:
+        case K_BINARY_INT_GT:
+        case K_REDUCE_FLOAT_DOT:
+        case K_REDUCE_INT_DOT:
+            return 2;
+        case K_FUSED_FLOAT:
+        case K_FUSED_INT:
+            return FUSED_MAX_REGS;
+        default:
+            return 1;
+    }
+}
 
 #endif // COMMON_H
\ No newline at end of file
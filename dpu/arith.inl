@@ -0,0 +1,51 @@
+#include <stdint.h>
+
+// Elementwise operations shared by the binary, vector-scalar and fused
+// kernels. Comparisons give 1 where they hold and 0 elsewhere.
+#define COPY(x) (x)
+#define ADD(x, y) ((x) + (y))
+#define SUB(x, y) ((x) - (y))
+#define MUL(x, y) ((x) * (y))
+#define DIV(x, y) ((x) / (y))
+#define MOD(x, y) ((x) % (y))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define LT(x, y) ((x) < (y))
+#define EQ(x, y) ((x) == (y))
+#define GT(x, y) ((x) > (y))
+
+// The DPU multiplies 8 by 8 bits in one instruction; a full 32-bit product
+// is a library call of a few dozen cycles. Most integer data (indices,
+// counts, fixed point) fits in 16 bits, so such operands are multiplied
+// from four 8-bit partial products, or from one when both fit in 8 bits.
+#define MUL8(x, y) ((uint32_t)(uint8_t)(x) * (uint8_t)(y))
+
+static inline int mul_int(int x, int y) {
+  uint32_t ux = x < 0 ? -(uint32_t)x : (uint32_t)x;
+  uint32_t uy = y < 0 ? -(uint32_t)y : (uint32_t)y;
+  uint32_t product;
+  if ((ux | uy) <= 0xFF) {
+    product = MUL8(ux, uy);
+  } else if ((ux | uy) <= 0xFFFF) {
+    product = MUL8(ux, uy) +
+              ((MUL8(ux >> 8, uy) + MUL8(ux, uy >> 8)) << 8) +
+              (MUL8(ux >> 8, uy >> 8) << 16);
+  } else {
+    // Wraps like the host does
+    return (int)((uint32_t)x * (uint32_t)y);
+  }
+  return (x ^ y) < 0 ? (int)-product : (int)product;
+}
+
+// A scalar 1 << shift turns an integer multiply, divide or modulo into
+// shifts and masks. Division truncates toward zero like C, so negative
+// dividends are biased by divisor - 1 before the arithmetic shift.
+static inline int pow2_shift(int s) {
+  if (s <= 0 || (s & (s - 1)) != 0) return -1;
+  return __builtin_ctz((uint32_t)s);
+}
+
+#define SHL(x, shift) ((int)((uint32_t)(x) << (shift)))
+#define SHR_TRUNC(x, shift) \
+  (((x) + (((x) >> 31) & ((1 << (shift)) - 1))) >> (shift))
+#define MASK_TRUNC(x, shift) ((x) - SHL(SHR_TRUNC(x, shift), shift))
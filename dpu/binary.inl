@@ -1,41 +1,168 @@
+#include <alloc.h>
 #include <mram.h>
-#define DEFINE_BINARY_KERNEL(TYPE, OP, SYMBOL)                              \
-  int binary_##TYPE##_##OP(void) {                                          \
-    unsigned int tasklet_id = me();                                         \
-    uint32_t num_elems = args.num_elements;                                 \
-                                                                            \
-    __mram_ptr TYPE *lhs_ptr = (__mram_ptr TYPE *)(args.binary.lhs_offset); \
-    __mram_ptr TYPE *rhs_ptr = (__mram_ptr TYPE *)(args.binary.rhs_offset); \
-    __mram_ptr TYPE *res_ptr = (__mram_ptr TYPE *)(args.binary.res_offset); \
-                                                                            \
-    __dma_aligned TYPE lhs_block[BLOCK_SIZE];                               \
-    __dma_aligned TYPE rhs_block[BLOCK_SIZE];                               \
-    __dma_aligned TYPE res_block[BLOCK_SIZE];                               \
-                                                                            \
-    for (uint32_t block_loc = tasklet_id << BLOCK_SIZE_LOG2;                \
-         block_loc < num_elems;                                             \
-         block_loc += (NR_TASKLETS << BLOCK_SIZE_LOG2)) {                   \
-      uint32_t block_elems = (block_loc + BLOCK_SIZE >= num_elems)          \
-                                 ? (num_elems - block_loc)                  \
-                                 : BLOCK_SIZE;                              \
-      uint32_t block_bytes = block_elems * sizeof(TYPE);                    \
-                                                                            \
-      mram_read((__mram_ptr void const *)(lhs_ptr + block_loc), lhs_block,  \
-                block_bytes);                                               \
-      mram_read((__mram_ptr void const *)(rhs_ptr + block_loc), rhs_block,  \
-                block_bytes);                                               \
-                                                                            \
-      for (uint32_t i = 0; i < block_elems; i++) {                          \
-        res_block[i] = lhs_block[i] SYMBOL rhs_block[i];                    \
-      }                                                                     \
-                                                                            \
-      mram_write(res_block, (__mram_ptr void *)(res_ptr + block_loc),       \
-                 block_bytes);                                              \
-    }                                                                       \
-    return 0;                                                               \
+
+// lhs and rhs blocks per tasklet; the result overwrites the lhs block
+#define BINARY_BLOCK_BYTES TASKLET_BLOCK_BYTES(2)
+
+#define DEFINE_BINARY_KERNEL(TYPE, OP, FUNC)                               \
+  int binary_##TYPE##_##OP(void) {                                         \
+    unsigned int tasklet_id = me();                                        \
+    uint32_t num_elems = args.num_elements;                                \
+    uint32_t block_size =                                                  \
+        launch_block_bytes(BINARY_BLOCK_BYTES) / sizeof(TYPE);             \
+                                                                           \
+    __mram_ptr TYPE *lhs_ptr =                                             \
+        (__mram_ptr TYPE *)MRAM_HEAP(args.binary.lhs_offset);              \
+    __mram_ptr TYPE *rhs_ptr =                                             \
+        (__mram_ptr TYPE *)MRAM_HEAP(args.binary.rhs_offset);              \
+    __mram_ptr TYPE *res_ptr =                                             \
+        (__mram_ptr TYPE *)MRAM_HEAP(args.binary.res_offset);              \
+                                                                           \
+    /* WRAM working buffers, sized from the tasklet's share of WRAM */     \
+    TYPE *lhs_block = (TYPE *)mem_alloc(block_size * sizeof(TYPE));        \
+    TYPE *rhs_block = (TYPE *)mem_alloc(block_size * sizeof(TYPE));        \
+                                                                           \
+    for (uint32_t block_loc = tasklet_id * block_size;                     \
+         block_loc < num_elems; block_loc += NR_TASKLETS * block_size) {   \
+      uint32_t block_elems = (block_loc + block_size >= num_elems)         \
+                                 ? (num_elems - block_loc)                 \
+                                 : block_size;                             \
+      uint32_t block_bytes = DMA_ALIGN(block_elems * sizeof(TYPE));        \
+                                                                           \
+      dma_read((__mram_ptr void const *)(lhs_ptr + block_loc), lhs_block,  \
+               block_bytes);                                               \
+      dma_read((__mram_ptr void const *)(rhs_ptr + block_loc), rhs_block,  \
+               block_bytes);                                               \
+                                                                           \
+      for (uint32_t i = 0; i < block_elems; i++) {                         \
+        lhs_block[i] = FUNC(lhs_block[i], rhs_block[i]);                   \
+      }                                                                    \
+                                                                           \
+      dma_write(lhs_block, (__mram_ptr void *)(res_ptr + block_loc),       \
+                block_bytes);                                              \
+    }                                                                      \
+    return 0;                                                              \
+  }
+
+DEFINE_BINARY_KERNEL(float, add, ADD)
+DEFINE_BINARY_KERNEL(float, subtract, SUB)
+DEFINE_BINARY_KERNEL(float, multiply, MUL)
+DEFINE_BINARY_KERNEL(float, divide, DIV)
+DEFINE_BINARY_KERNEL(float, min, MIN)
+DEFINE_BINARY_KERNEL(float, max, MAX)
+DEFINE_BINARY_KERNEL(float, less, LT)
+DEFINE_BINARY_KERNEL(float, equal, EQ)
+DEFINE_BINARY_KERNEL(float, greater, GT)
+DEFINE_BINARY_KERNEL(int, add, ADD)
+DEFINE_BINARY_KERNEL(int, subtract, SUB)
+DEFINE_BINARY_KERNEL(int, multiply, mul_int)
+DEFINE_BINARY_KERNEL(int, divide, DIV)
+DEFINE_BINARY_KERNEL(int, modulo, MOD)
+DEFINE_BINARY_KERNEL(int, min, MIN)
+DEFINE_BINARY_KERNEL(int, max, MAX)
+DEFINE_BINARY_KERNEL(int, less, LT)
+DEFINE_BINARY_KERNEL(int, equal, EQ)
+DEFINE_BINARY_KERNEL(int, greater, GT)
+
+#define SCALAR_ADD(x, s) ((x) + (s))
+#define SCALAR_SUB(x, s) ((x) - (s))
+#define SCALAR_RSUB(x, s) ((s) - (x))
+#define SCALAR_MUL(x, s) ((x) * (s))
+#define SCALAR_DIV(x, s) ((x) / (s))
+#define SCALAR_MOD(x, s) ((x) % (s))
+
+// A single block per tasklet; the scalar stays in WRAM with the launch args
+#define SCALAR_BLOCK_BYTES TASKLET_BLOCK_BYTES(1)
+
+#define DEFINE_SCALAR_KERNEL(TYPE, FIELD, OP, FUNC)                      \
+  int scalar_##TYPE##_##OP(void) {                                       \
+    unsigned int tasklet_id = me();                                      \
+    uint32_t num_elems = args.num_elements;                              \
+    uint32_t block_size =                                                \
+        launch_block_bytes(SCALAR_BLOCK_BYTES) / sizeof(TYPE);           \
+    TYPE scalar = args.scalar.value.FIELD;                               \
+                                                                         \
+    __mram_ptr TYPE *rhs_ptr =                                           \
+        (__mram_ptr TYPE *)MRAM_HEAP(args.scalar.rhs_offset);            \
+    __mram_ptr TYPE *res_ptr =                                           \
+        (__mram_ptr TYPE *)MRAM_HEAP(args.scalar.res_offset);            \
+                                                                         \
+    TYPE *block = (TYPE *)mem_alloc(block_size * sizeof(TYPE));          \
+                                                                         \
+    for (uint32_t block_loc = tasklet_id * block_size;                   \
+         block_loc < num_elems; block_loc += NR_TASKLETS * block_size) { \
+      uint32_t block_elems = (block_loc + block_size >= num_elems)       \
+                                 ? (num_elems - block_loc)               \
+                                 : block_size;                           \
+      uint32_t block_bytes = DMA_ALIGN(block_elems * sizeof(TYPE));      \
+                                                                         \
+      dma_read((__mram_ptr void const *)(rhs_ptr + block_loc), block,    \
+               block_bytes);                                             \
+                                                                         \
+      for (uint32_t i = 0; i < block_elems; i++) {                       \
+        block[i] = FUNC(block[i], scalar);                               \
+      }                                                                  \
+                                                                         \
+      dma_write(block, (__mram_ptr void *)(res_ptr + block_loc),         \
+                block_bytes);                                            \
+    }                                                                    \
+    return 0;                                                            \
+  }
+
+DEFINE_SCALAR_KERNEL(float, f, add, SCALAR_ADD)
+DEFINE_SCALAR_KERNEL(float, f, subtract, SCALAR_SUB)
+DEFINE_SCALAR_KERNEL(float, f, rsubtract, SCALAR_RSUB)
+DEFINE_SCALAR_KERNEL(float, f, multiply, SCALAR_MUL)
+DEFINE_SCALAR_KERNEL(float, f, divide, SCALAR_DIV)
+DEFINE_SCALAR_KERNEL(int, i, add, SCALAR_ADD)
+DEFINE_SCALAR_KERNEL(int, i, subtract, SCALAR_SUB)
+DEFINE_SCALAR_KERNEL(int, i, rsubtract, SCALAR_RSUB)
+
+// Integer multiply, divide and modulo by a scalar check once per launch
+// whether it is a power of two and then run POW2(x, shift) for every element
+// instead of FUNC(x, scalar)
+#define DEFINE_SCALAR_POW2_KERNEL(OP, FUNC, POW2)                        \
+  int scalar_int_##OP(void) {                                            \
+    unsigned int tasklet_id = me();                                      \
+    uint32_t num_elems = args.num_elements;                              \
+    uint32_t block_size =                                                \
+        launch_block_bytes(SCALAR_BLOCK_BYTES) / sizeof(int);            \
+    int scalar = args.scalar.value.i;                                    \
+    int shift = pow2_shift(scalar);                                      \
+                                                                         \
+    __mram_ptr int *rhs_ptr =                                            \
+        (__mram_ptr int *)MRAM_HEAP(args.scalar.rhs_offset);             \
+    __mram_ptr int *res_ptr =                                            \
+        (__mram_ptr int *)MRAM_HEAP(args.scalar.res_offset);             \
+                                                                         \
+    int *block = (int *)mem_alloc(block_size * sizeof(int));             \
+                                                                         \
+    for (uint32_t block_loc = tasklet_id * block_size;                   \
+         block_loc < num_elems; block_loc += NR_TASKLETS * block_size) { \
+      uint32_t block_elems = (block_loc + block_size >= num_elems)       \
+                                 ? (num_elems - block_loc)               \
+                                 : block_size;                           \
+      uint32_t block_bytes = DMA_ALIGN(block_elems * sizeof(int));       \
+                                                                         \
+      dma_read((__mram_ptr void const *)(rhs_ptr + block_loc), block,    \
+               block_bytes);                                             \
+                                                                         \
+      if (shift >= 0) {                                                  \
+        for (uint32_t i = 0; i < block_elems; i++) {                     \
+          block[i] = POW2(block[i], shift);                              \
+        }                                                                \
+      } else {                                                           \
+        for (uint32_t i = 0; i < block_elems; i++) {                     \
+          block[i] = FUNC(block[i], scalar);                             \
+        }                                                                \
+      }                                                                  \
+                                                                         \
+      dma_write(block, (__mram_ptr void *)(res_ptr + block_loc),         \
+                block_bytes);                                            \
+    }                                                                    \
+    return 0;                                                            \
   }
 
-DEFINE_BINARY_KERNEL(float, add, +)
-DEFINE_BINARY_KERNEL(float, subtract, -)
-DEFINE_BINARY_KERNEL(int, add, +)
-DEFINE_BINARY_KERNEL(int, subtract, -)
\ No newline at end of file
+DEFINE_SCALAR_POW2_KERNEL(multiply, mul_int, SHL)
+DEFINE_SCALAR_POW2_KERNEL(divide, SCALAR_DIV, SHR_TRUNC)
+DEFINE_SCALAR_POW2_KERNEL(modulo, SCALAR_MOD, MASK_TRUNC)
@@ -0,0 +1,103 @@
+#include <alloc.h>
+#include <mram.h>
+
+// One block per register
+#define FUSED_BLOCK_BYTES TASKLET_BLOCK_BYTES(FUSED_MAX_REGS)
+
+#define FUSED_REG(r) (regs + (r) * block_size)
+
+#define FUSED_UNARY_CASE(OP_ID, FUNC)              \
+  case OP_ID:                                      \
+    for (uint32_t i = 0; i < block_elems; i++) {   \
+      dst[i] = FUNC(lhs[i]);                       \
+    }                                              \
+    break;
+
+#define FUSED_BINARY_CASE(OP_ID, FUNC)             \
+  case OP_ID:                                      \
+    for (uint32_t i = 0; i < block_elems; i++) {   \
+      dst[i] = FUNC(lhs[i], rhs[i]);               \
+    }                                              \
+    break;
+
+// MUL_FUNC multiplies two elements; INT_CASES holds the integer-only ops
+// The condition is read from the destination register itself
+#define FUSED_SELECT_CASE(OP_ID)                   \
+  case OP_ID:                                      \
+    for (uint32_t i = 0; i < block_elems; i++) {   \
+      dst[i] = dst[i] != 0 ? lhs[i] : rhs[i];      \
+    }                                              \
+    break;
+
+#define DEFINE_FUSED_KERNEL(TYPE, FIELD, MUL_FUNC, INT_CASES)            \
+  int fused_##TYPE(void) {                                               \
+    unsigned int tasklet_id = me();                                      \
+    uint32_t num_elems = args.num_elements;                              \
+    uint32_t block_size =                                                \
+        launch_block_bytes(FUSED_BLOCK_BYTES) / sizeof(TYPE);            \
+                                                                         \
+    __mram_ptr TYPE *res_ptr =                                           \
+        (__mram_ptr TYPE *)MRAM_HEAP(args.fused.res_offset);             \
+                                                                         \
+    /* WRAM register file, one block per register */                     \
+    TYPE *regs =                                                         \
+        (TYPE *)mem_alloc(FUSED_MAX_REGS * block_size * sizeof(TYPE));   \
+                                                                         \
+    /* Constant registers are filled once and never overwritten */       \
+    for (uint32_t c = 0; c < program.num_constants; c++) {               \
+      TYPE *reg = FUSED_REG(program.num_inputs + c);                     \
+      TYPE value = program.constants[c].FIELD;                           \
+      for (uint32_t i = 0; i < block_size; i++) {                        \
+        reg[i] = value;                                                  \
+      }                                                                  \
+    }                                                                    \
+                                                                         \
+    for (uint32_t block_loc = tasklet_id * block_size;                   \
+         block_loc < num_elems; block_loc += NR_TASKLETS * block_size) { \
+      uint32_t block_elems = (block_loc + block_size >= num_elems)       \
+                                 ? (num_elems - block_loc)               \
+                                 : block_size;                           \
+      uint32_t block_bytes = DMA_ALIGN(block_elems * sizeof(TYPE));      \
+                                                                         \
+      /* Each input is read once per block */                            \
+      for (uint32_t in = 0; in < program.num_inputs; in++) {             \
+        __mram_ptr TYPE *in_ptr =                                        \
+            (__mram_ptr TYPE *)MRAM_HEAP(program.input_offsets[in]);     \
+        dma_read((__mram_ptr void const *)(in_ptr + block_loc),          \
+                 FUSED_REG(in), block_bytes);                            \
+      }                                                                  \
+                                                                         \
+      for (uint32_t pc = 0; pc < program.num_instrs; pc++) {             \
+        FUSED_INSTR instr = program.code[pc];                            \
+        TYPE *dst = FUSED_REG(instr.dst);                                \
+        const TYPE *lhs = FUSED_REG(instr.lhs);                          \
+        const TYPE *rhs = FUSED_REG(instr.rhs);                          \
+        switch (instr.op) {                                              \
+          FUSED_UNARY_CASE(F_NEGATE, NEGATE)                             \
+          FUSED_UNARY_CASE(F_ABS, ABS)                                   \
+          FUSED_BINARY_CASE(F_ADD, ADD)                                  \
+          FUSED_BINARY_CASE(F_SUB, SUB)                                  \
+          FUSED_BINARY_CASE(F_MUL, MUL_FUNC)                             \
+          FUSED_BINARY_CASE(F_DIV, DIV)                                  \
+          FUSED_BINARY_CASE(F_MIN, MIN)                                  \
+          FUSED_BINARY_CASE(F_MAX, MAX)                                  \
+          FUSED_BINARY_CASE(F_LT, LT)                                    \
+          FUSED_BINARY_CASE(F_EQ, EQ)                                    \
+          FUSED_BINARY_CASE(F_GT, GT)                                    \
+          FUSED_UNARY_CASE(F_COPY, COPY)                                 \
+          FUSED_SELECT_CASE(F_SELECT)                                    \
+          INT_CASES                                                      \
+          default:                                                       \
+            return -1;                                                   \
+        }                                                                \
+      }                                                                  \
+                                                                         \
+      /* Only the result is written back */                              \
+      dma_write(FUSED_REG(program.result_reg),                           \
+                (__mram_ptr void *)(res_ptr + block_loc), block_bytes);  \
+    }                                                                    \
+    return 0;                                                            \
+  }
+
+DEFINE_FUSED_KERNEL(float, f, MUL, )
+DEFINE_FUSED_KERNEL(int, i, mul_int, FUSED_BINARY_CASE(F_MOD, MOD))
@@ -3,29 +3,158 @@
 #include <common.h>
 #include <defs.h>
 #include <mram.h>
+#include <perfcounter.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 __host DPU_LAUNCH_ARGS args;
+__host DPU_FUSED_PROGRAM program;
+__host DPU_REDUCE_RESULT reduce_result;
+__host uint64_t kernel_cycles;  // cycles spent in the last launch
+
+__mram_noinit DPU_COMMAND commands[BATCH_MAX_COMMANDS];
+// Cycle counts of every command of the last launch, read by the host when it
+// profiles kernels
+__mram_noinit DPU_KERNEL_STATS kernel_stats[BATCH_MAX_COMMANDS];
+
+// Cycles each tasklet spent in the current command, and in MRAM transfers
+uint32_t tasklet_cycles[NR_TASKLETS];
+uint32_t tasklet_dma_cycles[NR_TASKLETS];
 
 BARRIER_INIT(my_barrier, NR_TASKLETS);
 
+// Host offsets are relative to the start of the MRAM heap
+#define MRAM_HEAP(offset) ((uint32_t)DPU_MRAM_HEAP_POINTER + (offset))
+
+// Block size requested by the host, bounded by the kernel's WRAM share
+static inline uint32_t launch_block_bytes(uint32_t max_bytes) {
+  uint32_t bytes = args.block_bytes & ~7U;
+  return (bytes == 0 || bytes > max_bytes) ? max_bytes : bytes;
+}
+
+// MRAM transfers of the kernels, timed per tasklet
+static inline void dma_read(__mram_ptr void const *from, void *to,
+                            uint32_t bytes) {
+  uint32_t start = perfcounter_get();
+  mram_read(from, to, bytes);
+  tasklet_dma_cycles[me()] += perfcounter_get() - start;
+}
+
+static inline void dma_write(const void *from, __mram_ptr void *to,
+                             uint32_t bytes) {
+  uint32_t start = perfcounter_get();
+  mram_write(from, to, bytes);
+  tasklet_dma_cycles[me()] += perfcounter_get() - start;
+}
+
+#include "arith.inl"
 #include "binary.inl"
 #include "unary.inl"
+#include "fused.inl"
+#include "reduce.inl"
+
+// The globals above, leaving 1 KB of WRAM_GLOBAL_BYTES to the runtime's own,
+// and at least one 8-byte block per fused register for every tasklet
+_Static_assert(sizeof(args) + sizeof(program) + sizeof(reduce_result) +
+                       sizeof(kernel_cycles) + sizeof(tasklet_cycles) +
+                       sizeof(tasklet_dma_cycles) + sizeof(reduce_partials) +
+                       1024 <=
+                   WRAM_GLOBAL_BYTES,
+               "DPU globals do not fit in WRAM_GLOBAL_BYTES");
+_Static_assert(WRAM_BUFFER_BYTES >= NR_TASKLETS * FUSED_MAX_REGS * 8,
+               "Tasklet stacks leave no WRAM for the kernels' buffers");
 
 int (*kernels[KERNEL_COUNT])(void) = {
     // Unary
     unary_float_negate, unary_float_abs, unary_int_negate, unary_int_abs,
 
     // Binary
-    binary_float_add, binary_float_subtract, binary_int_add,
-    binary_int_subtract};
+    binary_float_add, binary_float_subtract, binary_float_multiply,
+    binary_float_divide, binary_float_min, binary_float_max, binary_float_less,
+    binary_float_equal, binary_float_greater, binary_int_add,
+    binary_int_subtract, binary_int_multiply, binary_int_divide,
+    binary_int_modulo, binary_int_min, binary_int_max, binary_int_less,
+    binary_int_equal, binary_int_greater,
+
+    // Vector-scalar
+    scalar_float_add, scalar_float_subtract, scalar_float_rsubtract,
+    scalar_float_multiply, scalar_float_divide, scalar_int_add,
+    scalar_int_subtract, scalar_int_rsubtract, scalar_int_multiply,
+    scalar_int_divide, scalar_int_modulo,
+
+    // Fused
+    fused_float, fused_int,
+
+    // Reductions
+    reduce_float_sum, reduce_float_min, reduce_float_max, reduce_float_dot,
+    reduce_int_sum, reduce_int_min, reduce_int_max, reduce_int_dot};
+
+static bool is_fused(uint32_t kernel) {
+  return kernel == K_FUSED_FLOAT || kernel == K_FUSED_INT;
+}
+
+// Loads a command of the batch into args and program (tasklet 0 only)
+static void load_command(uint32_t c) {
+  mram_read(&commands[c].args, &args, sizeof(args));
+  if (is_fused(args.kernel)) {
+    mram_read(&commands[c].program, &program, sizeof(program));
+  }
+}
+
+// Summarizes command c once every tasklet has finished it (tasklet 0 only)
+static void record_stats(uint32_t c, uint32_t cycles) {
+  DPU_KERNEL_STATS stats;
+  stats.kernel = args.kernel;
+  stats.cycles = cycles;
+  stats.tasklet_max_cycles = 0;
+  stats.tasklet_min_cycles = UINT32_MAX;
+  stats.busy_cycles = 0;
+  stats.dma_cycles = 0;
+  for (uint32_t t = 0; t < NR_TASKLETS; t++) {
+    if (tasklet_cycles[t] > stats.tasklet_max_cycles) {
+      stats.tasklet_max_cycles = tasklet_cycles[t];
+    }
+    if (tasklet_cycles[t] < stats.tasklet_min_cycles) {
+      stats.tasklet_min_cycles = tasklet_cycles[t];
+    }
+    stats.busy_cycles += tasklet_cycles[t];
+    stats.dma_cycles += tasklet_dma_cycles[t];
+  }
+  mram_write(&stats, &kernel_stats[c], sizeof(stats));
+}
 
 int main(void) {
-  // args.kernel indicates which kernel to run
-  if (args.kernel < KERNEL_COUNT) {
-    return kernels[args.kernel]();
-  } else {
-    // invalid kernel ID
-    return -1;
+  // A plain launch runs args as a single command
+  bool batch = args.kernel == K_BATCH;
+  uint32_t num_commands = batch ? args.batch.num_commands : 1;
+  if (num_commands > BATCH_MAX_COMMANDS) return -1;
+
+  if (me() == 0) perfcounter_config(COUNT_CYCLES, true);
+  // Every tasklet has read args before tasklet 0 replaces them
+  barrier_wait(&my_barrier);
+
+  int ret = 0;
+  for (uint32_t c = 0; c < num_commands; c++) {
+    // Kernels take their WRAM buffers from the heap, which is reset for
+    // every command
+    if (me() == 0) {
+      if (batch) load_command(c);
+      mem_reset();
+    }
+    barrier_wait(&my_barrier);
+    uint32_t start = perfcounter_get();
+    tasklet_dma_cycles[me()] = 0;
+
+    // args.kernel indicates which kernel to run
+    int r = args.kernel < KERNEL_COUNT ? kernels[args.kernel]() : -1;
+    if (r != 0) ret = r;
+    tasklet_cycles[me()] = perfcounter_get() - start;
+
+    // The next command may only be loaded once every tasklet is done
+    barrier_wait(&my_barrier);
+    if (me() == 0) record_stats(c, perfcounter_get() - start);
   }
-}
\ No newline at end of file
+
+  if (me() == 0) kernel_cycles = perfcounter_get();
+  return ret;
+}
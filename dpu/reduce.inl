@@ -0,0 +1,107 @@
+#include <alloc.h>
+#include <float.h>
+#include <mram.h>
+
+#define REDUCE_BLOCK_BYTES TASKLET_BLOCK_BYTES(1)
+#define DOT_BLOCK_BYTES TASKLET_BLOCK_BYTES(2)
+
+#define REDUCE_SUM(acc, x) ((acc) + (x))
+#define REDUCE_MIN(acc, x) ((x) < (acc) ? (x) : (acc))
+#define REDUCE_MAX(acc, x) ((x) > (acc) ? (x) : (acc))
+
+// Per-tasklet partial results, combined by tasklet 0 after the barrier
+DPU_REDUCE_RESULT reduce_partials[NR_TASKLETS];
+
+#define COMBINE_PARTIALS(ACC_TYPE, FIELD, FUNC)      \
+  reduce_partials[tasklet_id].FIELD = acc;           \
+  barrier_wait(&my_barrier);                         \
+  if (tasklet_id == 0) {                             \
+    ACC_TYPE total = reduce_partials[0].FIELD;       \
+    for (uint32_t t = 1; t < NR_TASKLETS; t++) {     \
+      total = FUNC(total, reduce_partials[t].FIELD); \
+    }                                                \
+    reduce_result.FIELD = total;                     \
+  }
+
+#define DEFINE_REDUCE_KERNEL(TYPE, ACC_TYPE, FIELD, OP, FUNC, IDENTITY)    \
+  int reduce_##TYPE##_##OP(void) {                                         \
+    unsigned int tasklet_id = me();                                        \
+    uint32_t num_elems = args.num_elements;                                \
+    uint32_t block_size =                                                  \
+        launch_block_bytes(REDUCE_BLOCK_BYTES) / sizeof(TYPE);             \
+                                                                           \
+    __mram_ptr TYPE *src_ptr =                                             \
+        (__mram_ptr TYPE *)MRAM_HEAP(args.unary.rhs_offset);               \
+                                                                           \
+    TYPE *src_block = (TYPE *)mem_alloc(block_size * sizeof(TYPE));        \
+    ACC_TYPE acc = IDENTITY;                                               \
+                                                                           \
+    for (uint32_t block_loc = tasklet_id * block_size;                     \
+         block_loc < num_elems; block_loc += NR_TASKLETS * block_size) {   \
+      uint32_t block_elems = (block_loc + block_size >= num_elems)         \
+                                 ? (num_elems - block_loc)                 \
+                                 : block_size;                             \
+      uint32_t block_bytes = DMA_ALIGN(block_elems * sizeof(TYPE));        \
+                                                                           \
+      dma_read((__mram_ptr void const *)(src_ptr + block_loc), src_block,  \
+               block_bytes);                                               \
+                                                                           \
+      for (uint32_t i = 0; i < block_elems; i++) {                         \
+        acc = FUNC(acc, src_block[i]);                                     \
+      }                                                                    \
+    }                                                                      \
+                                                                           \
+    COMBINE_PARTIALS(ACC_TYPE, FIELD, FUNC)                                \
+    return 0;                                                              \
+  }
+
+#define DEFINE_DOT_KERNEL(TYPE, ACC_TYPE, FIELD)                           \
+  int reduce_##TYPE##_dot(void) {                                          \
+    unsigned int tasklet_id = me();                                        \
+    uint32_t num_elems = args.num_elements;                                \
+    uint32_t block_size =                                                  \
+        launch_block_bytes(DOT_BLOCK_BYTES) / sizeof(TYPE);                \
+                                                                           \
+    __mram_ptr TYPE *lhs_ptr =                                             \
+        (__mram_ptr TYPE *)MRAM_HEAP(args.binary.lhs_offset);              \
+    __mram_ptr TYPE *rhs_ptr =                                             \
+        (__mram_ptr TYPE *)MRAM_HEAP(args.binary.rhs_offset);              \
+    /* dot(a, a) (norm2) reads its operand once */                         \
+    int same_operand = args.binary.lhs_offset == args.binary.rhs_offset;   \
+                                                                           \
+    TYPE *lhs_block = (TYPE *)mem_alloc(block_size * sizeof(TYPE));        \
+    TYPE *rhs_block = (TYPE *)mem_alloc(block_size * sizeof(TYPE));        \
+    TYPE *rhs_vals = same_operand ? lhs_block : rhs_block;                 \
+    ACC_TYPE acc = 0;                                                      \
+                                                                           \
+    for (uint32_t block_loc = tasklet_id * block_size;                     \
+         block_loc < num_elems; block_loc += NR_TASKLETS * block_size) {   \
+      uint32_t block_elems = (block_loc + block_size >= num_elems)         \
+                                 ? (num_elems - block_loc)                 \
+                                 : block_size;                             \
+      uint32_t block_bytes = DMA_ALIGN(block_elems * sizeof(TYPE));        \
+                                                                           \
+      dma_read((__mram_ptr void const *)(lhs_ptr + block_loc), lhs_block,  \
+               block_bytes);                                               \
+      if (!same_operand) {                                                 \
+        dma_read((__mram_ptr void const *)(rhs_ptr + block_loc),           \
+                 rhs_block, block_bytes);                                  \
+      }                                                                    \
+                                                                           \
+      for (uint32_t i = 0; i < block_elems; i++) {                         \
+        acc += (ACC_TYPE)lhs_block[i] * (ACC_TYPE)rhs_vals[i];             \
+      }                                                                    \
+    }                                                                      \
+                                                                           \
+    COMBINE_PARTIALS(ACC_TYPE, FIELD, REDUCE_SUM)                          \
+    return 0;                                                              \
+  }
+
+DEFINE_REDUCE_KERNEL(float, float, f, sum, REDUCE_SUM, 0.0f)
+DEFINE_REDUCE_KERNEL(float, float, f, min, REDUCE_MIN, FLT_MAX)
+DEFINE_REDUCE_KERNEL(float, float, f, max, REDUCE_MAX, -FLT_MAX)
+DEFINE_DOT_KERNEL(float, float, f)
+DEFINE_REDUCE_KERNEL(int, int64_t, i, sum, REDUCE_SUM, 0)
+DEFINE_REDUCE_KERNEL(int, int64_t, i, min, REDUCE_MIN, INT32_MAX)
+DEFINE_REDUCE_KERNEL(int, int64_t, i, max, REDUCE_MAX, INT32_MIN)
+DEFINE_DOT_KERNEL(int, int64_t, i)
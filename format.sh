@@ -2,3 +2,5 @@
 clang-format -i dpu/*
 clang-format -i host/*
 clang-format -i test/*
+clang-format -i bench/*
+clang-format -i tools/*
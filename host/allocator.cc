@@ -1,38 +1,36 @@
 
 #include "allocator.h"
 
-#include <algorithm>
+#include <iterator>
 #include <stdexcept>
 
+#include "common.h"
 #include "logger.h"
 
 allocator::allocator(uint32_t start_addr, std::size_t total_size,
                      std::size_t num_dpus)
-    : start_addr_(start_addr), total_size_(total_size), num_dpus_(num_dpus) {
-  // Initialize internal state, but do NOT pre-allocate vectors
-  ptrs_.resize(num_dpus_, start_addr_);  // all start at base address
-  sizes_.resize(num_dpus_, total_size_ / num_dpus_);
-  offsets_.resize(num_dpus_, 0);
-  free_list_.resize(num_dpus_);
-}
+    : num_dpus_(num_dpus),
+      start_addr_(start_addr),
+      heap_size_(total_size / num_dpus) {}
 
 vector_desc allocator::allocate_upmem_vector(std::size_t n,
                                              std::size_t size_type) {
   // grab lock
   std::lock_guard<std::mutex> lock(this->lock);
   std::size_t num_dpus = this->num_dpus_;
-  vector<uint32_t> vec_ptrs(num_dpus);
-  vector<uint32_t> vec_sizes(num_dpus);
 
   size_t size_per_dpu = n / num_dpus;
   size_t remainder = n % num_dpus;
 
-  for (size_t i = 0; i < num_dpus; i++) {
-    size_t alloc_size = (size_per_dpu + (i < remainder ? 1 : 0)) * size_type;
-    uint32_t addr = allocate(i, alloc_size);  // use bump/free-list allocator
+  // The first DPUs hold the remainder, so theirs is the largest slice. DPU
+  // kernels move whole 8-byte words, so slices are padded to 8 bytes.
+  size_t max_size = (size_per_dpu + (remainder ? 1 : 0)) * size_type;
+  uint32_t addr = allocate(DMA_ALIGN(max_size));
 
-    vec_ptrs[i] = addr;
-    vec_sizes[i] = alloc_size;
+  vector<uint32_t> vec_ptrs(num_dpus, addr);
+  vector<uint32_t> vec_sizes(num_dpus);
+  for (size_t i = 0; i < num_dpus; i++) {
+    vec_sizes[i] = (size_per_dpu + (i < remainder ? 1 : 0)) * size_type;
   }
 
   return std::make_pair(vec_ptrs, vec_sizes);
@@ -40,80 +38,69 @@ vector_desc allocator::allocate_upmem_vector(std::size_t n,
 
 void allocator::deallocate_upmem_vector(vector_desc& data) {
   std::lock_guard<std::mutex> lock(this->lock);
-  for (size_t i = 0; i < num_dpus_; ++i) {
-    uint32_t addr = data.first[i];
-    size_t size = data.second[i];
-    deallocate(i, addr, size);
-  }
+  deallocate(data.first[0], DMA_ALIGN(data.second[0]));
 }
 
-uint32_t allocator::allocate(std::size_t dpu_id, std::size_t n) {
-  if (dpu_id >= num_dpus_) throw std::out_of_range("Invalid DPU ID");
+bool allocator::empty() {
+  std::lock_guard<std::mutex> lock(this->lock);
+  return offset_ == 0;
+}
 
-  auto& flist = free_list_[dpu_id];
+uint32_t allocator::allocate(std::size_t n) {
+  if (n == 0) return start_addr_ + offset_;
 
   // best-fit free block
-  auto best_it = flist.end();
-  size_t best_size = SIZE_MAX;
-  for (auto it = flist.begin(); it != flist.end(); ++it) {
-    if (it->size >= n && it->size < best_size) {
-      best_it = it;
-      best_size = it->size;
-    }
-  }
-
-  if (best_it != flist.end()) {
-    uint32_t addr = best_it->addr;
-    if (best_it->size > n) {
-      best_it->addr += n;
-      best_it->size -= n;
-    } else {
-      flist.erase(best_it);
-    }
+  auto best = free_by_size_.lower_bound({n, 0});
+  if (best != free_by_size_.end()) {
+    auto [size, addr] = *best;
+    erase_free(free_by_addr_.find(addr));
+    if (size > n) insert_free(addr + n, size - n);
     return addr;
   }
 
-  if (offsets_[dpu_id] + n > sizes_[dpu_id]) {
+  if (offset_ + n > heap_size_) {
     throw std::runtime_error("DPU out of memory!");
   }
 
-  uint32_t addr = ptrs_[dpu_id] + offsets_[dpu_id];
-  offsets_[dpu_id] += n;
+  uint32_t addr = start_addr_ + offset_;
+  offset_ += n;
   return addr;
 }
 
-void allocator::deallocate(std::size_t dpu_id, uint32_t addr, size_t size) {
-  if (dpu_id >= num_dpus_) throw std::out_of_range("Invalid DPU ID");
-
-  FreeBlock new_block{addr, size};
-  auto& flist = free_list_[dpu_id];
-
-  // Find the first block whose address is greater than new_block
-  auto it = std::find_if(flist.begin(), flist.end(),
-                         [&](const FreeBlock& b) { return b.addr > addr; });
-
-  // Insert the new block at the found position
-  auto inserted = flist.insert(it, new_block);
+void allocator::deallocate(uint32_t addr, size_t size) {
+  if (size == 0) return;
 
   // Merge with previous block if adjacent
-  if (inserted != flist.begin()) {
-    auto prev = inserted - 1;
-    if (prev->addr + prev->size == inserted->addr) {
-      prev->size += inserted->size;
-      inserted = flist.erase(inserted);
+  auto next = free_by_addr_.lower_bound(addr);
+  if (next != free_by_addr_.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == addr) {
+      addr = prev->first;
+      size += prev->second;
+      erase_free(prev);
     }
   }
 
   // Merge with next block if adjacent
-  if (inserted + 1 != flist.end()) {
-    auto next = inserted + 1;
-    if (inserted->addr + inserted->size == next->addr) {
-      inserted->size += next->size;
-      flist.erase(next);
-    }
+  if (next != free_by_addr_.end() && addr + size == next->first) {
+    size += next->second;
+    erase_free(next);
+  }
+
+  // A block at the top of the heap goes back to the bump pointer
+  if (addr + size == start_addr_ + offset_) {
+    offset_ = addr - start_addr_;
+    return;
   }
+  insert_free(addr, size);
+}
+
+void allocator::insert_free(uint32_t addr, size_t size) {
+  free_by_addr_.emplace(addr, size);
+  free_by_size_.emplace(size, addr);
 }
 
-vector_desc allocator::get_vector_desc() const {
-  return std::make_pair(ptrs_, sizes_);
+void allocator::erase_free(std::map<uint32_t, std::size_t>::iterator it) {
+  free_by_size_.erase({it->second, it->first});
+  free_by_addr_.erase(it);
 }
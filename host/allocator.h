@@ -1,7 +1,9 @@
 #pragma once
 
 #include <cstdint>
+#include <map>
 #include <mutex>
+#include <set>
 #include <utility>
 #include <vector>
 
@@ -10,11 +12,9 @@ using std::vector;
 using vector_desc =
     std::pair<vector<uint32_t>, vector<uint32_t>>;  // ptrs and sizes
 
-struct FreeBlock {
-  uint32_t addr;
-  size_t size;
-};
-
+// Every vector is spread evenly over the DPUs, so all DPUs share one heap
+// layout: a vector takes the same block on every DPU, sized for its largest
+// per-DPU slice, and the heap state is kept once for all of them.
 class allocator {
  public:
   allocator(uint32_t start_addr, std::size_t total_size, std::size_t num_dpus);
@@ -22,24 +22,28 @@ class allocator {
   vector_desc allocate_upmem_vector(std::size_t n, std::size_t size_type);
   void deallocate_upmem_vector(vector_desc &data);
 
+  // Whether every vector has been deallocated
+  bool empty();
+
  private:
-  uint32_t start_addr_;  // starting base address
-  std::size_t total_size_;
   std::size_t num_dpus_;
+  uint32_t start_addr_;     // starting base address
+  std::size_t heap_size_;   // heap size per DPU
+  std::size_t offset_ = 0;  // bump pointer, the top of the used heap
 
-  vector<uint32_t> ptrs_;                // base addresses per DPU
-  vector<uint32_t> sizes_;               // total size per DPU
-  vector<uint32_t> offsets_;             // bump pointer per DPU
-  vector<vector<FreeBlock>> free_list_;  // free blocks per DPU
+  // Free blocks below the bump pointer, by address to merge neighbours and by
+  // (size, address) to find the best fit
+  std::map<uint32_t, std::size_t> free_by_addr_;
+  std::set<std::pair<std::size_t, uint32_t>> free_by_size_;
 
-  // Allocate 'n' units on a specific DPU
-  uint32_t allocate(std::size_t dpu_id, std::size_t n);
+  // Allocate 'n' bytes on every DPU
+  uint32_t allocate(std::size_t n);
 
   // Deallocate a block and merge adjacent free blocks
-  void deallocate(std::size_t dpu_id, uint32_t addr, size_t size);
+  void deallocate(uint32_t addr, size_t size);
 
-  // Get vector_desc (pointers and sizes per DPU)
-  vector_desc get_vector_desc() const;
+  void insert_free(uint32_t addr, size_t size);
+  void erase_free(std::map<uint32_t, std::size_t>::iterator it);
 
   std::mutex lock;
-};
\ No newline at end of file
+};
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+
+#include "logger.h"
+#include "logger.inl"
+#include "runtime.h"
+#include "vectordpu.h"
+
+namespace {
+
+constexpr uint32_t MIN_BLOCK_BYTES = 8;
+constexpr int RUNS_PER_SIZE = 3;
+
+// Fewest DPU cycles over a few runs of the kernel at the current block size
+uint64_t measure(const std::function<void()>& run) {
+  auto& runtime = DpuRuntime::get();
+  uint64_t best = std::numeric_limits<uint64_t>::max();
+  for (int i = 0; i < RUNS_PER_SIZE; i++) {
+    run();
+    best = std::min(best, runtime.last_kernel_cycles());
+  }
+  return best;
+}
+
+// Powers of two from MIN_BLOCK_BYTES up to the kernel maximum, which is
+// tried as well when it is not a power of two itself
+void tune_kernel(KernelID kernel, const std::function<void()>& run) {
+  auto& runtime = DpuRuntime::get();
+  uint32_t max_bytes = runtime.max_block_bytes(kernel);
+  uint32_t best_bytes = max_bytes;
+  uint64_t best_cycles = std::numeric_limits<uint64_t>::max();
+
+  for (uint32_t bytes = MIN_BLOCK_BYTES;; bytes *= 2) {
+    bytes = std::min(bytes, max_bytes);
+    runtime.set_block_bytes(kernel, bytes);
+    uint64_t cycles = measure(run);
+    if (cycles < best_cycles) {
+      best_cycles = cycles;
+      best_bytes = bytes;
+    }
+    if (bytes == max_bytes) break;
+  }
+
+  runtime.set_block_bytes(kernel, best_bytes);
+  runtime.get_logger().log("[autotune] ", kernel_id_to_string(kernel), " ",
+                           best_bytes, " bytes, ", best_cycles, " cycles");
+}
+
+template <typename T>
+void tune_type(uint32_t n) {
+  vector<T> a(n), b(n), c(n);
+  for (uint32_t i = 0; i < n; i++) {
+    a[i] = static_cast<T>(rand() % 100);
+    b[i] = static_cast<T>(rand() % 100 + 1);  // also a divisor
+    c[i] = static_cast<T>(rand() % 100);
+  }
+  auto dpu_a = dpu_vector<T>::from_cpu(a);
+  auto dpu_b = dpu_vector<T>::from_cpu(b);
+  auto dpu_c = dpu_vector<T>::from_cpu(c);
+  dpu_vector<T> res(n);
+
+  using unary = UnaryKernelSelector<T>;
+  using binary = BinaryKernelSelector<T>;
+  using reduce = ReduceKernelSelector<T>;
+
+  tune_kernel(unary::negate(), [&] { res = -dpu_a; });
+  tune_kernel(unary::abs(), [&] { res = abs(dpu_a); });
+  tune_kernel(binary::add(), [&] { res = dpu_a + dpu_b; });
+  tune_kernel(binary::sub(), [&] { res = dpu_a - dpu_b; });
+  tune_kernel(binary::mul(), [&] { res = dpu_a * dpu_b; });
+  tune_kernel(binary::div(), [&] { res = dpu_a / dpu_b; });
+  if constexpr (std::is_integral_v<T>) {
+    tune_kernel(binary::mod(), [&] { res = dpu_a % dpu_b; });
+  }
+  tune_kernel(binary::min(), [&] { res = min(dpu_a, dpu_b); });
+  tune_kernel(binary::max(), [&] { res = max(dpu_a, dpu_b); });
+  tune_kernel(binary::lt(), [&] { res = dpu_a < dpu_b; });
+  tune_kernel(binary::eq(), [&] { res = dpu_a == dpu_b; });
+  tune_kernel(binary::gt(), [&] { res = dpu_a > dpu_b; });
+  tune_kernel(FusedKernelSelector<T>::program(),
+              [&] { res = abs(dpu_a + dpu_b - dpu_c); });
+  tune_kernel(reduce::sum(), [&] { reduce_sum(dpu_a); });
+  tune_kernel(reduce::min(), [&] { reduce_min(dpu_a); });
+  tune_kernel(reduce::max(), [&] { reduce_max(dpu_a); });
+  tune_kernel(reduce::dot(), [&] { dot(dpu_a, dpu_b); });
+}
+
+}  // namespace
+
+void autotune_block_sizes(uint32_t n) {
+  tune_type<int>(n);
+  tune_type<float>(n);
+  DpuRuntime::get().save_tuning(DpuRuntime::tuning_file_path());
+}
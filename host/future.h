@@ -0,0 +1,283 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "queue.h"
+#include "runtime.h"
+#include "small_function.h"
+#include "vectordpu.h"
+
+// ============================
+// Futures
+// ============================
+// The result of work that has been submitted to a stream but may still be
+// running: the host can prepare the next batch and collect the result later
+// with get(), or co_await it from a coroutine. Move-only.
+template <typename T>
+class dpu_future {
+ public:
+  dpu_future() = default;
+  // Ready once event has finished; result then produces the value
+  dpu_future(std::shared_ptr<Event> event, EventQueue& queue,
+             small_function<T()> result)
+      : event_(std::move(event)), queue_(&queue), result_(std::move(result)) {}
+
+  dpu_future(dpu_future&&) = default;
+  dpu_future& operator=(dpu_future&&) = default;
+
+  bool valid() const { return static_cast<bool>(result_); }
+  bool ready() const { return event_->finished.load(); }
+
+  // Blocks until the value is available
+  void wait() const { queue_->wait(event_); }
+
+  // Blocks until the value is available and hands it over; once only
+  T get() {
+    assert(valid());
+    wait();
+    return take();
+  }
+
+  // A future of fn(value), ready at the same time
+  template <typename F>
+  auto then(F fn) && -> dpu_future<std::invoke_result_t<F, T>> {
+    using R = std::invoke_result_t<F, T>;
+    return dpu_future<R>(
+        event_, *queue_,
+        [result = std::move(result_), fn = std::move(fn)]() mutable -> R {
+          return fn(result());
+        });
+  }
+
+  const std::shared_ptr<Event>& event() const { return event_; }
+
+  // co_await suspends the coroutine until the value is available and resumes
+  // it on the runtime's completion thread
+  auto operator co_await() & { return awaiter{*this}; }
+  auto operator co_await() && { return awaiter{*this}; }
+
+ private:
+  struct awaiter {
+    dpu_future& future;
+
+    bool await_ready() const { return future.ready(); }
+    bool await_suspend(std::coroutine_handle<> handle) {
+      // Whatever is still queued or batched has to be issued to ever finish
+      future.queue_->flush_batch();
+      return future.event_->then([handle] {
+        DpuRuntime::get().completion_thread().post([handle] {
+          handle.resume();
+        });
+      });
+    }
+    T await_resume() { return future.take(); }
+  };
+
+  T take() {
+    small_function<T()> result = std::move(result_);
+    return result();
+  }
+
+  std::shared_ptr<Event> event_;
+  EventQueue* queue_ = nullptr;
+  small_function<T()> result_;
+};
+
+// ============================
+// Asynchronous transfers
+// ============================
+// Reads v back into a host vector owned by the future
+template <typename T>
+dpu_future<vector<T>> to_cpu_async(const dpu_vector<T>& v) {
+  auto out = std::make_shared<vector<T>>(v.size());
+  dpu_vector<T> handle = v;
+  std::shared_ptr<Event> e = handle.to_cpu_async(*out);
+  e->host_res = out;
+  return dpu_future<vector<T>>(e, v.stream().get_event_queue(),
+                               [out] { return std::move(*out); });
+}
+
+// Evaluates expr and reads the result back
+template <typename T>
+dpu_future<vector<T>> to_cpu_async(const dpu_expr<T>& expr) {
+  return to_cpu_async(dpu_vector<T>(expr));
+}
+
+// Uploads data, which the future keeps until the transfer has finished. The
+// vector can be used in further ops right away, since they run after the
+// transfer anyway; the future only tells when the upload itself is done.
+template <typename T>
+dpu_future<dpu_vector<T>> from_cpu_async(vector<T> data, DpuStream& stream) {
+  auto owned = std::make_shared<vector<T>>(std::move(data));
+  dpu_vector<T> vec =
+      dpu_vector<T>::from_cpu(std::span<const T>(*owned), stream);
+
+  // A fence reading the vector finishes once the upload has
+  std::shared_ptr<Event> fence = Event::create(Event::OperationType::FENCE);
+  fence->reads = {vec.buffer_id()};
+  fence->res = vec.buffer();
+  fence->host_res = owned;
+  stream.get_event_queue().submit(fence);
+  return dpu_future<dpu_vector<T>>(fence, stream.get_event_queue(),
+                                   [vec] { return vec; });
+}
+
+template <typename T>
+dpu_future<dpu_vector<T>> from_cpu_async(vector<T> data) {
+  return from_cpu_async(std::move(data), default_stream());
+}
+
+// ============================
+// Asynchronous ops
+// ============================
+// Elementwise ops never block: they return a dpu_vector (or expression) whose
+// value is computed by the DPUs in submission order. These make the point at
+// which it has been computed visible to the host.
+
+// Evaluates expr into a new vector, ready once the DPUs have written it
+template <typename T>
+dpu_future<dpu_vector<T>> evaluate_async(const dpu_expr<T>& expr) {
+  dpu_vector<T> vec(expr);
+  DpuStream& stream = vec.stream();
+  std::shared_ptr<Event> fence = Event::create(Event::OperationType::FENCE);
+  fence->reads = {vec.buffer_id()};
+  fence->res = vec.buffer();
+  stream.get_event_queue().submit(fence);
+  return dpu_future<dpu_vector<T>>(fence, stream.get_event_queue(),
+                                   [vec] { return vec; });
+}
+
+// Reductions that return as soon as they are submitted. The result is
+// combined in the type the DPUs accumulated it in and converted to R.
+template <typename R, typename T, typename Combine>
+dpu_future<R> reduce_async(const dpu_vector<T>& lhs, const dpu_vector<T>& rhs,
+                           KernelID kernel_id, bool is_binary,
+                           Combine combine) {
+  DpuStream& stream = lhs.stream();
+  auto results =
+      std::make_shared<vector<DPU_REDUCE_RESULT>>(stream.num_dpus());
+  std::shared_ptr<Event> xfer =
+      submit_reduce(lhs, rhs, kernel_id, is_binary, results);
+  return dpu_future<R>(xfer, stream.get_event_queue(),
+                       [results, lhs, combine] {
+                         std::optional<reduce_acc_t<T>> total;
+                         fold_reduce_results<T>(lhs.data_desc().second,
+                                                results->data(), 0,
+                                                lhs.stream().num_dpus(),
+                                                combine, total);
+                         return static_cast<R>(
+                             total.value_or(reduce_acc_t<T>{}));
+                       });
+}
+
+template <typename T>
+dpu_future<T> reduce_sum_async(const dpu_vector<T>& a) {
+  return reduce_async<T>(a, a, ReduceKernelSelector<T>::sum(), false,
+                         [](auto x, auto y) { return x + y; });
+}
+
+template <typename T>
+dpu_future<T> reduce_min_async(const dpu_vector<T>& a) {
+  return reduce_async<T>(a, a, ReduceKernelSelector<T>::min(), false,
+                         [](auto x, auto y) { return std::min(x, y); });
+}
+
+template <typename T>
+dpu_future<T> reduce_max_async(const dpu_vector<T>& a) {
+  return reduce_async<T>(a, a, ReduceKernelSelector<T>::max(), false,
+                         [](auto x, auto y) { return std::max(x, y); });
+}
+
+template <typename T>
+dpu_future<T> dot_async(const dpu_vector<T>& a, const dpu_vector<T>& b) {
+  assert(a.size() == b.size());
+  return reduce_async<T>(a, b, ReduceKernelSelector<T>::dot(), true,
+                         [](auto x, auto y) { return x + y; });
+}
+
+// The root of the total as the DPUs accumulated it, as norm2() takes
+template <typename T>
+dpu_future<double> norm2_async(const dpu_vector<T>& a) {
+  return reduce_async<double>(a, a, ReduceKernelSelector<T>::dot(), true,
+                              [](auto x, auto y) { return x + y; })
+      .then([](double d) { return std::sqrt(d); });
+}
+
+// ============================
+// Coroutines
+// ============================
+// A coroutine that may co_await dpu_futures. It starts running when it is
+// called and runs up to its first co_await on the calling thread; the rest
+// runs on the runtime's completion thread. get() blocks until it has
+// returned and hands over its value (or rethrows its exception).
+template <typename T>
+class dpu_task {
+ public:
+  struct promise_type {
+    std::optional<T> value;
+    std::exception_ptr error;
+    // Outside the frame: the task may destroy the frame as soon as it is set
+    std::shared_ptr<std::atomic<bool>> done =
+        std::make_shared<std::atomic<bool>>(false);
+
+    dpu_task get_return_object() {
+      return dpu_task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    // Stays suspended at the end, so the task can read the value
+    auto final_suspend() noexcept {
+      struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+        void await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+          std::shared_ptr<std::atomic<bool>> done = h.promise().done;
+          done->store(true, std::memory_order_release);
+          done->notify_all();
+        }
+        void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    void return_value(T v) { value = std::move(v); }
+    void unhandled_exception() { error = std::current_exception(); }
+  };
+
+  dpu_task(dpu_task&& other) noexcept
+      : handle_(std::exchange(other.handle_, nullptr)),
+        done_(std::move(other.done_)) {}
+  dpu_task& operator=(dpu_task&&) = delete;
+  ~dpu_task() {
+    if (handle_) {
+      wait();
+      handle_.destroy();
+    }
+  }
+
+  bool done() const { return done_->load(std::memory_order_acquire); }
+  void wait() const { done_->wait(false, std::memory_order_acquire); }
+
+  T get() {
+    wait();
+    auto& promise = handle_.promise();
+    if (promise.error) std::rethrow_exception(promise.error);
+    return std::move(*promise.value);
+  }
+
+ private:
+  explicit dpu_task(std::coroutine_handle<promise_type> handle)
+      : handle_(handle), done_(handle.promise().done) {}
+
+  std::coroutine_handle<promise_type> handle_;
+  std::shared_ptr<std::atomic<bool>> done_;
+};
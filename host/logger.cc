@@ -0,0 +1,178 @@
+#include "logger.h"
+
+#include <algorithm>
+#include <charconv>
+
+namespace {
+
+template <typename T>
+T read(const char*& p) {
+  T value;
+  std::memcpy(&value, p, sizeof(T));
+  p += sizeof(T);
+  return value;
+}
+
+}  // namespace
+
+Logger::~Logger() {
+  {
+    std::lock_guard<std::mutex> lock(wake_lock_);
+    stop_ = true;
+  }
+  wake_.notify_one();
+  if (thread_.joinable()) thread_.join();
+  flush();
+}
+
+int Logger::level() { return DPU_LOG_LEVEL; }
+
+Logger::Ring& Logger::thread_ring() {
+  // Gives the ring back when the thread exits, for another thread to take
+  // over, so that short-lived threads do not each leave one behind
+  struct Handle {
+    uint64_t logger = UINT64_MAX;
+    std::shared_ptr<Ring> ring;
+    ~Handle() {
+      if (ring) ring->in_use.store(false, std::memory_order_release);
+    }
+  };
+  thread_local Handle handle;
+  if (handle.logger == id_) return *handle.ring;
+
+  // First line of this thread on this logger
+  if (handle.ring) handle.ring->in_use.store(false, std::memory_order_release);
+  std::shared_ptr<Ring> ring;
+  {
+    std::lock_guard<std::mutex> lock(rings_lock_);
+    for (auto& r : rings_) {
+      bool in_use = false;
+      if (r->in_use.compare_exchange_strong(in_use, true,
+                                            std::memory_order_acq_rel)) {
+        ring = r;
+        break;
+      }
+    }
+    if (!ring) {
+      ring = std::make_shared<Ring>();
+      rings_.push_back(ring);
+    }
+    if (!thread_.joinable()) thread_ = std::thread(&Logger::run, this);
+  }
+  handle.logger = id_;
+  handle.ring = std::move(ring);
+  return *handle.ring;
+}
+
+void Logger::wait_for_room(Ring& ring, uint64_t head) {
+  wake_.notify_one();
+  while (head - ring.tail.load(std::memory_order_acquire) == RING_RECORDS) {
+    std::this_thread::yield();
+  }
+}
+
+void Logger::run() {
+  std::unique_lock<std::mutex> lock(wake_lock_);
+  while (!stop_) {
+    wake_.wait_for(lock, FLUSH_INTERVAL);
+    lock.unlock();
+    flush();
+    lock.lock();
+  }
+}
+
+void Logger::flush() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  drain_locked();
+}
+
+void Logger::drain_locked() {
+  std::vector<std::pair<Ring*, uint64_t>> heads;
+  pending_.clear();
+  {
+    std::lock_guard<std::mutex> lock(rings_lock_);
+    for (auto& ring : rings_) {
+      uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+      uint64_t head = ring->head.load(std::memory_order_acquire);
+      for (uint64_t i = tail; i < head; i++) {
+        const Record& r = ring->records[i % RING_RECORDS];
+        pending_.emplace_back(r.time, &r);
+      }
+      if (head != tail) heads.emplace_back(ring.get(), head);
+    }
+  }
+  if (pending_.empty()) return;
+
+  std::stable_sort(
+      pending_.begin(), pending_.end(),
+      [](const auto& a, const auto& b) { return a.first < b.first; });
+  for (const auto& [time, record] : pending_) format(*record);
+  stream_.flush();
+  for (auto [ring, head] : heads) {
+    ring->tail.store(head, std::memory_order_release);
+  }
+}
+
+void Logger::format(const Record& r) {
+  // Formatted into line_ and written at once
+  line_.resize(2 * RECORD_BYTES);
+  char* out = line_.data();
+  auto ensure = [&](std::size_t bytes) {
+    std::size_t used = out - line_.data();
+    if (used + bytes > line_.size()) line_.resize(2 * (used + bytes));
+    out = line_.data() + used;
+  };
+  auto number = [&](auto value, auto... format) {
+    ensure(32);
+    out = std::to_chars(out, out + 32, value, format...).ptr;
+  };
+
+  const char* p = r.data;
+  const char* end = r.data + r.size;
+  while (p < end) {
+    switch (static_cast<Tag>(*p++)) {
+      case Tag::INT:
+        number(read<int64_t>(p));
+        break;
+      case Tag::UINT:
+        number(read<uint64_t>(p));
+        break;
+      case Tag::DOUBLE:
+        number(read<double>(p));
+        break;
+      case Tag::CHAR:
+        ensure(1);
+        *out++ = read<char>(p);
+        break;
+      case Tag::STRING: {
+        uint16_t size = read<uint16_t>(p);
+        ensure(size);
+        std::memcpy(out, p, size);
+        out += size;
+        p += size;
+        break;
+      }
+      case Tag::HEX: {
+        uint64_t value = read<uint64_t>(p);
+        int digits = 8;
+        while (digits < 16 && (value >> (4 * digits)) != 0) digits++;
+        ensure(2 + digits);
+        *out++ = '0';
+        *out++ = 'x';
+        for (int d = digits - 1; d >= 0; d--) {
+          *out++ = "0123456789abcdef"[(value >> (4 * d)) & 0xF];
+        }
+        break;
+      }
+      case Tag::POINTER:
+        ensure(2);
+        *out++ = '0';
+        *out++ = 'x';
+        number(read<uintptr_t>(p), 16);
+        break;
+    }
+  }
+  ensure(1);
+  *out++ = '\n';
+  stream_.write(line_.data(), out - line_.data());
+}
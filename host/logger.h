@@ -1,28 +1,87 @@
 #pragma once
 #include <common.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <string_view>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 using vector_desc =
     std::pair<std::vector<uint32_t>, std::vector<uint32_t>>;  // ptrs and sizes
 
-class Logger {
-  std::mutex mtx_;
-  std::ostream& stream_;
+// Messages up to this level are compiled in: 0 compiles logging out, 1 logs
+// the runtime, the allocations and every event, 2 also every copy, transfer
+// and launch argument. -DENABLE_DPU_LOGGING without a level means 1.
+#ifndef ENABLE_DPU_LOGGING
+#define DPU_LOG_LEVEL 0
+#else
+#define DPU_LOG_LEVEL ENABLE_DPU_LOGGING
+#endif
+
+// Logs its arguments as one line on the runtime's logger if level is compiled
+// in. Otherwise the arguments are not evaluated and no code is generated.
+#define DPU_LOG(level, ...)                            \
+  do {                                                 \
+    if constexpr ((level) <= DPU_LOG_LEVEL) {          \
+      DpuRuntime::get().get_logger().log(__VA_ARGS__); \
+    }                                                  \
+  } while (0)
+
+// Logged as 0x and 8 hex digits
+struct log_hex {
+  uint64_t value;
+};
 
+// Logs lines from any number of threads without making them wait for each
+// other or for the output. log() encodes its arguments as a binary record
+// into a ring buffer of the calling thread, lock free, and a background
+// thread formats the records of every ring onto the stream, oldest first.
+// Strings are copied, so temporaries may be logged; arguments that do not fit
+// in a record are cut off. The background thread is woken early when a ring
+// is half full, and a thread whose ring is full waits for it to catch up.
+class Logger {
  public:
+  static constexpr std::size_t RECORD_BYTES = 256;
+  static constexpr std::size_t RING_RECORDS = 1024;  // per logging thread
+  // How long logged lines may wait for the background thread
+  static constexpr std::chrono::milliseconds FLUSH_INTERVAL{5};
+
   Logger(std::ostream& stream = std::cout) : stream_(stream) {}
+  ~Logger();  // writes out what is left
+
+  Logger(const Logger&) = delete;
+  Logger& operator=(const Logger&) = delete;
+
+  template <typename... Args>
+  void log(const Args&... args);
 
-  // Proxy object that locks the mutex for the duration of the object
+  // Writes out every line logged so far
+  void flush();
+
+  // DPU_LOG_LEVEL the library was built with
+  static int level();
+
+  // Writes to the stream directly, after the lines logged so far and with
+  // nothing else writing to it, for the duration of the object (e.g. for a
+  // table that is formatted anyway)
   struct Lock {
     std::ostream& stream;
     std::unique_lock<std::mutex> lock;
 
-    Lock(Logger& logger) : stream(logger.stream_), lock(logger.mtx_) {}
+    Lock(Logger& logger) : stream(logger.stream_), lock(logger.mtx_) {
+      logger.drain_locked();
+    }
 
     // For generic types
     template <typename T>
@@ -40,13 +99,127 @@ class Logger {
   };
 
   Lock lock() { return Lock(*this); }
+
+ private:
+  enum class Tag : uint8_t { INT, UINT, DOUBLE, CHAR, STRING, HEX, POINTER };
+
+  struct Record {
+    uint64_t time;  // steady clock, orders the records of different threads
+    uint32_t size;  // of data
+    char data[RECORD_BYTES - 12];
+  };
+
+  // Written by one thread, read by the background thread
+  struct Ring {
+    std::atomic<uint64_t> head{0};  // next record written
+    std::atomic<uint64_t> tail{0};  // next record formatted
+    std::atomic<bool> in_use{true};  // by a live thread
+    Record records[RING_RECORDS];
+  };
+
+  class Writer {
+   public:
+    explicit Writer(Record& r) : pos_(r.data), end_(r.data + sizeof(r.data)) {}
+
+    template <typename T>
+    void put(Tag tag, const T& value) {
+      if (end_ - pos_ < 1 + static_cast<std::ptrdiff_t>(sizeof(T))) {
+        pos_ = end_;  // nothing after it either
+        return;
+      }
+      *pos_++ = static_cast<char>(tag);
+      std::memcpy(pos_, &value, sizeof(T));
+      pos_ += sizeof(T);
+    }
+
+    void put_string(std::string_view s) {
+      if (end_ - pos_ < 3) {
+        pos_ = end_;
+        return;
+      }
+      uint16_t size = std::min<std::size_t>(s.size(), end_ - pos_ - 3);
+      *pos_++ = static_cast<char>(Tag::STRING);
+      std::memcpy(pos_, &size, sizeof(size));
+      std::memcpy(pos_ + sizeof(size), s.data(), size);
+      pos_ += sizeof(size) + size;
+    }
+
+    template <typename T>
+    void encode(const T& value) {
+      if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+        put_string(value);
+      } else if constexpr (std::same_as<T, log_hex>) {
+        put(Tag::HEX, value.value);
+      } else if constexpr (std::same_as<T, char>) {
+        put(Tag::CHAR, value);
+      } else if constexpr (std::is_enum_v<T>) {
+        encode(static_cast<std::underlying_type_t<T>>(value));
+      } else if constexpr (std::signed_integral<T> || std::same_as<T, bool>) {
+        put(Tag::INT, static_cast<int64_t>(value));
+      } else if constexpr (std::unsigned_integral<T>) {
+        put(Tag::UINT, static_cast<uint64_t>(value));
+      } else if constexpr (std::floating_point<T>) {
+        put(Tag::DOUBLE, static_cast<double>(value));
+      } else {
+        static_assert(std::is_pointer_v<T>, "type cannot be logged");
+        put(Tag::POINTER, reinterpret_cast<uintptr_t>(value));
+      }
+    }
+
+    uint32_t size(const Record& r) const { return pos_ - r.data; }
+
+   private:
+    char* pos_;
+    char* end_;
+  };
+
+  // Ring of the calling thread, registered on first use
+  Ring& thread_ring();
+  // Waits until ring has room for another record
+  void wait_for_room(Ring& ring, uint64_t head);
+  void start_thread();
+  void run();
+  // Formats every record logged so far, with mtx_ held
+  void drain_locked();
+  void format(const Record& r);
+
+  std::vector<char> line_;  // format()
+
+  std::mutex mtx_;  // held while writing to the stream
+  std::ostream& stream_;
+  const uint64_t id_ = next_id_++;  // tells loggers apart in thread_ring()
+  static inline std::atomic<uint64_t> next_id_{0};
+
+  std::mutex rings_lock_;
+  std::vector<std::shared_ptr<Ring>> rings_;
+  std::vector<std::pair<uint64_t, const Record*>> pending_;  // drain_locked()
+
+  std::mutex wake_lock_;
+  std::condition_variable wake_;
+  bool stop_ = false;
+  std::thread thread_;  // started by the first log()
 };
 
+template <typename... Args>
+void Logger::log(const Args&... args) {
+  Ring& ring = thread_ring();
+  uint64_t head = ring.head.load(std::memory_order_relaxed);
+  uint64_t used = head - ring.tail.load(std::memory_order_acquire);
+  if (used == RING_RECORDS / 2) wake_.notify_one();
+  if (used == RING_RECORDS) wait_for_room(ring, head);
+  Record& r = ring.records[head % RING_RECORDS];
+  Writer writer(r);
+  (writer.encode(args), ...);
+  r.size = writer.size(r);
+  r.time = std::chrono::steady_clock::now().time_since_epoch().count();
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
 inline void print_vector_desc(vector_desc desc);
 
 inline void log_allocation(const std::type_info& type, uint32_t n,
-                           std::string_view debug_name, const char* debug_file,
-                           int debug_line);
+                           uint32_t stream, std::string_view debug_name,
+                           const char* debug_file, int debug_line);
 
 inline void log_dpu_launch_args(const DPU_LAUNCH_ARGS* args,
-                                uint32_t nr_of_dpus);
\ No newline at end of file
+                                uint32_t nr_of_dpus);
@@ -4,7 +4,7 @@
 #include "queue.h"
 #include "runtime.h"
 
-inline const char* kernel_id_to_string(KernelID id) {
+inline const char* kernel_id_to_string(uint32_t id) {
   switch (id) {
     case K_UNARY_FLOAT_NEGATE:
       return "UNARY_FLOAT_NEGATE";
@@ -18,12 +18,86 @@ inline const char* kernel_id_to_string(KernelID id) {
       return "BINARY_FLOAT_ADD";
     case K_BINARY_FLOAT_SUB:
       return "BINARY_FLOAT_SUB";
+    case K_BINARY_FLOAT_MUL:
+      return "BINARY_FLOAT_MUL";
+    case K_BINARY_FLOAT_DIV:
+      return "BINARY_FLOAT_DIV";
+    case K_BINARY_FLOAT_MIN:
+      return "BINARY_FLOAT_MIN";
+    case K_BINARY_FLOAT_MAX:
+      return "BINARY_FLOAT_MAX";
+    case K_BINARY_FLOAT_LT:
+      return "BINARY_FLOAT_LT";
+    case K_BINARY_FLOAT_EQ:
+      return "BINARY_FLOAT_EQ";
+    case K_BINARY_FLOAT_GT:
+      return "BINARY_FLOAT_GT";
     case K_BINARY_INT_ADD:
       return "BINARY_INT_ADD";
     case K_BINARY_INT_SUB:
       return "BINARY_INT_SUB";
+    case K_BINARY_INT_MUL:
+      return "BINARY_INT_MUL";
+    case K_BINARY_INT_DIV:
+      return "BINARY_INT_DIV";
+    case K_BINARY_INT_MOD:
+      return "BINARY_INT_MOD";
+    case K_BINARY_INT_MIN:
+      return "BINARY_INT_MIN";
+    case K_BINARY_INT_MAX:
+      return "BINARY_INT_MAX";
+    case K_BINARY_INT_LT:
+      return "BINARY_INT_LT";
+    case K_BINARY_INT_EQ:
+      return "BINARY_INT_EQ";
+    case K_BINARY_INT_GT:
+      return "BINARY_INT_GT";
+    case K_SCALAR_FLOAT_ADD:
+      return "SCALAR_FLOAT_ADD";
+    case K_SCALAR_FLOAT_SUB:
+      return "SCALAR_FLOAT_SUB";
+    case K_SCALAR_FLOAT_RSUB:
+      return "SCALAR_FLOAT_RSUB";
+    case K_SCALAR_FLOAT_MUL:
+      return "SCALAR_FLOAT_MUL";
+    case K_SCALAR_FLOAT_DIV:
+      return "SCALAR_FLOAT_DIV";
+    case K_SCALAR_INT_ADD:
+      return "SCALAR_INT_ADD";
+    case K_SCALAR_INT_SUB:
+      return "SCALAR_INT_SUB";
+    case K_SCALAR_INT_RSUB:
+      return "SCALAR_INT_RSUB";
+    case K_SCALAR_INT_MUL:
+      return "SCALAR_INT_MUL";
+    case K_SCALAR_INT_DIV:
+      return "SCALAR_INT_DIV";
+    case K_SCALAR_INT_MOD:
+      return "SCALAR_INT_MOD";
+    case K_FUSED_FLOAT:
+      return "FUSED_FLOAT";
+    case K_FUSED_INT:
+      return "FUSED_INT";
+    case K_REDUCE_FLOAT_SUM:
+      return "REDUCE_FLOAT_SUM";
+    case K_REDUCE_FLOAT_MIN:
+      return "REDUCE_FLOAT_MIN";
+    case K_REDUCE_FLOAT_MAX:
+      return "REDUCE_FLOAT_MAX";
+    case K_REDUCE_FLOAT_DOT:
+      return "REDUCE_FLOAT_DOT";
+    case K_REDUCE_INT_SUM:
+      return "REDUCE_INT_SUM";
+    case K_REDUCE_INT_MIN:
+      return "REDUCE_INT_MIN";
+    case K_REDUCE_INT_MAX:
+      return "REDUCE_INT_MAX";
+    case K_REDUCE_INT_DOT:
+      return "REDUCE_INT_DOT";
     case KERNEL_COUNT:
       return "KERNEL_COUNT";
+    case K_BATCH:
+      return "BATCH";
     default:
       return "UNKNOWN_KERNEL_ID";
   }
@@ -31,60 +105,64 @@ inline const char* kernel_id_to_string(KernelID id) {
 
 inline void print_vector_desc(vector_desc desc) {
   Logger& logger = DpuRuntime::get().get_logger();
-  logger.lock() << "[debug-help] Vector Description:" << std::endl;
+  logger.log("[debug-help] Vector Description:");
   for (size_t i = 0; i < desc.first.size(); i++) {
-    logger.lock() << "\t DPU[" << i << "] \t"
-                  << "ptr=0x" << std::hex << desc.first[i]
-                  << " size=" << std::dec << desc.second[i] << std::endl;
+    logger.log("\t DPU[", i, "] \tptr=", log_hex{desc.first[i]},
+               " size=", desc.second[i]);
   }
 }
 
 inline void log_allocation(const std::type_info& type, uint32_t n,
-                           std::string_view debug_name, const char* debug_file,
-                           int debug_line) {
+                           uint32_t stream, std::string_view debug_name,
+                           const char* debug_file, int debug_line) {
   Logger& logger = DpuRuntime::get().get_logger();
-  auto log = logger.lock();
-  log << "[mem-logger] Allocated dpu_vector<" << type.name() << "> of size "
-      << n;
-  if (!debug_name.empty()) {
-    log << " (name=\"" << debug_name << "\")";
+  if (debug_name.empty()) {
+    logger.log("[mem-logger] Allocated dpu_vector<", type.name(),
+               "> of size ", n, " on stream ", stream, " at ", debug_file,
+               ":", debug_line);
+  } else {
+    logger.log("[mem-logger] Allocated dpu_vector<", type.name(),
+               "> of size ", n, " on stream ", stream, " (name=\"",
+               debug_name, "\") at ", debug_file, ":", debug_line);
   }
-  if (debug_file != nullptr && debug_line >= 0) {
-    log << " at " << debug_file << ":" << debug_line;
-  }
-  log << std::endl;
 }
 
-#ifdef ENABLE_DPU_LOGGING
 inline void log_dpu_launch_args(const DPU_LAUNCH_ARGS* args,
                                 uint32_t nr_of_dpus) {
   Logger& logger = DpuRuntime::get().get_logger();
-  auto log = logger.lock();
-  log << "[task-logger] kernel="
-      << kernel_id_to_string(static_cast<KernelID>(args->kernel))
-      << " nr_of_dpus=" << nr_of_dpus << std::endl;
-#if ENABLE_DPU_LOGGING >= 2
-  for (uint32_t i = 0; i < nr_of_dpus; i++) {
-    log << "[task-logger] DPU[" << i << "]\t"
-        << "kernel="
-        << kernel_id_to_string(static_cast<KernelID>(args[i].kernel))
-        << " is_binary=" << static_cast<int>(args[i].is_binary)
-        << " num_elements=" << args[i].num_elements
-        << " size_type=" << args[i].size_type;
-
-    if (args[i].is_binary) {
-      log << std::hex << std::setfill('0') << " lhs_offset=0x" << std::setw(8)
-          << args[i].binary.lhs_offset << " rhs_offset=0x" << std::setw(8)
-          << args[i].binary.rhs_offset << " res_offset=0x" << std::setw(8)
-          << args[i].binary.res_offset << std::dec;
-    } else {
-      log << std::hex << std::setfill('0') << " src_offset=0x" << std::setw(8)
-          << args[i].unary.rhs_offset << " res_offset=0x" << std::setw(8)
-          << args[i].unary.res_offset << std::dec;
+  logger.log("[task-logger] kernel=", kernel_id_to_string(args->kernel),
+             " nr_of_dpus=", nr_of_dpus);
+  if constexpr (DPU_LOG_LEVEL >= 2) {
+    for (uint32_t i = 0; i < nr_of_dpus; i++) {
+      const DPU_LAUNCH_ARGS& a = args[i];
+      const char* kernel = kernel_id_to_string(a.kernel);
+      if (a.kernel == K_BATCH) {
+        logger.log("[task-logger] DPU[", i, "]\tkernel=", kernel,
+                   " num_commands=", a.batch.num_commands);
+      } else if (a.kernel == K_FUSED_FLOAT || a.kernel == K_FUSED_INT) {
+        logger.log("[task-logger] DPU[", i, "]\tkernel=", kernel,
+                   " num_elements=", a.num_elements, " size_type=",
+                   a.size_type, " res_offset=", log_hex{a.fused.res_offset});
+      } else if (a.kernel >= K_SCALAR_FLOAT_ADD &&
+                 a.kernel <= K_SCALAR_INT_MOD) {
+        logger.log("[task-logger] DPU[", i, "]\tkernel=", kernel,
+                   " num_elements=", a.num_elements, " size_type=",
+                   a.size_type, " src_offset=", log_hex{a.scalar.rhs_offset},
+                   " res_offset=", log_hex{a.scalar.res_offset}, " scalar=",
+                   log_hex{static_cast<uint32_t>(a.scalar.value.i)});
+      } else if (a.is_binary) {
+        logger.log("[task-logger] DPU[", i, "]\tkernel=", kernel,
+                   " is_binary=1 num_elements=", a.num_elements,
+                   " size_type=", a.size_type,
+                   " lhs_offset=", log_hex{a.binary.lhs_offset},
+                   " rhs_offset=", log_hex{a.binary.rhs_offset},
+                   " res_offset=", log_hex{a.binary.res_offset});
+      } else {
+        logger.log("[task-logger] DPU[", i, "]\tkernel=", kernel,
+                   " num_elements=", a.num_elements, " size_type=",
+                   a.size_type, " src_offset=", log_hex{a.unary.rhs_offset},
+                   " res_offset=", log_hex{a.unary.res_offset});
+      }
     }
-
-    log << std::endl;
   }
-#endif
 }
-#endif
\ No newline at end of file
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "future.h"
+#include "runtime.h"
+#include "vectordpu.h"
+
+// ============================
+// Streaming pipelines
+// ============================
+// Processes data larger than MRAM in chunks of chunk_elems elements. Chunk
+// i + 1 is read from the source and uploaded while the DPUs work on chunk i,
+// and chunk i - 1 is handed to the sink once its download has finished. Up to
+// PIPELINE_DEPTH chunks are in flight, each in a slot of host and MRAM
+// buffers that are allocated once and reused by every PIPELINE_DEPTH-th chunk
+// (a last, partial chunk gets MRAM buffers of its size).
+constexpr uint32_t PIPELINE_DEPTH = 3;
+
+// A source fills the span it is given and returns the number of elements
+// written, 0 once it is exhausted. A sink consumes one chunk of results.
+template <typename T>
+using chunk_source = std::function<size_t(std::span<T>)>;
+template <typename T>
+using chunk_sink = std::function<void(std::span<const T>)>;
+
+struct pipeline_stats {
+  uint64_t bytes_in = 0;
+  uint64_t bytes_out = 0;
+  uint32_t chunks = 0;
+  double seconds = 0;
+
+  // End-to-end throughput, source to sink
+  double gb_per_s() const {
+    return seconds > 0 ? (bytes_in + bytes_out) / seconds / 1e9 : 0;
+  }
+};
+
+template <typename T>
+chunk_source<T> span_source(std::span<const T> data) {
+  auto pos = std::make_shared<size_t>(0);
+  return [data, pos](std::span<T> chunk) {
+    size_t n = std::min(chunk.size(), data.size() - *pos);
+    std::copy_n(data.begin() + *pos, n, chunk.begin());
+    *pos += n;
+    return n;
+  };
+}
+
+template <typename T>
+chunk_sink<T> span_sink(std::span<T> data) {
+  auto pos = std::make_shared<size_t>(0);
+  return [data, pos](std::span<const T> chunk) {
+    if (*pos + chunk.size() > data.size()) {
+      throw std::out_of_range("span_sink: output span too small");
+    }
+    std::copy(chunk.begin(), chunk.end(), data.begin() + *pos);
+    *pos += chunk.size();
+  };
+}
+
+// Raw binary files of T
+template <typename T>
+chunk_source<T> file_source(const std::string& path) {
+  auto file = std::make_shared<std::ifstream>(path, std::ios::binary);
+  if (!*file) throw std::runtime_error("file_source: cannot open " + path);
+  return [file](std::span<T> chunk) {
+    file->read(reinterpret_cast<char*>(chunk.data()), chunk.size_bytes());
+    return static_cast<size_t>(file->gcount()) / sizeof(T);
+  };
+}
+
+template <typename T>
+chunk_sink<T> file_sink(const std::string& path) {
+  auto file = std::make_shared<std::ofstream>(path, std::ios::binary);
+  if (!*file) throw std::runtime_error("file_sink: cannot open " + path);
+  return [file](std::span<const T> chunk) {
+    file->write(reinterpret_cast<const char*>(chunk.data()),
+                chunk.size_bytes());
+  };
+}
+
+// Uploads data into the MRAM buffer of a slot, reallocated if the chunk has
+// another size
+template <typename T>
+void upload_chunk(dpu_vector<T>& chunk, std::span<const T> data) {
+  if (chunk.size() != data.size()) chunk = dpu_vector<T>(data.size());
+  chunk.assign(data);
+}
+
+// Applies fn, which maps a chunk on the DPUs to a dpu_vector or expression
+// of the same size, to every chunk of source and writes the results to sink.
+// An expression is evaluated into the slot's result buffer.
+template <typename T, typename F>
+pipeline_stats stream_map(const chunk_source<T>& source,
+                          const chunk_sink<T>& sink, uint32_t chunk_elems,
+                          F&& fn) {
+  vector<vector<T>> in(PIPELINE_DEPTH, vector<T>(chunk_elems));
+  vector<vector<T>> out(PIPELINE_DEPTH, vector<T>(chunk_elems));
+  vector<dpu_vector<T>> chunks, results;
+  for (uint32_t s = 0; s < PIPELINE_DEPTH; s++) {
+    chunks.emplace_back(chunk_elems);
+    results.emplace_back(chunk_elems);
+  }
+  vector<std::shared_ptr<Event>> downloads(PIPELINE_DEPTH);
+  vector<size_t> sizes(PIPELINE_DEPTH, 0);
+  pipeline_stats stats;
+
+  // Waits for the download of a slot and hands its chunk to the sink
+  auto drain = [&](uint32_t slot) {
+    if (!downloads[slot]) return;
+    DpuRuntime::get().get_event_queue().wait(downloads[slot]);
+    downloads[slot].reset();
+    sink(std::span<const T>(out[slot].data(), sizes[slot]));
+    stats.bytes_out += sizes[slot] * sizeof(T);
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0;; i++) {
+    uint32_t slot = i % PIPELINE_DEPTH;
+    // The slot's previous chunk has to be out of its buffers first
+    drain(slot);
+    size_t n = source(std::span<T>(in[slot]));
+    if (n == 0) break;
+
+    sizes[slot] = n;
+    stats.bytes_in += n * sizeof(T);
+    stats.chunks++;
+    upload_chunk(chunks[slot], std::span<const T>(in[slot]).first(n));
+    results[slot] = fn(chunks[slot]);
+    downloads[slot] =
+        results[slot].to_cpu_async(std::span<T>(out[slot]).first(n));
+  }
+  for (uint32_t i = 0; i < PIPELINE_DEPTH; i++) drain(i);
+
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  return stats;
+}
+
+// Reduces every chunk of source on the DPUs with fn, which submits the
+// reduction without blocking and returns its dpu_future (e.g.
+// reduce_sum_async), and folds the per-chunk results into init with combine.
+// Chunk i + 1 is read from the source and uploaded while the DPUs reduce
+// chunk i, whose result is only collected after that; the two alternate
+// between two slots of host and MRAM buffers.
+template <typename T, typename R, typename F, typename C>
+R stream_reduce(const chunk_source<T>& source, uint32_t chunk_elems, F&& fn,
+                C&& combine, R init, pipeline_stats* stats = nullptr) {
+  vector<vector<T>> in(2, vector<T>(chunk_elems));
+  vector<dpu_vector<T>> chunks;
+  for (uint32_t s = 0; s < 2; s++) chunks.emplace_back(chunk_elems);
+  pipeline_stats local;
+
+  auto start = std::chrono::steady_clock::now();
+  // Whether source had another chunk for slot
+  auto upload = [&](uint32_t slot) {
+    size_t n = source(std::span<T>(in[slot]));
+    if (n == 0) return false;
+    local.bytes_in += n * sizeof(T);
+    local.chunks++;
+    upload_chunk(chunks[slot], std::span<const T>(in[slot]).first(n));
+    return true;
+  };
+
+  R acc = init;
+  if (upload(0)) {
+    auto pending = fn(chunks[0]);
+    for (uint32_t i = 1;; i++) {
+      // The future of chunk i - 2, which read this slot, has been collected
+      bool more = upload(i % 2);
+      acc = combine(acc, pending.get());
+      if (!more) break;
+      pending = fn(chunks[i % 2]);
+    }
+  }
+
+  local.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  if (stats) *stats = local;
+  return acc;
+}
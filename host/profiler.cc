@@ -0,0 +1,86 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+#include "logger.inl"
+
+double KernelProfile::tasklet_imbalance() const {
+  return busy_cycles != 0
+             ? static_cast<double>(tasklet_max_cycles) * NR_TASKLETS /
+                   busy_cycles
+             : 1;
+}
+
+void KernelProfiler::record(const DPU_KERNEL_STATS* stats, uint32_t num_dpus,
+                            uint32_t num_commands) {
+  std::lock_guard<std::mutex> lock(lock_);
+  for (uint32_t c = 0; c < num_commands; c++) {
+    uint32_t kernel = stats[c].kernel;
+    if (kernel >= KERNEL_COUNT) continue;
+    KernelProfile& p = profiles_[kernel];
+    if (p.launches == 0) p.min_cycles = std::numeric_limits<uint64_t>::max();
+
+    uint64_t total = 0, slowest = 0;
+    for (uint32_t d = 0; d < num_dpus; d++) {
+      const DPU_KERNEL_STATS& s = stats[d * num_commands + c];
+      total += s.cycles;
+      slowest = std::max<uint64_t>(slowest, s.cycles);
+      p.min_cycles = std::min<uint64_t>(p.min_cycles, s.cycles);
+      p.busy_cycles += s.busy_cycles;
+      p.dma_cycles += s.dma_cycles;
+      p.tasklet_max_cycles += s.tasklet_max_cycles;
+    }
+    p.launches++;
+    p.dpu_runs += num_dpus;
+    p.total_cycles += total;
+    p.max_cycles = std::max(p.max_cycles, slowest);
+    p.critical_cycles += slowest;
+    p.mean_cycles += static_cast<double>(total) / num_dpus;
+  }
+}
+
+KernelProfile KernelProfiler::profile(KernelID kernel) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return profiles_[kernel];
+}
+
+void KernelProfiler::reset() {
+  std::lock_guard<std::mutex> lock(lock_);
+  profiles_.fill(KernelProfile{});
+}
+
+void KernelProfiler::print(std::ostream& out) const {
+  std::array<KernelProfile, KERNEL_COUNT> profiles;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    profiles = profiles_;
+  }
+  std::vector<uint32_t> kernels;
+  for (uint32_t k = 0; k < KERNEL_COUNT; k++) {
+    if (profiles[k].launches != 0) kernels.push_back(k);
+  }
+  std::sort(kernels.begin(), kernels.end(), [&](uint32_t a, uint32_t b) {
+    return profiles[a].critical_cycles > profiles[b].critical_cycles;
+  });
+
+  char line[160];
+  std::snprintf(line, sizeof(line), "%-20s %8s %14s %10s %10s %10s %7s %7s %6s",
+                "kernel", "launches", "cycles", "min", "avg", "max", "imbal",
+                "t-imbal", "dma");
+  out << line << '\n';
+  for (uint32_t k : kernels) {
+    const KernelProfile& p = profiles[k];
+    std::snprintf(line, sizeof(line),
+                  "%-20s %8llu %14llu %10llu %10.0f %10llu %7.2f %7.2f %5.1f%%",
+                  kernel_id_to_string(k),
+                  static_cast<unsigned long long>(p.launches),
+                  static_cast<unsigned long long>(p.critical_cycles),
+                  static_cast<unsigned long long>(p.min_cycles), p.avg_cycles(),
+                  static_cast<unsigned long long>(p.max_cycles),
+                  p.imbalance(), p.tasklet_imbalance(), 100 * p.dma_share());
+    out << line << '\n';
+  }
+}
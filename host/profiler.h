@@ -0,0 +1,62 @@
+#pragma once
+
+#include <common.h>
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+
+// Cycles of every launch of one kernel, gathered from every DPU. A launch is
+// one command: a batched launch counts once for each command it runs.
+struct KernelProfile {
+  uint64_t launches = 0;
+  uint64_t dpu_runs = 0;      // launches times the DPUs of each
+  uint64_t total_cycles = 0;  // summed over every DPU of every launch
+  uint64_t min_cycles = 0;    // fastest DPU of any launch
+  uint64_t max_cycles = 0;    // slowest DPU of any launch
+  // Slowest DPU of each launch, summed: how long the kernel kept its
+  // stream's DPUs busy
+  uint64_t critical_cycles = 0;
+  double mean_cycles = 0;  // average DPU of each launch, summed
+  // Summed over tasklets, DPUs and launches
+  uint64_t busy_cycles = 0;
+  uint64_t dma_cycles = 0;
+  uint64_t tasklet_max_cycles = 0;  // slowest tasklet, summed
+
+  // Average DPU of a launch
+  double avg_cycles() const {
+    return launches != 0 ? mean_cycles / launches : 0;
+  }
+  // Slowest DPU over the average DPU: 1 when the DPUs are balanced, and the
+  // time lost to waiting for the slowest one above that
+  double imbalance() const {
+    return mean_cycles != 0 ? critical_cycles / mean_cycles : 1;
+  }
+  // Slowest tasklet over the average tasklet, within a DPU
+  double tasklet_imbalance() const;
+  // Share of the tasklets' time spent in MRAM transfers
+  double dma_share() const {
+    return busy_cycles != 0 ? static_cast<double>(dma_cycles) / busy_cycles
+                            : 0;
+  }
+};
+
+// Per-kernel totals of the DPU_KERNEL_STATS read back after each launch.
+// Completion callbacks of different streams record concurrently.
+class KernelProfiler {
+ public:
+  // stats holds num_commands entries per DPU, DPU-major
+  void record(const DPU_KERNEL_STATS* stats, uint32_t num_dpus,
+              uint32_t num_commands);
+
+  KernelProfile profile(KernelID kernel) const;
+  void reset();
+
+  // One line per kernel that ran, most critical cycles first
+  void print(std::ostream& out) const;
+
+ private:
+  mutable std::mutex lock_;
+  std::array<KernelProfile, KERNEL_COUNT> profiles_{};
+};
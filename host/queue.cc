@@ -1,7 +1,13 @@
 #include "queue.h"
 
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <thread>
+
 #include "logger.h"
 #include "runtime.h"
+#include "stream.h"
 #include "vectordpu.h"
 
 #ifndef DPURT
@@ -10,7 +16,7 @@
 #define CHECK_UPMEM(x) DPU_ASSERT(x)
 #endif
 
-std::string operationtype_to_string(Event::OperationType op) {
+const char* operationtype_to_string(Event::OperationType op) {
   switch (op) {
     case Event::OperationType::COMPUTE:
       return "COMPUTE";
@@ -28,41 +34,399 @@ std::string operationtype_to_string(Event::OperationType op) {
 /*static*/ dpu_error_t upmem_callback([[maybe_unused]] struct dpu_set_t stream,
                                       [[maybe_unused]] uint32_t rank_id,
                                       void* data) {
-  Event* me = static_cast<Event*>(data);
-  me->mark_finished(/* true */);
-#ifdef ENABLE_DPU_LOGGING
-  Logger& logger = DpuRuntime::get().get_logger();
-  logger.lock() << "[Event] Callback finished: "
-                << operationtype_to_string(me->op) << " started=" << me->started
-                << ", finished=" << me->finished << std::endl;
-#endif
-
+  auto* me = static_cast<Event::rank_callback*>(data);
+  me->event->finish_rank(me->rank);
   return DPU_OK;
 }
 
-void Event::add_completion_callback() {
-  auto& runtime = DpuRuntime::get();
-  dpu_set_t& dpu_set = runtime.dpu_set();
-  CHECK_UPMEM(dpu_callback(
-      dpu_set, &upmem_callback, (void*)this,
-      (dpu_callback_flags_t)(DPU_CALLBACK_ASYNC | DPU_CALLBACK_NONBLOCKING |
-                             DPU_CALLBACK_SINGLE_CALL)));
+void Event::finish_rank(uint32_t rank) {
+  if (traced) trace.rank_completed[rank] = EventTracer::now();
+  if (on_rank_finish) on_rank_finish(rank);
+  rank_done_[rank].store(true, std::memory_order_release);
+  rank_done_[rank].notify_all();
+  if (ranks_pending_.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+  // Last rank. Waiters may drop the event as soon as it is marked finished.
+  std::shared_ptr<Event> self = std::move(self_);
+  if (traced || recorded) {
+    trace.completed = EventTracer::now();
+    trace.callback_thread = EventTracer::thread_id();
+  }
+  if (!kernel_stats.empty()) {
+    uint32_t num_commands =
+        commands.empty() ? 1 : commands.size() / args.size();
+    DpuRuntime::get().profiler().record(kernel_stats.data(),
+                                        kernel_stats.size() / num_commands,
+                                        num_commands);
+  }
+  if (on_finish) on_finish();
+  if (traced) {
+    trace.callback_done = EventTracer::now();
+    DpuRuntime::get().tracer().record(*this);
+  }
+  if (recorded) DpuRuntime::get().recorder().record(*this);
+  DPU_LOG(1, "[Event] Callback finished: ", operationtype_to_string(op),
+          " started=", started, ", finished=1");
+  release();
+  mark_finished();
+}
+
+void Event::release() {
+  cb = nullptr;
+  on_finish = nullptr;
+  on_rank_finish = nullptr;
+  res.reset();
+  operands.clear();
+  host_res.reset();
+  for (auto& b : batched) b->release();
+}
+
+void Event::add_completion_callback(DpuStream& stream) {
+  // the callback may fire on another thread before dpu_callback returns
   assert(this->finished == false);
+  uint32_t num_ranks = stream.num_ranks();
+  if (num_ranks_ != num_ranks) {
+    rank_callbacks_ = std::make_unique<rank_callback[]>(num_ranks);
+    rank_done_ = std::make_unique<std::atomic<bool>[]>(num_ranks);
+    num_ranks_ = num_ranks;
+  }
+  for (uint32_t r = 0; r < num_ranks; r++) {
+    rank_done_[r].store(false, std::memory_order_relaxed);
+  }
+  rank_tracked_ = true;
+  if (traced || recorded) {
+    // Everything the event issues has been by now
+    trace.issue_done = EventTracer::now();
+    trace.stream = stream.id();
+    trace.num_dpus = stream.num_dpus();
+  }
+  if (traced) trace.rank_completed.assign(num_ranks, 0);
+  ranks_pending_.store(num_ranks, std::memory_order_release);
+  for (uint32_t r = 0; r < num_ranks; r++) {
+    rank_callbacks_[r] = {this, r};
+    CHECK_UPMEM(dpu_callback(
+        stream.rank_set(r), &upmem_callback, &rank_callbacks_[r],
+        (dpu_callback_flags_t)(DPU_CALLBACK_ASYNC | DPU_CALLBACK_NONBLOCKING)));
+  }
 
-#ifdef ENABLE_DPU_LOGGING
-  Logger& logger = DpuRuntime::get().get_logger();
-  logger.lock() << "[Event] Added completion callback." << std::endl;
-#endif
+  DPU_LOG(1, "[Event] Added completion callback.");
 }
 
-void EventQueue::add_fence(std::shared_ptr<Event> e) {
+namespace {
+
+// Events kept for reuse; more than this many in flight at once is rare
+constexpr std::size_t EVENT_POOL_SIZE = 256;
+
+// A free list that is never destroyed, so events and control blocks may still
+// be released during static destruction
+template <typename T>
+struct free_list {
+  std::mutex lock;
+  std::vector<T*> items;
+
+  static free_list& get() {
+    static free_list& list = *new free_list;
+    return list;
+  }
+
+  T* pop() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (items.empty()) return nullptr;
+    T* item = items.back();
+    items.pop_back();
+    return item;
+  }
+
+  bool push(T* item) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (items.size() == EVENT_POOL_SIZE) return false;
+    items.push_back(item);
+    return true;
+  }
+};
+
+// Allocates the shared_ptr control blocks of pooled events, so that creating
+// an event from the pool does not go to the heap either
+template <typename T>
+struct recycling_allocator {
+  using value_type = T;
+
+  recycling_allocator() = default;
+  template <typename U>
+  recycling_allocator(const recycling_allocator<U>&) {}
+
+  T* allocate(std::size_t n) {
+    if (n == 1) {
+      if (T* p = free_list<T>::get().pop()) return p;
+    }
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* p, std::size_t n) {
+    if (n == 1 && free_list<T>::get().push(p)) return;
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template <typename U>
+  bool operator==(const recycling_allocator<U>&) const {
+    return true;
+  }
+};
+
+}  // namespace
+
+namespace {
+std::atomic<WaitMode> wait_mode_{WaitMode::BLOCK};
+}  // namespace
+
+void Event::set_wait_mode(WaitMode mode) { wait_mode_.store(mode); }
+WaitMode Event::wait_mode() { return wait_mode_.load(); }
+
+void Event::wait() const {
+  if (wait_mode() == WaitMode::SPIN) {
+    while (!finished.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+    return;
+  }
+  // Sleeps until set_finished() changes the flag
+  finished.wait(false, std::memory_order_acquire);
+}
+
+void Event::wait(uint32_t rank) const {
+  if (!tracks_ranks(rank)) return wait();
+  if (wait_mode() == WaitMode::SPIN) {
+    while (!rank_finished(rank)) {
+      std::this_thread::yield();
+    }
+    return;
+  }
+  rank_done_[rank].wait(false, std::memory_order_acquire);
+}
+
+bool Event::then(small_function<void()> fn) {
+  std::lock_guard<std::mutex> lock(then_lock_);
+  if (finished.load(std::memory_order_acquire)) return false;
+  continuations_.push_back(std::move(fn));
+  return true;
+}
+
+void Event::set_finished() {
+  finished.store(true, std::memory_order_release);
+  finished.notify_all();
+  // then() sees the flag once it has the lock, so nothing is added after this
+  std::vector<small_function<void()>> continuations;
+  {
+    std::lock_guard<std::mutex> lock(then_lock_);
+    continuations.swap(continuations_);
+  }
+  for (auto& fn : continuations) fn();
+}
+
+std::shared_ptr<Event> Event::create(OperationType t) {
+  Event* e = free_list<Event>::get().pop();
+  if (e != nullptr) {
+    e->op = t;
+  } else {
+    e = new Event(t);
+  }
+  return std::shared_ptr<Event>(e, &Event::recycle,
+                                recycling_allocator<Event>());
+}
+
+void Event::recycle(Event* e) {
+  // Dropping the references may recycle other events, so do it before taking
+  // the pool's lock
+  e->cb = nullptr;
+  e->on_finish = nullptr;
+  e->on_rank_finish = nullptr;
+  e->res.reset();
+  e->operands.clear();
+  e->host_res.reset();
+  e->args.clear();
+  e->programs.clear();
+  e->commands.clear();
+  e->batched.clear();
+  e->kernel_stats.clear();
+  e->bytes = 0;
+  e->host_data = nullptr;
+  e->traced = false;
+  e->recorded = false;
+  e->issue_number = 0;
+  e->trace.detail.clear();
+  e->trace.rank_completed.clear();
+  e->reads.clear();
+  e->writes.clear();
+  e->batchable = false;
+  e->finished.store(false, std::memory_order_relaxed);
+  e->started = false;
+  e->record_ = false;
+  e->rank_tracked_ = false;
+  if (!free_list<Event>::get().push(e)) delete e;
+}
+
+EventQueue::~EventQueue() {
+  // Drop the references held by events nobody took out of the inbox
+  Event* e = inbox_.exchange(nullptr, std::memory_order_acquire);
+  while (e != nullptr) {
+    Event* next = e->next_submitted_;
+    e->next_submitted_ = nullptr;
+    e->self_.reset();
+    e = next;
+  }
+}
+
+namespace {
+void trace_submit(Event& e) {
   auto& runtime = DpuRuntime::get();
-  dpu_set_t& dpu_set = runtime.dpu_set();
-  CHECK_UPMEM(dpu_callback(
-      dpu_set, &upmem_callback, (void*)e.get(),
-      (dpu_callback_flags_t)(DPU_CALLBACK_ASYNC | DPU_CALLBACK_NONBLOCKING |
-                             DPU_CALLBACK_SINGLE_CALL)));
-  assert(e->finished == false);
+  e.traced = runtime.tracing();
+  e.recorded = runtime.recording();
+  if (!e.traced && !e.recorded) return;
+  e.trace.submitted = EventTracer::now();
+  e.trace.submit_thread = EventTracer::thread_id();
+}
+}  // namespace
+
+void EventQueue::submit(std::shared_ptr<Event> e) {
+  Event* raw = e.get();
+  trace_submit(*raw);
+  raw->record_ = batching() && raw->batchable;
+  raw->self_ = std::move(e);
+  push_inbox(raw, raw);
+  try_drain();
+}
+
+void EventQueue::submit(std::shared_ptr<Event> first,
+                        std::shared_ptr<Event> then) {
+  Event* oldest = first.get();
+  Event* newest = then.get();
+  trace_submit(*oldest);
+  trace_submit(*newest);
+  oldest->record_ = batching() && oldest->batchable;
+  newest->record_ = batching() && newest->batchable;
+  oldest->self_ = std::move(first);
+  newest->self_ = std::move(then);
+  newest->next_submitted_ = oldest;
+  push_inbox(newest, oldest);
+  try_drain();
+}
+
+void EventQueue::push_inbox(Event* newest, Event* oldest) {
+  Event* head = inbox_.load(std::memory_order_relaxed);
+  do {
+    oldest->next_submitted_ = head;
+  } while (!inbox_.compare_exchange_weak(
+      head, newest, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void EventQueue::try_drain() {
+  // Every thread that held the lock looks at the inbox again after letting go,
+  // so an event pushed while the lock was held is never left behind
+  while (inbox_.load(std::memory_order_acquire) != nullptr) {
+    std::unique_lock<std::mutex> lock(issue_lock_, std::try_to_lock);
+    if (!lock.owns_lock()) return;
+    drain_inbox();
+  }
+}
+
+void EventQueue::drain_inbox() {
+  // The inbox is newest first
+  Event* list = inbox_.exchange(nullptr, std::memory_order_acquire);
+  Event* oldest = nullptr;
+  while (list != nullptr) {
+    Event* next = list->next_submitted_;
+    list->next_submitted_ = oldest;
+    oldest = list;
+    list = next;
+  }
+
+  while (oldest != nullptr) {
+    Event* next = oldest->next_submitted_;
+    oldest->next_submitted_ = nullptr;
+    std::shared_ptr<Event> e = std::move(oldest->self_);
+    if (e->record_) {
+      batch_.push_back(std::move(e));
+      if (batch_.size() == BATCH_MAX_COMMANDS) flush_batch_locked();
+    } else {
+      // Recorded events run before anything submitted after them
+      flush_batch_locked();
+      enqueue(std::move(e));
+    }
+    oldest = next;
+  }
+
+  while (!operations_.empty()) {
+    process_next();
+  }
+}
+
+void EventQueue::begin_batch() { batch_depth_++; }
+
+void EventQueue::end_batch() {
+  assert(batch_depth_.load() > 0);
+  if (--batch_depth_ == 0) flush_batch();
+}
+
+void EventQueue::flush_batch() {
+  {
+    std::lock_guard<std::mutex> lock(issue_lock_);
+    drain_inbox();
+    flush_batch_locked();
+    while (!operations_.empty()) {
+      process_next();
+    }
+  }
+  try_drain();
+}
+
+void EventQueue::flush_batch_locked() {
+  if (batch_.empty()) return;
+
+  std::shared_ptr<Event> e;
+  if (batch_.size() == 1) {
+    e = batch_.front();  // launched as usual
+  } else {
+    uint32_t nr_of_dpus = stream_.num_dpus();
+    uint32_t num_commands = batch_.size();
+
+    e = Event::create(Event::OperationType::COMPUTE);
+    e->commands.resize(nr_of_dpus * num_commands);
+    e->args.assign(nr_of_dpus, DPU_LAUNCH_ARGS{});
+    for (uint32_t d = 0; d < nr_of_dpus; d++) {
+      for (uint32_t c = 0; c < num_commands; c++) {
+        DPU_COMMAND& cmd = e->commands[d * num_commands + c];
+        cmd.args = batch_[c]->args[d];
+        if (!batch_[c]->programs.empty()) cmd.program = batch_[c]->programs[d];
+      }
+      e->args[d].kernel = K_BATCH;
+      e->args[d].batch.num_commands = num_commands;
+    }
+    // Recorded as one launch, with the buffers of all its commands
+    for (const auto& b : batch_) {
+      e->reads.insert(e->reads.end(), b->reads.begin(), b->reads.end());
+      e->writes.insert(e->writes.end(), b->writes.begin(), b->writes.end());
+    }
+    e->cb = std::bind(push_commands_and_launch, std::ref(stream_),
+                      std::ref(e->args), std::ref(e->commands));
+    // Traced and recorded as a whole, from the submission of its first
+    // command
+    e->traced = batch_.front()->traced;
+    e->recorded = batch_.front()->recorded;
+    e->trace.submitted = batch_.front()->trace.submitted;
+    e->trace.submit_thread = batch_.front()->trace.submit_thread;
+    std::swap(e->batched, batch_);
+  }
+  batch_.clear();
+  enqueue(std::move(e));
+}
+
+void EventQueue::enqueue(std::shared_ptr<Event> e) {
+  operations_.push(std::move(e));
+}
+
+void EventQueue::add_fence(std::shared_ptr<Event> e) {
+  e->started = true;
+  e->add_completion_callback(stream_);
 }
 
 void EventQueue::process_next() {
@@ -72,54 +436,130 @@ void EventQueue::process_next() {
   std::shared_ptr<Event> e = operations_.front();
   debug_print_queue();
 
-#ifdef ENABLE_DPU_LOGGING
-  Logger& logger = DpuRuntime::get().get_logger();
-  logger.lock() << "[EventQueue] Processing " << operationtype_to_string(e->op)
-                << " event." << std::endl;
-#endif
+  DPU_LOG(1, "[EventQueue] Processing ", operationtype_to_string(e->op),
+          " event.");
 
+  // Kept alive until its callback is done with it, see finish_rank()
+  e->self_ = e;
+  if (e->traced || e->recorded) {
+    e->trace.issued = EventTracer::now();
+    e->trace.issue_thread = EventTracer::thread_id();
+  }
+  if (e->recorded) {
+    e->issue_number = DpuRuntime::get().recorder().next_issue();
+  }
   switch (e->op) {
     case Event::OperationType::FENCE:
       EventQueue::add_fence(e);
       break;
     case Event::OperationType::COMPUTE:
-      e->started = true;
+      e->mark_started();
       e->cb();
-      e->add_completion_callback();
+      if (DpuRuntime::get().profiling()) read_kernel_stats(*e);
+      e->add_completion_callback(stream_);
       break;
     case Event::OperationType::DPU_TRANSFER:
       e->started = true;
       e->cb();
-      e->add_completion_callback();
+      e->add_completion_callback(stream_);
       break;
     case Event::OperationType::HOST_TRANSFER:
       e->started = true;
       e->cb();
-      e->add_completion_callback();
+      e->add_completion_callback(stream_);
       break;
     default:
       assert(false && "Unknown event type");
   }
   operations_.pop();  // Remove
+  inflight_.push_back(e);
+  reap();
+}
+
+void EventQueue::read_kernel_stats(Event& e) {
+  uint32_t num_commands =
+      e.commands.empty() ? 1 : e.commands.size() / e.args.size();
+  uint32_t bytes = num_commands * sizeof(DPU_KERNEL_STATS);
+  e.kernel_stats.resize(stream_.num_dpus() * num_commands);
+  stream_.for_each_rank([&](uint32_t r) {
+    dpu_set_t& rank = stream_.rank_set(r);
+    uint32_t first = stream_.rank_first_dpu(r);
+    dpu_set_t dpu;
+    uint32_t idx_dpu = 0;
+    DPU_FOREACH(rank, dpu, idx_dpu) {
+      CHECK_UPMEM(dpu_prepare_xfer(
+          dpu, &e.kernel_stats[(first + idx_dpu) * num_commands]));
+    }
+    CHECK_UPMEM(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "kernel_stats", 0,
+                              bytes, DPU_XFER_ASYNC));
+  });
 }
 
 void EventQueue::process_events() {
-  while (!operations_.empty()) {
-    this->process_next();
+  {
+    std::lock_guard<std::mutex> lock(issue_lock_);
+    drain_inbox();
   }
+  try_drain();
 }
+
+void EventQueue::reap() {
+  std::erase_if(inflight_, [](const std::shared_ptr<Event>& e) {
+    return e->finished.load();
+  });
+}
+
+void EventQueue::wait(const std::shared_ptr<Event>& e) {
+  flush_batch();
+  assert(e->started && "waiting on an event that was not submitted");
+  e->wait();
+  std::lock_guard<std::mutex> lock(issue_lock_);
+  reap();
+}
+
+void EventQueue::wait(const std::shared_ptr<Event>& e, uint32_t rank) {
+  flush_batch();
+  assert(e->started && "waiting on an event that was not submitted");
+  e->wait(rank);
+}
+
+void EventQueue::wait() {
+  flush_batch();
+  for (;;) {
+    std::shared_ptr<Event> e;
+    {
+      std::lock_guard<std::mutex> lock(issue_lock_);
+      reap();
+      if (inflight_.empty()) return;
+      e = inflight_.front();
+    }
+    e->wait();
+  }
+}
+
+bool EventQueue::has_pending() {
+  if (inbox_.load(std::memory_order_acquire) != nullptr) return true;
+  std::lock_guard<std::mutex> lock(issue_lock_);
+  return !operations_.empty() || !batch_.empty();
+}
+
+std::size_t EventQueue::inflight_count() {
+  std::lock_guard<std::mutex> lock(issue_lock_);
+  reap();
+  return inflight_.size();
+}
+
 void EventQueue::debug_print_queue() {
-#ifdef ENABLE_DPU_LOGGING
+#if DPU_LOG_LEVEL >= 2
   Logger& logger = DpuRuntime::get().get_logger();
-  logger.lock() << "[EventQueue] Current queue state:" << std::endl;
+  logger.log("[EventQueue] Current queue state:");
 
   std::queue<std::shared_ptr<Event>> temp_queue = operations_;
 
   while (!temp_queue.empty()) {
     auto e = temp_queue.front();  // Get the front element
-    logger.lock() << "  Event type: " << operationtype_to_string(e->op)
-                  << ", started: " << e->started
-                  << ", finished: " << e->finished << std::endl;
+    logger.log("  Event type: ", operationtype_to_string(e->op),
+               ", started: ", e->started, ", finished: ", e->finished.load());
     temp_queue.pop();  // Pop the element from the temporary queue
   }
 #endif
@@ -1,54 +1,247 @@
 #pragma once
 
+#include <atomic>
 #include <cassert>
 #include <cstdint>
-#include <functional>
 #include <memory>
+#include <mutex>
 #include <queue>
-#include <variant>
+#include <vector>
 
+#include "small_function.h"
+#include "tracer.h"
 #include "vectordpu.h"  // for dpu_vector
 
+class DpuStream;
+
+// How host threads wait for events: put to sleep until the completion
+// callback wakes them, or yielding in a loop, which may wake a little sooner
+// but keeps a core busy per waiting thread.
+enum class WaitMode { BLOCK, SPIN };
+
 class Event {
  public:
   enum class OperationType { COMPUTE, DPU_TRANSFER, HOST_TRANSFER, FENCE };
 
   OperationType op;
-  std::function<void()> cb;
+  small_function<void()> cb;
+
+  // Buffer written (or read back) by the event and the buffers it reads,
+  // kept alive until it finishes. They are dropped just before it is marked
+  // finished, so a buffer without handles is back in its allocator by the
+  // time waiters wake up.
+  std::shared_ptr<const dpu_buffer> res;
+  std::vector<std::shared_ptr<const dpu_buffer>> operands;
+  // Host memory it transfers from or into, likewise
+  std::shared_ptr<void> host_res;
+
+  // Runs when the event's operations have completed, before it is marked
+  // finished
+  small_function<void()> on_finish;
+  // Runs when the event's operations on a rank have completed, before the
+  // rank is marked finished (e.g. to copy the rank's part of a transfer out
+  // of its staging buffer). Calls for different ranks may run concurrently.
+  small_function<void(uint32_t rank)> on_rank_finish;
+
+  // Launch arguments per DPU (COMPUTE events). Owned by the event so that
+  // the asynchronous push stays valid until the event finishes.
+  std::vector<DPU_LAUNCH_ARGS> args;
+  std::vector<DPU_FUSED_PROGRAM> programs;  // fused COMPUTE events only
+
+  // Elementwise COMPUTE events fill in their args when they are submitted, so
+  // the queue may record them into a batch instead of launching each one.
+  bool batchable = false;
+  // Batched launch: the command buffer (BATCH_MAX_COMMANDS at most per DPU,
+  // DPU-major) and the events it runs.
+  std::vector<DPU_COMMAND> commands;
+  std::vector<std::shared_ptr<Event>> batched;
+  // Cycle counts of the launch per DPU and command, DPU-major, when profiling
+  std::vector<DPU_KERNEL_STATS> kernel_stats;
+
+  // Bytes of vector data a transfer moves, set by whoever creates it, and
+  // the host memory it moves them from or into when that is one piece
+  uint64_t bytes = 0;
+  const void* host_data = nullptr;
+  // Submitted while tracing (see DpuRuntime::set_tracing()): its timeline is
+  // filled in as it goes and recorded when it finishes
+  bool traced = false;
+  // Submitted while recording commands (see DpuRuntime::start_recording()):
+  // written to the recording when it finishes, with trace.submitted, issued,
+  // completed and stream filled in
+  bool recorded = false;
+  // Position in the order the events of every stream were issued while
+  // recording, from CommandRecorder::next_issue()
+  uint64_t issue_number = 0;
+  EventTrace trace;
 
-  // Result of the event
-  std::variant<std::monostate, dpu_vector<int>, dpu_vector<float>> res;
+  // MRAM buffers (identified by their MRAM offset) read and written by the
+  // event, as written to a recording. The queue does not track dependencies
+  // through them: see EventQueue.
+  std::vector<uint32_t> reads;
+  std::vector<uint32_t> writes;
 
-  Event(OperationType t) : op(t), res(std::monostate()) {}
+  Event(OperationType t) : op(t) {}
 
   template <typename Callable>
   Event(OperationType t, Callable&& c)
-      : op(t), cb(std::forward<Callable>(c)), res(std::monostate()) {}
+      : op(t), cb(std::forward<Callable>(c)) {}
 
-  bool finished = false;
+  // Events come from a pool and go back to it when the last reference is
+  // dropped, keeping the capacity of their vectors, so steady-state
+  // submissions do not allocate.
+  static std::shared_ptr<Event> create(OperationType t);
+  template <typename Callable>
+  static std::shared_ptr<Event> create(OperationType t, Callable&& c) {
+    std::shared_ptr<Event> e = create(t);
+    e->cb = std::forward<Callable>(c);
+    return e;
+  }
+
+  // Set by the completion callback, on another thread
+  std::atomic<bool> finished{false};
   bool started = false;
 
-  void add_completion_callback();
-  void mark_finished() { this->finished = true; }
+  // Block until the event has finished, or finished on rank. It has to have
+  // been issued: EventQueue::wait() flushes what is still queued first.
+  void wait() const;
+  void wait(uint32_t rank) const;
+
+  static void set_wait_mode(WaitMode mode);
+  static WaitMode wait_mode();
+
+  // Runs fn once the event has finished, on the thread that finishes it (the
+  // SDK's callback thread), or returns false without running it if it has
+  // finished already.
+  bool then(small_function<void()> fn);
+
+  // Registers upmem_callback on every rank of stream, which the SDK calls as
+  // soon as that rank has completed the operations issued before it.
+  void add_completion_callback(DpuStream& stream);
+  // Whether the event's operations on rank have completed
+  bool rank_finished(uint32_t rank) const {
+    return finished.load(std::memory_order_acquire) ||
+           (tracks_ranks(rank) &&
+            rank_done_[rank].load(std::memory_order_acquire));
+  }
+  void finish_rank(uint32_t rank);
+  void mark_started() {
+    for (auto& b : batched) b->started = true;
+    this->started = true;
+  }
+  void mark_finished() {
+    for (auto& b : batched) b->set_finished();
+    set_finished();
+  }
+
+  // What upmem_callback is registered with on each rank
+  struct rank_callback {
+    Event* event;
+    uint32_t rank;  // in the stream
+  };
+
+ private:
+  friend class EventQueue;
+
+  // Back to the pool, or deleted once it is full
+  static void recycle(Event* e);
+  // Drops the buffers, host memory and callbacks held for the event's
+  // operations (and those of the events it ran), once they have completed
+  void release();
+
+  // Wakes the waiters and runs the continuations
+  void set_finished();
+  // Whether completion is reported per rank for rank, which it is not for
+  // the events run by a batched launch
+  bool tracks_ranks(uint32_t rank) const {
+    return rank_tracked_ && rank < num_ranks_;
+  }
+
+  // Link in the submission inbox, which holds a reference until the event is
+  // taken out. The reference is then held again from the time the event is
+  // issued until its callback has finished with it, so that a waiter dropping
+  // the event cannot free it under the callback.
+  Event* next_submitted_ = nullptr;
+  std::shared_ptr<Event> self_;
+  bool record_ = false;  // submitted while batching
+
+  std::mutex then_lock_;
+  std::vector<small_function<void()>> continuations_;
+
+  uint32_t num_ranks_ = 0;  // of the arrays below, kept when recycled
+  bool rank_tracked_ = false;
+  std::unique_ptr<rank_callback[]> rank_callbacks_;
+  std::unique_ptr<std::atomic<bool>[]> rank_done_;
+  std::atomic<uint32_t> ranks_pending_{0};
 };
 
+// Issues the events of a stream to its ranks in submission order. The SDK
+// runs the asynchronous operations of a rank in the order they are issued,
+// and every op is issued to all the ranks of the stream its vectors live on,
+// so an event that uses a buffer runs after every earlier event on it without
+// tracking dependencies or waiting for them to finish.
 class EventQueue {
  public:
-  EventQueue() = default;
-  ~EventQueue() = default;
+  // Events are issued to the ranks of stream
+  explicit EventQueue(DpuStream& stream) : stream_(stream) {}
+  ~EventQueue();
 
-  void submit(std::shared_ptr<Event> e) { operations_.push(e); }
+  // Issue e after the events submitted before it. Any number of host threads
+  // may submit at the same time: events go into a lock-free inbox, and
+  // whichever thread holds the issue lock takes them out in submission order
+  // and issues them.
+  void submit(std::shared_ptr<Event> e);
+  // Submit first and then with no event of another thread in between (e.g. a
+  // launch and the transfer of its results out of a shared DPU symbol).
+  void submit(std::shared_ptr<Event> first, std::shared_ptr<Event> then);
+
+  // While a batch is open, batchable events are recorded instead of enqueued
+  // and run as a single DPU launch. Any other event, a wait, a full batch or
+  // closing the last open batch flushes the recorded events. A batch covers
+  // the events submitted to the queue by every thread while it is open.
+  void begin_batch();
+  void end_batch();
+  void flush_batch();
+  bool batching() const { return batch_depth_.load() > 0; }
 
   void add_fence(std::shared_ptr<Event> e);
 
+  // Block until every submitted event has finished.
   void wait();
-  void process_next();
+  // Block until e (and therefore everything it depends on) has finished.
+  void wait(const std::shared_ptr<Event>& e);
+  // Block until e has finished on rank, which may be before the other ranks.
+  void wait(const std::shared_ptr<Event>& e, uint32_t rank);
+  // Issue what has been submitted so far
   void process_events();
   void debug_print_queue();
 
-  bool has_pending() const { return !operations_.empty(); }
-  std::size_t pending_count() const { return operations_.size(); }
+  bool has_pending();
+  std::size_t inflight_count();
 
  private:
-  std::queue<std::shared_ptr<Event>> operations_;
+  // Pushes newest ... oldest, linked through next_submitted_, at once
+  void push_inbox(Event* newest, Event* oldest);
+  // Takes the inbox in submission order, with issue_lock_ held
+  void drain_inbox();
+  // Takes the inbox unless another thread is issuing, in which case that
+  // thread does so before it lets go of the lock
+  void try_drain();
+  void process_next();
+  // Reads the kernel stats of the launch e has just issued into e
+  void read_kernel_stats(Event& e);
+  void flush_batch_locked();
+  void enqueue(std::shared_ptr<Event> e);
+  // Drop finished events from the in-flight list.
+  void reap();
+
+  DpuStream& stream_;
+  std::atomic<Event*> inbox_{nullptr};  // submitted, newest first
+
+  // Everything below is only touched with issue_lock_ held
+  std::mutex issue_lock_;
+  std::queue<std::shared_ptr<Event>> operations_;  // taken out, not issued
+  std::vector<std::shared_ptr<Event>> inflight_;   // issued, not finished
+
+  std::atomic<uint32_t> batch_depth_{0};
+  std::vector<std::shared_ptr<Event>> batch_;  // recorded, not enqueued
 };
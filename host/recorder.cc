@@ -0,0 +1,277 @@
+#include "recorder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "tracer.h"
+
+namespace {
+
+// Every integer is stored in host byte order
+constexpr char MAGIC[8] = {'V', 'D', 'P', 'U', 'C', 'M', 'D', 'S'};
+constexpr uint32_t VERSION = 2;
+
+// Flags of a record
+constexpr uint8_t VECTOR_TRANSFER = 1;
+constexpr uint8_t HAS_CHECKSUM = 2;
+
+template <typename T>
+void put(std::vector<char>& out, const T& value) {
+  const char* p = reinterpret_cast<const char*>(&value);
+  out.insert(out.end(), p, p + sizeof(T));
+}
+
+void put_u32s(std::vector<char>& out, const std::vector<uint32_t>& values) {
+  put<uint32_t>(out, values.size());
+  for (uint32_t v : values) put(out, v);
+}
+
+// count values of size bytes each, as the number of runs of equal values
+// followed by the length and value of each run
+void put_runs(std::vector<char>& out, const void* values, uint32_t count,
+              std::size_t size) {
+  const char* v = static_cast<const char*>(values);
+  std::size_t runs_at = out.size();
+  uint32_t runs = 0;
+  put(out, runs);
+  for (uint32_t i = 0; i < count; runs++) {
+    uint32_t end = i + 1;
+    while (end < count &&
+           std::memcmp(v + end * size, v + i * size, size) == 0) {
+      end++;
+    }
+    put(out, end - i);
+    out.insert(out.end(), v + i * size, v + (i + 1) * size);
+    i = end;
+  }
+  std::memcpy(out.data() + runs_at, &runs, sizeof(runs));
+}
+
+class reader {
+ public:
+  reader(std::istream& in, const std::string& path) : in_(in), path_(path) {}
+
+  template <typename T>
+  T get() {
+    T value;
+    bytes(&value, sizeof(T));
+    return value;
+  }
+
+  void bytes(void* out, std::size_t size) {
+    if (!in_.read(static_cast<char*>(out), size)) {
+      throw std::runtime_error("Truncated command recording " + path_);
+    }
+  }
+
+  std::vector<uint32_t> u32s() {
+    std::vector<uint32_t> values(get<uint32_t>());
+    for (uint32_t& v : values) v = get<uint32_t>();
+    return values;
+  }
+
+  // count values of size bytes each into out, from runs
+  void runs(void* out, uint32_t count, std::size_t size) {
+    char* o = static_cast<char*>(out);
+    uint32_t runs = get<uint32_t>();
+    uint32_t filled = 0;
+    for (uint32_t r = 0; r < runs; r++) {
+      uint32_t length = get<uint32_t>();
+      if (length == 0 || length > count - filled) {
+        throw std::runtime_error("Corrupt command recording " + path_);
+      }
+      bytes(o + filled * size, size);
+      for (uint32_t i = 1; i < length; i++) {
+        std::memcpy(o + (filled + i) * size, o + filled * size, size);
+      }
+      filled += length;
+    }
+    if (filled != count) {
+      throw std::runtime_error("Corrupt command recording " + path_);
+    }
+  }
+
+  template <typename T>
+  void runs(std::vector<T>& out, uint32_t count) {
+    out.resize(count);
+    runs(out.data(), count, sizeof(T));
+  }
+
+ private:
+  std::istream& in_;
+  const std::string& path_;
+};
+
+}  // namespace
+
+uint64_t CommandRecorder::checksum(const void* data, std::size_t bytes) {
+  // FNV-1a over 8-byte words, then the bytes left
+  const char* p = static_cast<const char*>(data);
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  constexpr uint64_t PRIME = 0x100000001b3ULL;
+  std::size_t words = bytes / 8;
+  for (std::size_t i = 0; i < words; i++) {
+    uint64_t word;
+    std::memcpy(&word, p + i * 8, 8);
+    hash = (hash ^ word) * PRIME;
+  }
+  for (std::size_t i = words * 8; i < bytes; i++) {
+    hash = (hash ^ static_cast<uint8_t>(p[i])) * PRIME;
+  }
+  return hash;
+}
+
+void CommandRecorder::open(const std::string& path,
+                           const CommandHeader& header) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (file_.is_open()) file_.close();
+  file_.open(path, std::ios::binary | std::ios::trunc);
+  if (!file_) {
+    throw std::runtime_error("Cannot write command recording " + path);
+  }
+  checksums_.store(header.checksums);
+  origin_ = EventTracer::now();
+  issued_.store(0, std::memory_order_relaxed);
+
+  buffer_.assign(MAGIC, MAGIC + sizeof(MAGIC));
+  put(buffer_, VERSION);
+  put(buffer_, header.num_dpus);
+  put(buffer_, header.num_tasklets);
+  put<uint8_t>(buffer_, header.checksums);
+  put<uint32_t>(buffer_, header.streams.size());
+  for (const auto& stream : header.streams) {
+    put(buffer_, stream.num_ranks);
+    put(buffer_, stream.num_dpus);
+  }
+  file_.write(buffer_.data(), buffer_.size());
+}
+
+void CommandRecorder::close() {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (file_.is_open()) file_.close();
+}
+
+void CommandRecorder::record(const Event& e) {
+  bool vector_transfer = (e.op == Event::OperationType::DPU_TRANSFER ||
+                          e.op == Event::OperationType::HOST_TRANSFER) &&
+                         e.res != nullptr;
+  // Outside the lock: it reads every byte transferred
+  bool has_checksum = checksums_.load() && e.host_data != nullptr;
+  uint64_t sum = has_checksum ? checksum(e.host_data, e.bytes) : 0;
+
+  std::lock_guard<std::mutex> lock(lock_);
+  if (!file_.is_open()) return;
+  auto since_origin = [this](uint64_t t) {
+    return t > origin_ ? t - origin_ : 0;
+  };
+
+  buffer_.clear();
+  put<uint8_t>(buffer_, static_cast<uint8_t>(e.op));
+  put<uint8_t>(buffer_, (vector_transfer ? VECTOR_TRANSFER : 0) |
+                            (has_checksum ? HAS_CHECKSUM : 0));
+  put(buffer_, e.trace.stream);
+  put(buffer_, e.issue_number);
+  put(buffer_, since_origin(e.trace.submitted));
+  put(buffer_, since_origin(e.trace.issued));
+  put(buffer_, since_origin(e.trace.completed));
+  put(buffer_, e.bytes);
+  if (has_checksum) put(buffer_, sum);
+  put_u32s(buffer_, e.reads);
+  put_u32s(buffer_, e.writes);
+
+  if (e.op == Event::OperationType::COMPUTE) {
+    uint32_t num_dpus = e.args.size();
+    uint32_t num_commands = num_dpus != 0 ? e.commands.size() / num_dpus : 0;
+    put(buffer_, num_dpus);
+    put(buffer_, num_commands);
+    put<uint8_t>(buffer_, !e.programs.empty());
+    put_runs(buffer_, e.args.data(), num_dpus, sizeof(DPU_LAUNCH_ARGS));
+    if (!e.programs.empty()) {
+      put_runs(buffer_, e.programs.data(), num_dpus,
+               sizeof(DPU_FUSED_PROGRAM));
+    }
+    if (num_commands != 0) {
+      // A run is the commands of one DPU
+      put_runs(buffer_, e.commands.data(), num_dpus,
+               num_commands * sizeof(DPU_COMMAND));
+    }
+  } else if (vector_transfer) {
+    const vector_desc& desc = e.res->desc;
+    uint32_t num_dpus = desc.first.size();
+    put(buffer_, num_dpus);
+    put_runs(buffer_, desc.first.data(), num_dpus, sizeof(uint32_t));
+    put_runs(buffer_, desc.second.data(), num_dpus, sizeof(uint32_t));
+  }
+  file_.write(buffer_.data(), buffer_.size());
+}
+
+CommandRecording CommandRecorder::read(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) throw std::runtime_error("Cannot read command recording " + path);
+  reader in(file, path);
+
+  char magic[sizeof(MAGIC)];
+  in.bytes(magic, sizeof(magic));
+  if (std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      in.get<uint32_t>() != VERSION) {
+    throw std::runtime_error(path + " is not a command recording");
+  }
+
+  CommandRecording recording;
+  CommandHeader& header = recording.header;
+  header.num_dpus = in.get<uint32_t>();
+  header.num_tasklets = in.get<uint32_t>();
+  header.checksums = in.get<uint8_t>();
+  header.streams.resize(in.get<uint32_t>());
+  for (auto& stream : header.streams) {
+    stream.num_ranks = in.get<uint32_t>();
+    stream.num_dpus = in.get<uint32_t>();
+  }
+
+  while (file.peek() != std::ifstream::traits_type::eof()) {
+    CommandRecord r;
+    r.op = static_cast<Event::OperationType>(in.get<uint8_t>());
+    uint8_t flags = in.get<uint8_t>();
+    r.vector_transfer = flags & VECTOR_TRANSFER;
+    r.has_checksum = flags & HAS_CHECKSUM;
+    r.stream = in.get<uint32_t>();
+    if (r.stream >= header.streams.size()) {
+      throw std::runtime_error("Corrupt command recording " + path);
+    }
+    r.issue_number = in.get<uint64_t>();
+    r.submitted = in.get<uint64_t>();
+    r.issued = in.get<uint64_t>();
+    r.completed = in.get<uint64_t>();
+    r.bytes = in.get<uint64_t>();
+    if (r.has_checksum) r.checksum = in.get<uint64_t>();
+    r.reads = in.u32s();
+    r.writes = in.u32s();
+
+    if (r.op == Event::OperationType::COMPUTE) {
+      uint32_t num_dpus = in.get<uint32_t>();
+      uint32_t num_commands = in.get<uint32_t>();
+      bool has_programs = in.get<uint8_t>();
+      in.runs(r.args, num_dpus);
+      if (has_programs) in.runs(r.programs, num_dpus);
+      if (num_commands != 0) {
+        r.commands.resize(num_dpus * num_commands);
+        in.runs(r.commands.data(), num_dpus,
+                num_commands * sizeof(DPU_COMMAND));
+      }
+    } else if (r.vector_transfer) {
+      uint32_t num_dpus = in.get<uint32_t>();
+      in.runs(r.desc.first, num_dpus);
+      in.runs(r.desc.second, num_dpus);
+    }
+    recording.records.push_back(std::move(r));
+  }
+
+  // Written as they finished, on the callback threads of every rank, which
+  // is not always the order they were issued in
+  std::sort(recording.records.begin(), recording.records.end(),
+            [](const CommandRecord& a, const CommandRecord& b) {
+              return a.issue_number < b.issue_number;
+            });
+  return recording;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <common.h>
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "queue.h"
+
+// The streams a recording was made on, which a replay needs as well
+struct CommandHeader {
+  struct Stream {
+    uint32_t num_ranks = 0;
+    uint32_t num_dpus = 0;
+  };
+
+  uint32_t num_dpus = 0;
+  uint32_t num_tasklets = 0;  // of the build that recorded it
+  bool checksums = false;
+  std::vector<Stream> streams;
+};
+
+// One event as it was issued
+struct CommandRecord {
+  Event::OperationType op = Event::OperationType::FENCE;
+  // HOST_TRANSFER of a vector, rather than of the results of a reduction
+  bool vector_transfer = false;
+  uint32_t stream = 0;
+  // Order it was issued in, across streams (see Event::issue_number)
+  uint64_t issue_number = 0;
+
+  // EventTracer::now() nanoseconds since the recording started
+  uint64_t submitted = 0;
+  uint64_t issued = 0;
+  uint64_t completed = 0;
+
+  uint64_t bytes = 0;  // moved between the host and the DPUs, see Event
+  bool has_checksum = false;
+  uint64_t checksum = 0;  // of those bytes in host memory
+
+  // MRAM buffers read and written, as in Event
+  std::vector<uint32_t> reads;
+  std::vector<uint32_t> writes;
+  // COMPUTE events: as in Event, per DPU of the stream
+  std::vector<DPU_LAUNCH_ARGS> args;
+  std::vector<DPU_FUSED_PROGRAM> programs;
+  std::vector<DPU_COMMAND> commands;
+  // Vector transfers: MRAM offset and bytes on every DPU
+  vector_desc desc;
+};
+
+struct CommandRecording {
+  CommandHeader header;
+  std::vector<CommandRecord> records;  // by issue_number
+};
+
+// Writes every event finished while recording to a binary file, in the
+// order they finished, for
+// replay_commands() to issue again without the application that submitted
+// it: the operation, the launch arguments of every DPU with the fused
+// programs and batched commands, or the MRAM offset and sizes of the vector
+// transferred, the buffers read and written, and the times it was submitted,
+// issued and completed. Arrays with a value per DPU are stored as runs of
+// equal values, since the DPUs share the MRAM offset of a vector and differ
+// in its element count by one at most, so an event takes a few hundred bytes
+// however many DPUs run it. With checksums, transfers also store a checksum
+// of the host memory they moved, computed on the thread finishing them.
+class CommandRecorder {
+ public:
+  static uint64_t checksum(const void* data, std::size_t bytes);
+
+  // Starts a recording at path, which is truncated; throws
+  // std::runtime_error if it cannot be written
+  void open(const std::string& path, const CommandHeader& header);
+  // Events recorded after this are dropped
+  void close();
+
+  // Called by the issuing thread for each event it issues while recording
+  uint64_t next_issue() {
+    return issued_.fetch_add(1, std::memory_order_relaxed);
+  }
+  // Called by the thread finishing e, with e.trace filled in
+  void record(const Event& e);
+
+  // Reads the recording at path, with the records sorted back into the order
+  // they were issued in; throws std::runtime_error if it is not one
+  static CommandRecording read(const std::string& path);
+
+ private:
+  std::mutex lock_;
+  std::ofstream file_;
+  std::atomic<bool> checksums_{false};
+  std::atomic<uint64_t> issued_{0};
+  uint64_t origin_ = 0;
+  std::vector<char> buffer_;  // record()
+};
+
+// What replaying one event took, in nanoseconds, with the same from the
+// recording: latency from its submission to its completion, and service from
+// the later of its submission and the completion of the event before it on
+// its stream to its own completion, which leaves out the time it was queued
+// behind other events.
+struct ReplayedCommand {
+  const char* name;  // kernel, "batch", or the kind of transfer
+  uint32_t stream;
+  uint64_t bytes;
+  uint64_t recorded_latency;
+  uint64_t recorded_service;
+  uint64_t latency = 0;
+  uint64_t service = 0;
+  // Of what a transfer from the DPUs read back, if the recording has
+  // checksums
+  uint64_t checksum = 0;
+};
+
+// Issues the events of recording again, in the order they were issued, and
+// times each one. The runtime is initialized with the recording's DPU count
+// unless it already is, and repartitioned if its streams differ; it must
+// then match the recording, and no vector may be allocated, as the events
+// use the MRAM the recorded ones did. Transfers to the DPUs move a fixed
+// pattern instead of the recorded data, so the checksums of what is read
+// back differ from the recorded ones but are the same from one replay to the
+// next unless the kernels compute something else. With serial, each event
+// is waited for before the next one is submitted.
+std::vector<ReplayedCommand> replay_commands(const CommandRecording& recording,
+                                             bool serial = false);
@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "logger.inl"
+#include "recorder.h"
+#include "runtime.h"
+#include "stream.h"
+#include "tracer.h"
+#include "vectordpu.h"
+
+namespace {
+
+const char* command_name(const CommandRecord& r) {
+  switch (r.op) {
+    case Event::OperationType::COMPUTE:
+      if (!r.commands.empty()) return "batch";
+      return r.args.empty() ? "launch" : kernel_id_to_string(r.args[0].kernel);
+    case Event::OperationType::DPU_TRANSFER:
+      return "host->dpu";
+    case Event::OperationType::HOST_TRANSFER:
+      return "dpu->host";
+    case Event::OperationType::FENCE:
+      return "fence";
+  }
+  return "event";
+}
+
+// What a replayed transfer moves to the DPUs: 32-bit words that differ from
+// one transfer to the next and are never 0, so that replayed divisions do not
+// divide by zero
+std::shared_ptr<std::vector<char>> pattern(uint64_t bytes, uint32_t seed) {
+  auto data = std::make_shared<std::vector<char>>(bytes);
+  for (uint64_t i = 0; i + 4 <= bytes; i += 4) {
+    uint32_t word = 1 + (seed * 7919 + i / 4) % 1000;
+    std::memcpy(data->data() + i, &word, 4);
+  }
+  return data;
+}
+
+// Event doing what r did, on stream
+std::shared_ptr<Event> create_event(const CommandRecord& r, DpuStream& stream,
+                                    uint32_t seed) {
+  std::shared_ptr<Event> e;
+  switch (r.op) {
+    case Event::OperationType::COMPUTE:
+      e = Event::create(Event::OperationType::COMPUTE);
+      e->args = r.args;
+      e->programs = r.programs;
+      e->commands = r.commands;
+      if (!e->commands.empty()) {
+        e->cb = std::bind(push_commands_and_launch, std::ref(stream),
+                          std::ref(e->args), std::ref(e->commands));
+      } else if (!e->programs.empty()) {
+        e->cb = std::bind(push_program_and_launch, std::ref(stream),
+                          std::ref(e->args), std::ref(e->programs));
+      } else {
+        e->cb = std::bind(push_args_and_launch, std::ref(stream),
+                          std::ref(e->args));
+      }
+      break;
+    case Event::OperationType::DPU_TRANSFER: {
+      auto data = pattern(r.bytes, seed);
+      e = create_vector_xfer(true, stream, data->data(), r.desc);
+      e->host_res = std::move(data);
+      break;
+    }
+    case Event::OperationType::HOST_TRANSFER:
+      if (r.vector_transfer) {
+        auto data = std::make_shared<std::vector<char>>(r.bytes);
+        e = create_vector_xfer(false, stream, data->data(), r.desc);
+        e->host_res = std::move(data);
+      } else {
+        auto results =
+            std::make_shared<std::vector<DPU_REDUCE_RESULT>>(stream.num_dpus());
+        e = Event::create(
+            Event::OperationType::HOST_TRANSFER,
+            std::bind(reduce_xfer_from_dpu, std::ref(stream), results->data()));
+        e->bytes = r.bytes;
+        e->host_data = results->data();
+        e->host_res = std::move(results);
+      }
+      break;
+    case Event::OperationType::FENCE:
+      e = Event::create(Event::OperationType::FENCE);
+      break;
+  }
+  e->reads = r.reads;
+  e->writes = r.writes;
+  return e;
+}
+
+bool streams_match(DpuRuntime& runtime, const CommandHeader& header) {
+  if (runtime.num_streams() != header.streams.size()) return false;
+  for (uint32_t s = 0; s < header.streams.size(); s++) {
+    if (runtime.stream(s).num_ranks() != header.streams[s].num_ranks ||
+        runtime.stream(s).num_dpus() != header.streams[s].num_dpus) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+std::vector<ReplayedCommand> replay_commands(const CommandRecording& recording,
+                                             bool serial) {
+  const CommandHeader& header = recording.header;
+  const std::vector<CommandRecord>& records = recording.records;
+  auto& runtime = DpuRuntime::get();
+  if (!runtime.is_initialized()) {
+    DpuRuntimeOptions options = DpuRuntimeOptions::from_env();
+    options.num_dpus = header.num_dpus;
+    runtime.init(options);
+  }
+  if (runtime.num_dpus() != header.num_dpus) {
+    throw std::runtime_error(
+        "Commands recorded on " + std::to_string(header.num_dpus) +
+        " DPUs, replayed on " + std::to_string(runtime.num_dpus()));
+  }
+  if (!streams_match(runtime, header) && !header.streams.empty()) {
+    runtime.partition(header.streams[0].num_ranks);
+  }
+  if (!streams_match(runtime, header)) {
+    throw std::runtime_error("Commands recorded on other streams");
+  }
+  for (uint32_t s = 0; s < runtime.num_streams(); s++) {
+    if (!runtime.stream(s).get_allocator().empty()) {
+      throw std::logic_error("Commands replayed with live vectors");
+    }
+  }
+
+  std::vector<uint64_t> submitted(records.size());
+  std::vector<uint64_t> completed(records.size());
+  std::vector<uint64_t> checksums(records.size());
+  for (uint32_t i = 0; i < records.size(); i++) {
+    const CommandRecord& r = records[i];
+    DpuStream& stream = runtime.stream(r.stream);
+    std::shared_ptr<Event> e = create_event(r, stream, i);
+
+    // Before the event is marked finished, so waiting for it waits for this
+    bool checksum = header.checksums &&
+                    r.op == Event::OperationType::HOST_TRANSFER;
+    e->on_finish = [&done = completed[i], &sum = checksums[i], checksum,
+                    data = e->host_data, bytes = e->bytes] {
+      done = EventTracer::now();
+      if (checksum) sum = CommandRecorder::checksum(data, bytes);
+    };
+
+    EventQueue& queue = stream.get_event_queue();
+    submitted[i] = EventTracer::now();
+    queue.submit(e);
+    queue.process_events();
+    if (serial) queue.wait(e);
+  }
+  for (uint32_t s = 0; s < runtime.num_streams(); s++) {
+    runtime.stream(s).get_event_queue().wait();
+  }
+
+  // Service is measured from the completion of the event before on the stream
+  auto service = [](uint64_t submitted, uint64_t completed, uint64_t& last) {
+    uint64_t start = std::min(std::max(submitted, last), completed);
+    last = completed;
+    return completed - start;
+  };
+  std::vector<uint64_t> last_recorded(header.streams.size(), 0);
+  std::vector<uint64_t> last_replayed(header.streams.size(), 0);
+  std::vector<ReplayedCommand> replayed;
+  replayed.reserve(records.size());
+  for (uint32_t i = 0; i < records.size(); i++) {
+    const CommandRecord& r = records[i];
+    ReplayedCommand c{command_name(r), r.stream, r.bytes,
+                      r.completed - std::min(r.submitted, r.completed),
+                      service(r.submitted, r.completed,
+                              last_recorded[r.stream])};
+    c.latency = completed[i] - submitted[i];
+    c.service =
+        service(submitted[i], completed[i], last_replayed[r.stream]);
+    c.checksum = checksums[i];
+    replayed.push_back(c);
+  }
+  return replayed;
+}
@@ -4,39 +4,295 @@
 #define CHECK_UPMEM(x) DPU_ASSERT(x)
 #endif
 
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "logger.h"
+#include "logger.inl"
 #include "runtime.h"
 
-allocator& DpuRuntime::get_allocator() { return *allocator_; }
-EventQueue& DpuRuntime::get_event_queue() { return *event_queue_; }
+// MRAM per DPU
+constexpr uint64_t MRAM_BYTES = 64 * 1024 * 1024;
+
+allocator& DpuRuntime::get_allocator() {
+  return default_stream().get_allocator();
+}
+EventQueue& DpuRuntime::get_event_queue() {
+  return default_stream().get_event_queue();
+}
 Logger& DpuRuntime::get_logger() { return *logger_; }
 dpu_set_t& DpuRuntime::dpu_set() { return *dpu_set_; }
 uint32_t DpuRuntime::num_dpus() const { return num_dpus_; }
 uint32_t DpuRuntime::num_tasklets() const { return NR_TASKLETS; }
 
+std::shared_ptr<std::vector<char>> DpuRuntime::staging_buffer(
+    std::size_t bytes) {
+  std::unique_ptr<std::vector<char>> buffer;
+  {
+    std::lock_guard<std::mutex> lock(staging_lock_);
+    if (!staging_pool_.empty()) {
+      buffer = std::move(staging_pool_.back());
+      staging_pool_.pop_back();
+    }
+  }
+  if (!buffer) buffer = std::make_unique<std::vector<char>>();
+  if (buffer->size() < bytes) buffer->resize(bytes);
+
+  return std::shared_ptr<std::vector<char>>(
+      buffer.release(), [this](std::vector<char>* b) {
+        std::lock_guard<std::mutex> lock(staging_lock_);
+        staging_pool_.emplace_back(b);
+      });
+}
+
+CompletionThread& DpuRuntime::completion_thread() {
+  std::lock_guard<std::mutex> lock(completion_lock_);
+  if (!completion_thread_) {
+    completion_thread_ = std::make_unique<CompletionThread>();
+  }
+  return *completion_thread_;
+}
+
+void DpuRuntime::partition(uint32_t stream_ranks) {
+  for (auto& stream : streams_) {
+    stream->get_event_queue().wait();
+    if (!stream->get_allocator().empty()) {
+      throw std::logic_error("DPU streams repartitioned with live vectors");
+    }
+  }
+  streams_.clear();
+
+  if (stream_ranks == 0) stream_ranks = num_ranks_;
+  for (uint32_t first = 0; first < num_ranks_; first += stream_ranks) {
+    uint32_t count = std::min(stream_ranks, num_ranks_ - first);
+    std::vector<uint32_t> rank_dpus(rank_dpus_.begin() + first,
+                                    rank_dpus_.begin() + first + count);
+    streams_.push_back(std::make_unique<DpuStream>(
+        streams_.size(), rank_sets_ + first, rank_dpus, heap_bytes_,
+        xfer_threads_));
+  }
+
+  DPU_LOG(1, "[runtime] ", streams_.size(), " streams of up to ",
+          stream_ranks, " ranks.");
+}
+
+uint64_t DpuRuntime::last_kernel_cycles() {
+  for (auto& stream : streams_) stream->get_event_queue().wait();
+
+  std::vector<uint64_t> cycles(num_dpus_);
+  dpu_set_t dpu;
+  uint32_t idx_dpu;
+  DPU_FOREACH(*dpu_set_, dpu, idx_dpu) {
+    CHECK_UPMEM(dpu_prepare_xfer(dpu, &cycles[idx_dpu]));
+  }
+  CHECK_UPMEM(dpu_push_xfer(*dpu_set_, DPU_XFER_FROM_DPU, "kernel_cycles", 0,
+                            sizeof(uint64_t), DPU_XFER_DEFAULT));
+  return *std::max_element(cycles.begin(), cycles.end());
+}
+
+uint32_t DpuRuntime::block_bytes(KernelID kernel) const {
+  return block_bytes_[kernel];
+}
+
+uint32_t DpuRuntime::max_block_bytes(KernelID kernel) const {
+  return TASKLET_BLOCK_BYTES(kernel_nr_buffers(kernel));
+}
+
+void DpuRuntime::set_block_bytes(KernelID kernel, uint32_t bytes) {
+  block_bytes_[kernel] = std::min(bytes & ~7U, max_block_bytes(kernel));
+}
+
+std::string DpuRuntime::tuning_file_path() {
+  const char* path = std::getenv("VECTORDPU_TUNING_FILE");
+  return path != nullptr ? path : "vectordpu.tuning";
+}
+
+bool DpuRuntime::load_tuning(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) return false;
+
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream fields(line);
+    std::string name;
+    uint32_t bytes;
+    if (!(fields >> name >> bytes)) continue;
+    for (uint32_t id = 0; id < KERNEL_COUNT; id++) {
+      KernelID kernel = static_cast<KernelID>(id);
+      if (name == kernel_id_to_string(kernel)) set_block_bytes(kernel, bytes);
+    }
+  }
+
+  DPU_LOG(1, "[runtime] Loaded block sizes from ", path);
+  return true;
+}
+
+void DpuRuntime::write_trace(const std::string& path) const {
+  std::ofstream file(path);
+  if (!file) throw std::runtime_error("Cannot write trace file " + path);
+  tracer_.write(file);
+}
+
+void DpuRuntime::start_recording(const std::string& path, bool checksums) {
+  stop_recording();
+  CommandHeader header;
+  header.num_dpus = num_dpus_;
+  header.num_tasklets = num_tasklets();
+  header.checksums = checksums;
+  for (auto& stream : streams_) {
+    header.streams.push_back({stream->num_ranks(), stream->num_dpus()});
+  }
+  recorder_.open(path, header);
+  record_file_ = path;
+  recording_.store(true);
+
+  DPU_LOG(1, "[runtime] Recording commands to ", path);
+}
+
+void DpuRuntime::stop_recording() {
+  if (!recording_.exchange(false)) return;
+  for (auto& stream : streams_) stream->get_event_queue().wait();
+  recorder_.close();
+
+  DPU_LOG(1, "[runtime] Commands recorded to ", record_file_);
+}
+
+void DpuRuntime::save_tuning(const std::string& path) const {
+  std::ofstream file(path);
+  if (!file) throw std::runtime_error("Cannot write tuning file " + path);
+
+  file << "# <kernel> <DMA block bytes>" << std::endl;
+  for (uint32_t id = 0; id < KERNEL_COUNT; id++) {
+    KernelID kernel = static_cast<KernelID>(id);
+    if (block_bytes_[id] != 0) {
+      file << kernel_id_to_string(kernel) << " " << block_bytes_[id]
+           << std::endl;
+    }
+  }
+}
+
+DpuRuntimeOptions DpuRuntimeOptions::from_env() {
+  DpuRuntimeOptions options;
+  if (const char* dpus = std::getenv("VECTORDPU_NR_DPUS")) {
+    if (std::string(dpus) == "all") {
+      options.num_dpus = ALLOCATE_ALL;
+    } else {
+      options.num_dpus = std::stoul(dpus);
+    }
+  }
+  if (const char* profile = std::getenv("VECTORDPU_PROFILE")) {
+    options.profile = profile;
+  }
+  if (const char* heap = std::getenv("VECTORDPU_HEAP_MB")) {
+    options.heap_bytes = std::stoull(heap) * 1024 * 1024;
+  }
+  if (const char* binary = std::getenv("VECTORDPU_BINARY")) {
+    options.binary = binary;
+  }
+  if (const char* threads = std::getenv("VECTORDPU_XFER_THREADS")) {
+    options.xfer_threads = std::stoul(threads);
+  }
+  if (const char* ranks = std::getenv("VECTORDPU_STREAM_RANKS")) {
+    options.stream_ranks = std::stoul(ranks);
+  }
+  if (const char* wait = std::getenv("VECTORDPU_WAIT")) {
+    options.wait_mode =
+        std::string(wait) == "spin" ? WaitMode::SPIN : WaitMode::BLOCK;
+  }
+  if (const char* stats = std::getenv("VECTORDPU_KERNEL_STATS")) {
+    options.kernel_stats = std::string(stats) == "1";
+  }
+  if (const char* trace = std::getenv("VECTORDPU_TRACE")) {
+    options.trace_file = trace;
+  }
+  if (const char* record = std::getenv("VECTORDPU_RECORD")) {
+    options.record_file = record;
+  }
+  if (const char* sums = std::getenv("VECTORDPU_RECORD_CHECKSUMS")) {
+    options.record_checksums = std::string(sums) == "1";
+  }
+  return options;
+}
+
 void DpuRuntime::init(uint32_t num_dpus) {
+  DpuRuntimeOptions options = DpuRuntimeOptions::from_env();
+  options.num_dpus = num_dpus;
+  init(options);
+}
+
+void DpuRuntime::init(const DpuRuntimeOptions& options) {
   if (initialized_) return;  // idempotent
-  num_dpus_ = num_dpus;
   logger_ = std::make_unique<Logger>();
 
-#if ENABLE_DPU_LOGGING == 1
-  logger_->lock() << "[runtime] Initializing DPU runtime with " << num_dpus_
-                  << " DPUs..." << std::endl;
-#endif
+  uint32_t requested = options.num_dpus != 0 ? options.num_dpus : NR_DPUS;
+  if (requested == DpuRuntimeOptions::ALLOCATE_ALL) {
+    requested = DPU_ALLOCATE_ALL;
+  }
+  const char* binary =
+      options.binary.empty() ? DPU_RUNTIME : options.binary.c_str();
 
   // Allocate DPU set
   dpu_set_ = new dpu_set_t();
-  DPU_ASSERT(dpu_alloc(num_dpus_, "backend=simulator", dpu_set_));
-  DPU_ASSERT(dpu_load(*dpu_set_, DPU_RUNTIME, nullptr));
+  DPU_ASSERT(dpu_alloc(requested, options.profile.c_str(), dpu_set_));
+  DPU_ASSERT(dpu_get_nr_dpus(*dpu_set_, &num_dpus_));
 
-#if ENABLE_DPU_LOGGING == 1
-  logger_->lock() << "[runtime] DPU runtime initialized." << std::endl;
-#endif
+  // Ranks, in the order DPU_FOREACH visits their DPUs
+  DPU_ASSERT(dpu_get_nr_ranks(*dpu_set_, &num_ranks_));
+  rank_sets_ = new dpu_set_t[num_ranks_];
+  rank_dpus_.resize(num_ranks_);
+  dpu_set_t rank;
+  uint32_t idx_rank;
+  DPU_RANK_FOREACH(*dpu_set_, rank, idx_rank) {
+    rank_sets_[idx_rank] = rank;
+    DPU_ASSERT(dpu_get_nr_dpus(rank, &rank_dpus_[idx_rank]));
+  }
+
+  xfer_threads_ = options.xfer_threads != 0
+                      ? options.xfer_threads
+                      : std::max(std::thread::hardware_concurrency(), 1U);
+  if (options.wait_mode) Event::set_wait_mode(*options.wait_mode);
+  set_profiling(options.kernel_stats);
+  print_profile_ = options.kernel_stats;
+  set_tracing(!options.trace_file.empty());
+  trace_file_ = options.trace_file;
+
+  DPU_LOG(1, "[runtime] Initializing DPU runtime with ", num_dpus_,
+          " DPUs in ", num_ranks_, " ranks (", options.profile, ")...");
+
+  dpu_program_t* program = nullptr;
+  DPU_ASSERT(dpu_load(*dpu_set_, binary, &program));
+
+  // The MRAM heap starts after the program's own MRAM variables
+  dpu_symbol_t heap_start;
+  DPU_ASSERT(dpu_get_symbol(program, DPU_MRAM_HEAP_POINTER_NAME, &heap_start));
+  uint64_t available = MRAM_BYTES - heap_start.address % MRAM_BYTES;
+  heap_bytes_ = options.heap_bytes != 0 ? options.heap_bytes : available;
+  if (heap_bytes_ > available) {
+    throw std::invalid_argument("MRAM heap of " + std::to_string(heap_bytes_) +
+                                " bytes exceeds the " +
+                                std::to_string(available) + " available");
+  }
+  heap_bytes_ &= ~7ULL;
+
+  DPU_LOG(1, "[runtime] DPU runtime initialized with ", heap_bytes_ / 1024,
+          " KiB of heap per DPU.");
+
+  // Allocators and event queues
+  partition(options.stream_ranks);
 
-  // Allocate allocator and event queue
-  allocator_ =
-      std::make_unique<allocator>(0, 64 * 1024 * 1024 * num_dpus_, num_dpus_);
-  event_queue_ = std::make_unique<EventQueue>();
+  block_bytes_.fill(0);
+  load_tuning(tuning_file_path());
+
+  if (!options.record_file.empty()) {
+    start_recording(options.record_file, options.record_checksums);
+  }
 
   initialized_ = true;
 }
@@ -44,24 +300,44 @@ void DpuRuntime::init(uint32_t num_dpus) {
 void DpuRuntime::shutdown() {
   if (!initialized_) return;
 
-#if ENABLE_DPU_LOGGING == 1
-  logger_->lock() << "[runtime] Shutting down DPU runtime..." << std::endl;
-#endif
+  DPU_LOG(1, "[runtime] Shutting down DPU runtime...");
 
-  while (event_queue_->has_pending()) {
-    logger_->lock() << "[runtime] Waiting for pending events to complete..."
-                    << std::endl;
-    sleep(1);
+  for (auto& stream : streams_) {
+    EventQueue& queue = stream->get_event_queue();
+    if (queue.has_pending() || queue.inflight_count() > 0) {
+      logger_->log("[runtime] Waiting for pending events to complete...");
+      queue.wait();
+    }
+  }
+  // Lets the coroutines resumed by the last events run. Outside the lock, as
+  // they may await more events.
+  std::unique_ptr<CompletionThread> completion;
+  {
+    std::lock_guard<std::mutex> lock(completion_lock_);
+    completion = std::move(completion_thread_);
+  }
+  completion.reset();
+
+  if (print_profile_) {
+    auto log = logger_->lock();
+    log << "[runtime] Kernel profile:" << std::endl;
+    profiler_.print(log.stream);
+  }
+  stop_recording();
+  if (!trace_file_.empty()) {
+    write_trace(trace_file_);
+    logger_->log("[runtime] Trace written to ", trace_file_);
   }
 
   // if (initialized_) {
   //   DPU_ASSERT(dpu_free(dpu_set_));
   // }
 
-  allocator_.reset();
-  event_queue_.reset();
+  streams_.clear();
   logger_.reset();
   dpu_set_ = nullptr;
+  delete[] rank_sets_;
+  rank_sets_ = nullptr;
 
   initialized_ = false;
 }
@@ -1,13 +1,62 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
 
 #include "allocator.h"
 #include "logger.h"
+#include "profiler.h"
 #include "queue.h"
+#include "recorder.h"
+#include "stream.h"
+#include "tracer.h"
+#include "workers.h"
 
 struct dpu_set_t;
 
+// Options for DpuRuntime::init(). from_env() applies these environment
+// variables to the defaults:
+//   VECTORDPU_NR_DPUS  number of DPUs, or "all" for every available rank
+//   VECTORDPU_PROFILE  dpu_alloc profile, e.g. "backend=hw"
+//   VECTORDPU_HEAP_MB  MRAM heap per DPU in MiB
+//   VECTORDPU_BINARY   path of the DPU program
+//   VECTORDPU_XFER_THREADS  host threads preparing transfers, one per rank
+//                           at most
+//   VECTORDPU_STREAM_RANKS  ranks per stream, 0 for a single stream
+//   VECTORDPU_WAIT     "spin" to poll for events instead of sleeping
+//   VECTORDPU_KERNEL_STATS  "1" to profile kernels and print the profile at
+//                           shutdown
+//   VECTORDPU_TRACE    path to trace events to, written at shutdown
+//   VECTORDPU_RECORD   path to record the commands issued to, for replay
+//   VECTORDPU_RECORD_CHECKSUMS  "1" to record checksums of the data
+//                               transferred as well
+struct DpuRuntimeOptions {
+  static constexpr uint32_t ALLOCATE_ALL = UINT32_MAX;  // DPU_ALLOCATE_ALL
+
+  uint32_t num_dpus = 0;  // 0: NR_DPUS, set when the library is built
+  std::string profile = "backend=simulator";
+  uint64_t heap_bytes = 0;  // per DPU; 0: the MRAM the program leaves free
+  std::string binary;       // empty: DPU_RUNTIME, set when built
+  uint32_t xfer_threads = 0;  // 0: one per hardware thread
+  uint32_t stream_ranks = 0;  // see DpuRuntime::partition()
+  // Unset: Event::wait_mode() is left as it is, BLOCK unless
+  // Event::set_wait_mode() has been called
+  std::optional<WaitMode> wait_mode;
+  bool kernel_stats = false;  // see DpuRuntime::set_profiling()
+  std::string trace_file;     // empty: no tracing, see set_tracing()
+  std::string record_file;    // empty: no recording, see start_recording()
+  bool record_checksums = false;
+
+  static DpuRuntimeOptions from_env();
+};
+
 class DpuRuntime {
  private:
   DpuRuntime() : initialized_(false) {}
@@ -16,9 +65,32 @@ class DpuRuntime {
   bool initialized_;
   dpu_set_t* dpu_set_;
   uint32_t num_dpus_;
-  std::unique_ptr<allocator> allocator_;
-  std::unique_ptr<EventQueue> event_queue_;
+  uint64_t heap_bytes_ = 0;  // per DPU
+  uint32_t num_ranks_ = 0;
+  dpu_set_t* rank_sets_ = nullptr;
+  std::vector<uint32_t> rank_dpus_;
+  uint32_t xfer_threads_ = 1;
+  std::vector<std::unique_ptr<DpuStream>> streams_;
   std::unique_ptr<Logger> logger_;
+  std::array<uint32_t, KERNEL_COUNT> block_bytes_{};  // 0 = kernel maximum
+
+  std::mutex staging_lock_;
+  std::vector<std::unique_ptr<std::vector<char>>> staging_pool_;
+
+  std::mutex completion_lock_;
+  std::unique_ptr<CompletionThread> completion_thread_;
+
+  std::atomic<bool> profiling_{false};
+  bool print_profile_ = false;  // at shutdown
+  KernelProfiler profiler_;
+
+  std::atomic<bool> tracing_{false};
+  std::string trace_file_;  // written at shutdown
+  EventTracer tracer_;
+
+  std::atomic<bool> recording_{false};
+  std::string record_file_;
+  CommandRecorder recorder_;
 
  public:
   // Delete copy/move
@@ -31,15 +103,88 @@ class DpuRuntime {
     return instance;
   }
 
-  void init(uint32_t num_dpus);
+  void init(const DpuRuntimeOptions& options = DpuRuntimeOptions::from_env());
+  void init(uint32_t num_dpus);  // options from the environment otherwise
   bool is_initialized() const { return initialized_; }
 
+  // Allocator and queue of the default stream
   allocator& get_allocator();
   EventQueue& get_event_queue();
   Logger& get_logger();
   dpu_set_t& dpu_set();
   uint32_t num_dpus() const;
   uint32_t num_tasklets() const;
+  uint64_t heap_bytes() const { return heap_bytes_; }
+
+  uint32_t num_ranks() const { return num_ranks_; }
+
+  // Splits the ranks into streams of stream_ranks ranks each (the last one
+  // gets what is left), or into a single stream of all ranks for 0. Waits for
+  // every queue; throws std::logic_error while any vector is still allocated.
+  void partition(uint32_t stream_ranks);
+  uint32_t num_streams() const { return streams_.size(); }
+  DpuStream& stream(uint32_t id) { return *streams_[id]; }
+  // Vectors created without a stream go to stream 0
+  DpuStream& default_stream() { return *streams_[0]; }
+
+  // Host buffer of at least bytes for the unaligned tails of a transfer. It
+  // returns to a pool when the last reference is dropped, so steady-state
+  // transfers allocate nothing.
+  std::shared_ptr<std::vector<char>> staging_buffer(std::size_t bytes);
+
+  // Where coroutines awaiting a dpu_future resume; started on first use
+  CompletionThread& completion_thread();
+
+  // Cycles the slowest DPU spent in the last kernel. Waits for the queue.
+  uint64_t last_kernel_cycles();
+
+  // While profiling, every launch also reads back the cycle counts the DPU
+  // program keeps per command, and kernel_profile() sums them per kernel.
+  // Costs one more transfer per launch; off by default.
+  void set_profiling(bool enabled) { profiling_.store(enabled); }
+  bool profiling() const { return profiling_.load(std::memory_order_relaxed); }
+  KernelProfile kernel_profile(KernelID kernel) const {
+    return profiler_.profile(kernel);
+  }
+  void reset_kernel_profiles() { profiler_.reset(); }
+  void print_kernel_profiles(std::ostream& out) const { profiler_.print(out); }
+  KernelProfiler& profiler() { return profiler_; }
+
+  // While tracing, every event submitted records when it was submitted,
+  // issued and completed on each rank, and write_trace() writes those that
+  // have finished as a Chrome trace (see EventTracer). Off by default.
+  void set_tracing(bool enabled) { tracing_.store(enabled); }
+  bool tracing() const { return tracing_.load(std::memory_order_relaxed); }
+  void write_trace(const std::string& path) const;
+  void reset_trace() { tracer_.reset(); }
+  EventTracer& tracer() { return tracer_; }
+
+  // While recording, every event submitted is written to a command recording
+  // at path when it finishes (see CommandRecorder), with a checksum of the
+  // host data of every transfer if checksums. replay_commands() issues the
+  // events again. The recording holds the streams as they were when it
+  // started, so they should not be repartitioned until it stops.
+  // stop_recording() waits for every queue so that nothing recorded is left
+  // out; shutdown() stops it as well. Off by default.
+  void start_recording(const std::string& path, bool checksums = false);
+  void stop_recording();
+  bool recording() const {
+    return recording_.load(std::memory_order_relaxed);
+  }
+  CommandRecorder& recorder() { return recorder_; }
+
+  // DMA block size passed to a kernel in DPU_LAUNCH_ARGS. Settings are rounded
+  // down to 8 bytes and bounded by the kernel's WRAM share; 0 restores the
+  // maximum.
+  uint32_t block_bytes(KernelID kernel) const;
+  uint32_t max_block_bytes(KernelID kernel) const;
+  void set_block_bytes(KernelID kernel, uint32_t bytes);
+
+  // Tuning file with one "<kernel name> <block bytes>" line per kernel. init()
+  // loads it from tuning_file_path() when it exists.
+  static std::string tuning_file_path();
+  bool load_tuning(const std::string& path);
+  void save_tuning(const std::string& path) const;
 
   void shutdown();
 };
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// std::function without the allocation: callables of up to Capacity bytes
+// (a bound function pointer with a few references, or a lambda with a few
+// captures) are stored inline. Larger ones still go to the heap. Move-only.
+template <typename Signature, std::size_t Capacity = 64>
+class small_function;
+
+template <typename R, typename... Args, std::size_t Capacity>
+class small_function<R(Args...), Capacity> {
+ public:
+  small_function() = default;
+  small_function(std::nullptr_t) {}
+
+  template <typename F, typename = std::enable_if_t<!std::is_same_v<
+                            std::decay_t<F>, small_function>>>
+  small_function(F&& f) {
+    using Fn = std::decay_t<F>;
+    if constexpr (fits_inline<Fn>()) {
+      ::new (storage_) Fn(std::forward<F>(f));
+      ops_ = &inline_ops<Fn>;
+    } else {
+      *reinterpret_cast<Fn**>(storage_) = new Fn(std::forward<F>(f));
+      ops_ = &heap_ops<Fn>;
+    }
+  }
+
+  small_function(small_function&& other) noexcept { take(other); }
+  small_function& operator=(small_function&& other) noexcept {
+    if (this != &other) {
+      reset();
+      take(other);
+    }
+    return *this;
+  }
+  template <typename F>
+  small_function& operator=(F&& f) {
+    return *this = small_function(std::forward<F>(f));
+  }
+  small_function& operator=(std::nullptr_t) {
+    reset();
+    return *this;
+  }
+
+  small_function(const small_function&) = delete;
+  small_function& operator=(const small_function&) = delete;
+
+  ~small_function() { reset(); }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+
+  R operator()(Args... args) const {
+    return ops_->invoke(storage_, std::forward<Args>(args)...);
+  }
+
+ private:
+  struct ops {
+    R (*invoke)(void*, Args&&...);
+    void (*move)(void* from, void* to);  // and destroy from
+    void (*destroy)(void*);
+  };
+
+  template <typename Fn>
+  static constexpr bool fits_inline() {
+    return sizeof(Fn) <= Capacity &&
+           alignof(Fn) <= alignof(std::max_align_t) &&
+           std::is_nothrow_move_constructible_v<Fn>;
+  }
+
+  template <typename Fn>
+  static constexpr ops inline_ops = {
+      [](void* s, Args&&... args) -> R {
+        return (*static_cast<Fn*>(s))(std::forward<Args>(args)...);
+      },
+      [](void* from, void* to) {
+        ::new (to) Fn(std::move(*static_cast<Fn*>(from)));
+        static_cast<Fn*>(from)->~Fn();
+      },
+      [](void* s) { static_cast<Fn*>(s)->~Fn(); }};
+
+  template <typename Fn>
+  static constexpr ops heap_ops = {
+      [](void* s, Args&&... args) -> R {
+        return (**static_cast<Fn**>(s))(std::forward<Args>(args)...);
+      },
+      [](void* from, void* to) {
+        *static_cast<Fn**>(to) = *static_cast<Fn**>(from);
+      },
+      [](void* s) { delete *static_cast<Fn**>(s); }};
+
+  void take(small_function& other) {
+    if (other.ops_ == nullptr) return;
+    other.ops_->move(other.storage_, storage_);
+    ops_ = std::exchange(other.ops_, nullptr);
+  }
+
+  void reset() {
+    if (ops_ == nullptr) return;
+    ops_->destroy(storage_);
+    ops_ = nullptr;
+  }
+
+  alignas(std::max_align_t) mutable unsigned char storage_[Capacity];
+  const ops* ops_ = nullptr;
+};
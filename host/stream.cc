@@ -0,0 +1,40 @@
+#ifndef DPURT
+#define DPURT
+#include <dpu>  // UPMEM rt syslib
+#define CHECK_UPMEM(x) DPU_ASSERT(x)
+#endif
+
+#include "stream.h"
+
+#include <algorithm>
+
+DpuStream::DpuStream(uint32_t id, dpu_set_t* rank_sets,
+                     const std::vector<uint32_t>& rank_dpus,
+                     uint64_t heap_bytes, uint32_t xfer_threads)
+    : id_(id),
+      rank_sets_(rank_sets),
+      rank_first_dpu_(1, 0),
+      // The calling thread prepares transfers too
+      workers_(std::min<uint32_t>(xfer_threads, rank_dpus.size()) - 1) {
+  for (uint32_t dpus : rank_dpus) {
+    rank_first_dpu_.push_back(rank_first_dpu_.back() + dpus);
+  }
+  allocator_ =
+      std::make_unique<allocator>(0, heap_bytes * num_dpus(), num_dpus());
+  event_queue_ = std::make_unique<EventQueue>(*this);
+}
+
+// Events hold on to buffers that go back to the allocator
+DpuStream::~DpuStream() { event_queue_.reset(); }
+
+dpu_set_t& DpuStream::rank_set(uint32_t rank) { return rank_sets_[rank]; }
+
+void DpuStream::for_each_rank(const std::function<void(uint32_t)>& fn) {
+  workers_.parallel_for(num_ranks(), fn);
+}
+
+void DpuStream::launch() {
+  for (uint32_t r = 0; r < num_ranks(); r++) {
+    CHECK_UPMEM(dpu_launch(rank_sets_[r], DPU_ASYNCHRONOUS));
+  }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "allocator.h"
+#include "queue.h"
+#include "workers.h"
+
+struct dpu_set_t;
+
+// ============================
+// DPU Streams
+// ============================
+// A group of whole ranks with its own MRAM allocator and event queue. Vectors
+// live on one stream and are spread over its DPUs only, and the ops on them
+// are issued to its ranks only, so work on different streams runs on separate
+// hardware and may be submitted from different host threads. DPU operations
+// are issued rank by rank: a rank is the smallest set the SDK launches,
+// broadcasts to and reports completion for on its own.
+class DpuStream {
+ public:
+  // ranks are rank_sets[0 .. num_ranks - 1], with rank_dpus DPUs each
+  DpuStream(uint32_t id, dpu_set_t* rank_sets,
+            const std::vector<uint32_t>& rank_dpus, uint64_t heap_bytes,
+            uint32_t xfer_threads);
+  ~DpuStream();
+
+  DpuStream(const DpuStream&) = delete;
+  DpuStream& operator=(const DpuStream&) = delete;
+
+  uint32_t id() const { return id_; }
+  uint32_t num_dpus() const { return rank_first_dpu_.back(); }
+  allocator& get_allocator() { return *allocator_; }
+  EventQueue& get_event_queue() { return *event_queue_; }
+
+  // The DPUs of rank r are rank_first_dpu(r) ... rank_first_dpu(r + 1) - 1 in
+  // the stream's DPU order
+  uint32_t num_ranks() const { return rank_first_dpu_.size() - 1; }
+  dpu_set_t& rank_set(uint32_t rank);
+  uint32_t rank_first_dpu(uint32_t rank) const {
+    return rank_first_dpu_[rank];
+  }
+
+  // Runs fn(rank) for every rank on the stream's transfer threads and returns
+  // once all have returned. Every rank executes its operations in the order
+  // they are issued, so fn may issue asynchronous operations on rank_set(rank).
+  void for_each_rank(const std::function<void(uint32_t)>& fn);
+
+  // Launches the DPU program on every rank, asynchronously
+  void launch();
+
+ private:
+  uint32_t id_;
+  dpu_set_t* rank_sets_;  // owned by the runtime
+  std::vector<uint32_t> rank_first_dpu_;  // and num_dpus() at the end
+  WorkerPool workers_;
+  std::unique_ptr<allocator> allocator_;
+  std::unique_ptr<EventQueue> event_queue_;
+};
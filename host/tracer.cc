@@ -0,0 +1,202 @@
+#include "tracer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <tuple>
+#include <utility>
+
+#include "logger.inl"
+#include "queue.h"
+
+namespace {
+
+const char* event_name(const Event& e) {
+  switch (e.op) {
+    case Event::OperationType::COMPUTE:
+      if (!e.commands.empty()) return "batch";
+      return e.args.empty() ? "launch" : kernel_id_to_string(e.args[0].kernel);
+    case Event::OperationType::DPU_TRANSFER:
+      return "host->dpu";
+    case Event::OperationType::HOST_TRANSFER:
+      return "dpu->host";
+    case Event::OperationType::FENCE:
+      return "fence";
+  }
+  return "event";
+}
+
+const char* event_category(const Event& e) {
+  switch (e.op) {
+    case Event::OperationType::COMPUTE:
+      return "compute";
+    case Event::OperationType::DPU_TRANSFER:
+      return "dpu_transfer";
+    case Event::OperationType::HOST_TRANSFER:
+      return "host_transfer";
+    case Event::OperationType::FENCE:
+      return "fence";
+  }
+  return "event";
+}
+
+}  // namespace
+
+uint64_t EventTracer::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+uint32_t EventTracer::thread_id() {
+  static std::atomic<uint32_t> next{0};
+  thread_local uint32_t id = next++;
+  return id;
+}
+
+void EventTracer::reset() {
+  std::lock_guard<std::mutex> lock(lock_);
+  events_.clear();
+  origin_ = now();
+}
+
+void EventTracer::record(const Event& e) {
+  EventTrace t = e.trace;
+  t.name = event_name(e);
+  t.category = event_category(e);
+  t.bytes = e.bytes;
+  if (e.op == Event::OperationType::COMPUTE) {
+    // What the launch pushes besides the vectors
+    t.bytes += e.args.size() * sizeof(DPU_LAUNCH_ARGS) +
+               e.programs.size() * sizeof(DPU_FUSED_PROGRAM) +
+               e.commands.size() * sizeof(DPU_COMMAND);
+  }
+  for (std::size_t c = 0; c < e.batched.size(); c++) {
+    if (c != 0) t.detail += ',';
+    t.detail += kernel_id_to_string(e.commands[c].args.kernel);
+  }
+
+  std::lock_guard<std::mutex> lock(lock_);
+  events_.push_back(std::move(t));
+}
+
+std::vector<EventTrace> EventTracer::events() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return events_;
+}
+
+void EventTracer::write(std::ostream& out) const {
+  std::vector<EventTrace> events;
+  uint64_t origin;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    events = events_;
+    origin = origin_;
+  }
+  // Microseconds since reset()
+  auto us = [origin](uint64_t t) {
+    return t > origin ? (t - origin) / 1000.0 : 0.0;
+  };
+
+  char line[512];
+  bool first = true;
+  auto emit = [&] {
+    out << (first ? "\n" : ",\n") << line;
+    first = false;
+  };
+
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  std::snprintf(line, sizeof(line),
+                "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+                "\"args\":{\"name\":\"host\"}}");
+  emit();
+
+  std::set<uint32_t> threads;
+  // Slices of every rank, keyed by (stream, rank): rank completion, issue
+  // completion and event
+  std::map<std::pair<uint32_t, uint32_t>,
+           std::vector<std::tuple<uint64_t, uint64_t, std::size_t>>>
+      ranks;
+  for (std::size_t i = 0; i < events.size(); i++) {
+    const EventTrace& t = events[i];
+    threads.insert({t.submit_thread, t.issue_thread, t.callback_thread});
+    for (uint32_t r = 0; r < t.rank_completed.size(); r++) {
+      ranks[{t.stream, r}].emplace_back(t.rank_completed[r], t.issue_done, i);
+    }
+
+    // From submission to the end of the callback, overlapping the others
+    std::snprintf(line, sizeof(line),
+                  "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"b\",\"id\":%zu,"
+                  "\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"args\":{\"bytes\":%llu,"
+                  "\"stream\":%u,\"dpus\":%u,\"commands\":\"",
+                  t.name, t.category, i, t.submit_thread, us(t.submitted),
+                  static_cast<unsigned long long>(t.bytes), t.stream,
+                  t.num_dpus);
+    emit();
+    out << t.detail << "\"}}";  // up to BATCH_MAX_COMMANDS kernel names
+    std::snprintf(line, sizeof(line),
+                  "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"e\",\"id\":%zu,"
+                  "\"pid\":0,\"tid\":%u,\"ts\":%.3f}",
+                  t.name, t.category, i, t.submit_thread, us(t.callback_done));
+    emit();
+    // Pushing the transfers, arguments and launch
+    std::snprintf(line, sizeof(line),
+                  "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,"
+                  "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"queued_us\":"
+                  "%.3f}}",
+                  t.name, t.category, t.issue_thread, us(t.issued),
+                  us(t.issue_done) - us(t.issued),
+                  us(t.issued) - us(t.submitted));
+    emit();
+    std::snprintf(line, sizeof(line),
+                  "{\"name\":\"%s callback\",\"cat\":\"%s\",\"ph\":\"X\","
+                  "\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                  t.name, t.category, t.callback_thread, us(t.completed),
+                  us(t.callback_done) - us(t.completed));
+    emit();
+  }
+
+  for (uint32_t tid : threads) {
+    std::snprintf(line, sizeof(line),
+                  "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,"
+                  "\"args\":{\"name\":\"thread %u\"}}",
+                  tid, tid);
+    emit();
+  }
+
+  std::set<uint32_t> streams;
+  for (auto& [key, slices] : ranks) {
+    auto [stream, rank] = key;
+    uint32_t pid = stream + 1;
+    if (streams.insert(stream).second) {
+      std::snprintf(line, sizeof(line),
+                    "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,"
+                    "\"args\":{\"name\":\"stream %u\"}}",
+                    pid, stream);
+      emit();
+    }
+    std::snprintf(line, sizeof(line),
+                  "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,"
+                  "\"tid\":%u,\"args\":{\"name\":\"rank %u\"}}",
+                  pid, rank, rank);
+    emit();
+
+    // A rank runs its operations in issue order, one at a time
+    std::sort(slices.begin(), slices.end());
+    uint64_t previous = 0;
+    for (auto [completed, issue_done, i] : slices) {
+      uint64_t start = std::min(std::max(issue_done, previous), completed);
+      std::snprintf(line, sizeof(line),
+                    "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%u,"
+                    "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    events[i].name, events[i].category, pid, rank, us(start),
+                    us(completed) - us(start));
+      emit();
+      previous = completed;
+    }
+  }
+  out << "\n]}\n";
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class Event;
+
+// What the host saw of one event: when it was submitted, issued and
+// completed, in EventTracer::now() nanoseconds.
+struct EventTrace {
+  const char* name = "";      // kernel, or the kind of transfer
+  const char* category = "";  // operation type
+  std::string detail;         // e.g. the kernels of a batched launch
+  uint64_t bytes = 0;         // moved between the host and the DPUs
+  uint32_t stream = 0;
+  uint32_t num_dpus = 0;
+
+  uint64_t submitted = 0;
+  uint64_t issued = 0;      // the issuing thread started pushing it
+  uint64_t issue_done = 0;  // and had pushed it, asynchronously
+  uint64_t completed = 0;   // the last rank had finished it
+  uint64_t callback_done = 0;
+  std::vector<uint64_t> rank_completed;  // per rank of the stream
+
+  // EventTracer::thread_id() of the threads involved
+  uint32_t submit_thread = 0;
+  uint32_t issue_thread = 0;
+  uint32_t callback_thread = 0;
+};
+
+// Timeline of every event finished while tracing, written out as Chrome
+// trace-event JSON (chrome://tracing, ui.perfetto.dev). Host threads get a
+// track each with the issue of every event and the completion callbacks, and
+// every rank of a stream gets one with the time it spent on each event: from
+// the later of its issue and the rank's previous completion, to its own.
+// Completion callbacks of different streams record concurrently.
+class EventTracer {
+ public:
+  static uint64_t now();
+  // Small, stable number of the calling thread
+  static uint32_t thread_id();
+
+  // Drops what was recorded; timestamps are written relative to this
+  void reset();
+  // Called by the thread finishing e, with e.trace filled in up to the
+  // callback
+  void record(const Event& e);
+  std::vector<EventTrace> events() const;
+
+  void write(std::ostream& out) const;
+
+ private:
+  mutable std::mutex lock_;
+  uint64_t origin_ = now();
+  std::vector<EventTrace> events_;
+};
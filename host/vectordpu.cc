@@ -2,54 +2,36 @@
 
 #include "logger.inl"
 
-// Binary operators
-template <typename T>
-dpu_vector<T> operator+(const dpu_vector<T>& lhs, const dpu_vector<T>& rhs) {
-  return launch_binop(lhs, rhs, BinaryKernelSelector<T>::add());
-}
-
-template <typename T>
-dpu_vector<T> operator-(const dpu_vector<T>& lhs, const dpu_vector<T>& rhs) {
-  return launch_binop(lhs, rhs, BinaryKernelSelector<T>::sub());
-}
-
-// Unary operators
-template <typename T>
-dpu_vector<T> operator-(const dpu_vector<T>& a) {
-  return launch_unary(a, UnaryKernelSelector<T>::negate());
-}
-
-template <typename T>
-dpu_vector<T> abs(const dpu_vector<T>& a) {
-  return launch_unary(a, UnaryKernelSelector<T>::abs());
-}
-
 // Template instantiations for shared library
-#define INSTANTIATE_BINARY_OP(T, OP)                     \
-  template dpu_vector<T> OP<T>(const dpu_vector<T>& lhs, \
-                               const dpu_vector<T>& rhs);
-#define INSTANTIATE_UNARY_OP(T, OP) \
-  template dpu_vector<T> OP<T>(const dpu_vector<T>& vec);
-#define INSTANTIATE_TO_CPU(T) template std::vector<T> dpu_vector<T>::to_cpu();
-#define INSTANTIATE_FROM_CPU(T)                                           \
-  template dpu_vector<T> dpu_vector<T>::from_cpu(std::vector<T>& cpu_vec, \
-                                                 std::string_view name,   \
-                                                 std::source_location loc);
-
-#define INSTANTIATE_ALL(T)            \
-  INSTANTIATE_BINARY_OP(T, operator+) \
-  INSTANTIATE_BINARY_OP(T, operator-) \
-  INSTANTIATE_UNARY_OP(T, operator-)  \
-  INSTANTIATE_UNARY_OP(T, abs)        \
-  INSTANTIATE_FROM_CPU(T)             \
-  INSTANTIATE_TO_CPU(T)
+#define INSTANTIATE_LAUNCH(T)                                            \
+  template dpu_vector<T> launch_binop<T>(const dpu_vector<T>& lhs,       \
+                                         const dpu_vector<T>& rhs,       \
+                                         KernelID kernel_id);            \
+  template dpu_vector<T> launch_unary<T>(const dpu_vector<T>& a,         \
+                                         KernelID kernel_id);            \
+  template dpu_vector<T> launch_scalar<T>(const dpu_vector<T>& a,        \
+                                          T scalar, KernelID kernel_id);
+
+#define INSTANTIATE_REDUCE(T)                                        \
+  template T reduce_sum<T>(const dpu_vector<T>& a);                  \
+  template T reduce_min<T>(const dpu_vector<T>& a);                  \
+  template T reduce_max<T>(const dpu_vector<T>& a);                  \
+  template T dot<T>(const dpu_vector<T>& a, const dpu_vector<T>& b); \
+  template double norm2<T>(const dpu_vector<T>& a);                  \
+  template std::shared_ptr<Event> submit_reduce<T>(                  \
+      const dpu_vector<T>& lhs, const dpu_vector<T>& rhs,            \
+      KernelID kernel_id, bool is_binary,                            \
+      std::shared_ptr<vector<DPU_REDUCE_RESULT>> results);
+
+#define INSTANTIATE_ALL(T)      \
+  template class dpu_vector<T>; \
+  template class dpu_expr<T>;   \
+  INSTANTIATE_LAUNCH(T)         \
+  INSTANTIATE_REDUCE(T)
 
 INSTANTIATE_ALL(int)
 INSTANTIATE_ALL(float)
 
-#undef INSTANTIATE_BINARY_OP
-#undef INSTANTIATE_UNARY_OP
-#undef INSTANTIATE_ABS
-#undef INSTANTIATE_FROM_CPU
-#undef INSTANTIATE_TO_CPU
+#undef INSTANTIATE_LAUNCH
+#undef INSTANTIATE_REDUCE
 #undef INSTANTIATE_ALL
\ No newline at end of file
@@ -2,10 +2,17 @@
 
 #include <common.h>
 
+#include <atomic>
+#include <cassert>
+#include <concepts>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <source_location>
+#include <span>
 #include <string_view>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 using std::vector;
@@ -16,37 +23,233 @@ using vector_desc =
   std::string_view name = "",     \
                    std::source_location loc = std::source_location::current()
 
-// ============================q
+class DpuStream;
+class Event;
+template <typename T>
+class dpu_expr;
+
+// Stream 0, which vectors created without a stream live on. The first call
+// initializes the runtime.
+DpuStream& default_stream();
+
+// ============================
+// DPU Buffer
+// ============================
+// MRAM buffer behind one or more dpu_vector handles. Events that read or write
+// it hold a reference as well until they have finished, so it goes back to
+// the allocator once the last handle and the last such event are gone.
+struct dpu_buffer {
+  dpu_buffer(DpuStream& stream, vector_desc desc)
+      : stream(&stream), desc(std::move(desc)) {}
+  ~dpu_buffer();
+  dpu_buffer(const dpu_buffer&) = delete;
+  dpu_buffer& operator=(const dpu_buffer&) = delete;
+
+  DpuStream* stream;  // whose allocator the buffer came from
+  vector_desc desc;
+  std::atomic<uint32_t> handles{1};  // dpu_vectors sharing the buffer
+};
+
+// ============================
 // DPU Vector
 // ============================
+// A handle to a shared MRAM buffer: copies share the buffer and moves hand it
+// over. Assigning an expression writes into the buffer in place unless a
+// handle outside the expression (a copy, or a leaf of another expression)
+// still refers to it.
 template <typename T>
 class dpu_vector {
  public:
+  // On the default stream, or on stream
   dpu_vector(uint32_t n, LOGGER_ARGS_WITH_DEFAULTS);
+  dpu_vector(uint32_t n, DpuStream& stream, LOGGER_ARGS_WITH_DEFAULTS);
+
+  // Materialize a deferred expression
+  dpu_vector(const dpu_expr<T>& expr, LOGGER_ARGS_WITH_DEFAULTS);
+  dpu_vector& operator=(const dpu_expr<T>& expr);
 
   ~dpu_vector();
 
   dpu_vector(const dpu_vector& other);             // copy constructor
   dpu_vector& operator=(const dpu_vector& other);  // copy assignment
-  vector<uint32_t> data() const;
+
+  dpu_vector(dpu_vector&& other) noexcept;             // move constructor
+  dpu_vector& operator=(dpu_vector&& other) noexcept;  // move assignment
+
+  // In-place operators
+  dpu_vector& operator+=(const dpu_expr<T>& rhs);
+  dpu_vector& operator-=(const dpu_expr<T>& rhs);
+  dpu_vector& operator*=(const dpu_expr<T>& rhs);
+  dpu_vector& operator/=(const dpu_expr<T>& rhs);
+  dpu_vector& operator+=(T scalar);
+  dpu_vector& operator-=(T scalar);
+  dpu_vector& operator*=(T scalar);
+  dpu_vector& operator/=(T scalar);
+  dpu_vector& negate_in_place();
+  dpu_vector& abs_in_place();
+
+  const vector<uint32_t>& data() const { return buffer_->desc.first; }
   uint32_t size() const;
 
   vector<T> to_cpu();
+  // Reads the vector back into caller-owned memory of at least size()
+  // elements, without allocating or initializing a host vector
+  void to_cpu_into(std::span<T> cpu_vec);
+  // Same, without blocking: cpu_vec holds the data once the returned event
+  // has finished, and the slices on rank r once EventQueue::wait(e, r) returns
+  std::shared_ptr<Event> to_cpu_async(std::span<T> cpu_vec);
 
-  static dpu_vector<T> from_cpu(std::vector<T>& cpu_vec,
+  static dpu_vector<T> from_cpu(std::span<const T> cpu_vec,
+                                LOGGER_ARGS_WITH_DEFAULTS);
+  // Overwrites the vector with cpu_vec, of size() elements, reusing its
+  // buffer unless another handle shares it. Enqueued like from_cpu().
+  void assign(std::span<const T> cpu_vec);
+  static dpu_vector<T> from_cpu(std::span<const T> cpu_vec, DpuStream& stream,
                                 LOGGER_ARGS_WITH_DEFAULTS);
 
-  vector_desc data_desc() const { return data_; }
+  const vector_desc& data_desc() const { return buffer_->desc; }
+  const std::shared_ptr<dpu_buffer>& buffer() const { return buffer_; }
+  // Stream the vector lives on; operands of an op share one
+  DpuStream& stream() const { return *buffer_->stream; }
+
+  // MRAM offset of the buffer on the first DPU; identifies the buffer in
+  // Event::reads and writes.
+  uint32_t buffer_id() const { return buffer_->desc.first[0]; }
 
  private:
-  vector_desc data_;
-  uint32_t size_;
+  // Point this handle at a new buffer of n elements on stream
+  void reallocate(uint32_t n, DpuStream& stream);
+  void release();
+
+  std::shared_ptr<dpu_buffer> buffer_;
+  uint32_t size_ = 0;
   const char* debug_name = nullptr;
   const char* debug_file = nullptr;
   int debug_line = -1;
-  bool copied = false;
 };
 
+// ============================
+// Deferred expressions
+// ============================
+// Operators on dpu_vector do not launch anything. They build an expression
+// tree that is evaluated when it is assigned to a dpu_vector or read back with
+// to_cpu(). A whole tree is compiled into one DPU_FUSED_PROGRAM, so every input
+// is read once, only the result is written and no MRAM temporaries are needed.
+// Scalars are broadcast on the DPU and never occupy MRAM.
+template <typename T>
+struct expr_node {
+  enum class Kind : uint8_t { LEAF, SCALAR, UNARY, BINARY, SELECT };
+
+  Kind kind;
+  FusedOp op;
+  uint32_t size;
+  std::unique_ptr<dpu_vector<T>> leaf;  // LEAF only
+  T value{};                            // SCALAR only
+  std::shared_ptr<const expr_node> lhs;
+  std::shared_ptr<const expr_node> rhs;   // BINARY and SELECT only
+  std::shared_ptr<const expr_node> cond;  // SELECT only
+  // Where a tree without leaves is evaluated, if set on its root
+  DpuStream* stream = nullptr;
+};
+
+template <typename T>
+class dpu_expr {
+ public:
+  using node_ptr = std::shared_ptr<const expr_node<T>>;
+
+  // Leaf; implicit so that vectors and expressions can be mixed freely
+  dpu_expr(const dpu_vector<T>& vec) {
+    auto node = std::make_shared<expr_node<T>>();
+    node->kind = expr_node<T>::Kind::LEAF;
+    node->size = vec.size();
+    node->leaf = std::make_unique<dpu_vector<T>>(vec);
+    node_ = node;
+  }
+
+  dpu_expr(FusedOp op, const dpu_expr& a) {
+    auto node = std::make_shared<expr_node<T>>();
+    node->kind = expr_node<T>::Kind::UNARY;
+    node->op = op;
+    node->size = a.size();
+    node->lhs = a.node();
+    node_ = node;
+  }
+
+  dpu_expr(FusedOp op, const dpu_expr& lhs, const dpu_expr& rhs) {
+    assert(lhs.size() == rhs.size());
+    auto node = std::make_shared<expr_node<T>>();
+    node->kind = expr_node<T>::Kind::BINARY;
+    node->op = op;
+    node->size = lhs.size();
+    node->lhs = lhs.node();
+    node->rhs = rhs.node();
+    node_ = node;
+  }
+
+  // a where cond is nonzero and b elsewhere
+  static dpu_expr select(const dpu_expr& cond, const dpu_expr& a,
+                         const dpu_expr& b) {
+    assert(cond.size() == a.size() && a.size() == b.size());
+    auto node = std::make_shared<expr_node<T>>();
+    node->kind = expr_node<T>::Kind::SELECT;
+    node->op = F_SELECT;
+    node->size = cond.size();
+    node->cond = cond.node();
+    node->lhs = a.node();
+    node->rhs = b.node();
+    return dpu_expr(node);
+  }
+
+  // A scalar broadcast to size elements
+  static dpu_expr scalar(T value, uint32_t size) {
+    auto node = std::make_shared<expr_node<T>>();
+    node->kind = expr_node<T>::Kind::SCALAR;
+    node->size = size;
+    node->value = value;
+    return dpu_expr(node);
+  }
+
+  uint32_t size() const { return node_->size; }
+  const node_ptr& node() const { return node_; }
+
+  // Stream the vectors of the expression live on, or nullptr if it has none
+  // and none was given with on()
+  DpuStream* stream() const;
+  // The expression, evaluated on stream if it has no vectors of its own
+  dpu_expr on(DpuStream& stream) const;
+
+  vector<T> to_cpu() const;
+
+ private:
+  explicit dpu_expr(node_ptr node) : node_(std::move(node)) {}
+
+  node_ptr node_;
+};
+
+template <typename V>
+struct dpu_value_type;
+
+template <typename T>
+struct dpu_value_type<dpu_vector<T>> {
+  using type = T;
+};
+
+template <typename T>
+struct dpu_value_type<dpu_expr<T>> {
+  using type = T;
+};
+
+template <typename V>
+using dpu_value_t = typename dpu_value_type<std::remove_cvref_t<V>>::type;
+
+// dpu_vector<T> or dpu_expr<T>
+template <typename V>
+concept dpu_operand = requires { typename dpu_value_t<V>; };
+
+template <typename L, typename R>
+concept dpu_operands = dpu_operand<L> && dpu_operand<R> &&
+                       std::same_as<dpu_value_t<L>, dpu_value_t<R>>;
+
 // ============================
 // Kernel selectors
 // ============================
@@ -58,6 +261,13 @@ template <>
 struct BinaryKernelSelector<float> {
   static KernelID add() { return KernelID::K_BINARY_FLOAT_ADD; }
   static KernelID sub() { return KernelID::K_BINARY_FLOAT_SUB; }
+  static KernelID mul() { return KernelID::K_BINARY_FLOAT_MUL; }
+  static KernelID div() { return KernelID::K_BINARY_FLOAT_DIV; }
+  static KernelID min() { return KernelID::K_BINARY_FLOAT_MIN; }
+  static KernelID max() { return KernelID::K_BINARY_FLOAT_MAX; }
+  static KernelID lt() { return KernelID::K_BINARY_FLOAT_LT; }
+  static KernelID eq() { return KernelID::K_BINARY_FLOAT_EQ; }
+  static KernelID gt() { return KernelID::K_BINARY_FLOAT_GT; }
 };
 
 // int specialization
@@ -65,6 +275,14 @@ template <>
 struct BinaryKernelSelector<int> {
   static KernelID add() { return KernelID::K_BINARY_INT_ADD; }
   static KernelID sub() { return KernelID::K_BINARY_INT_SUB; }
+  static KernelID mul() { return KernelID::K_BINARY_INT_MUL; }
+  static KernelID div() { return KernelID::K_BINARY_INT_DIV; }
+  static KernelID mod() { return KernelID::K_BINARY_INT_MOD; }
+  static KernelID min() { return KernelID::K_BINARY_INT_MIN; }
+  static KernelID max() { return KernelID::K_BINARY_INT_MAX; }
+  static KernelID lt() { return KernelID::K_BINARY_INT_LT; }
+  static KernelID eq() { return KernelID::K_BINARY_INT_EQ; }
+  static KernelID gt() { return KernelID::K_BINARY_INT_GT; }
 };
 
 template <typename T>
@@ -84,6 +302,85 @@ struct UnaryKernelSelector<int> {
   static KernelID abs() { return KernelID::K_UNARY_INT_ABS; }
 };
 
+template <typename T>
+struct ScalarKernelSelector;
+
+// float specialization
+template <>
+struct ScalarKernelSelector<float> {
+  static KernelID add() { return KernelID::K_SCALAR_FLOAT_ADD; }
+  static KernelID sub() { return KernelID::K_SCALAR_FLOAT_SUB; }
+  static KernelID rsub() { return KernelID::K_SCALAR_FLOAT_RSUB; }
+  static KernelID mul() { return KernelID::K_SCALAR_FLOAT_MUL; }
+  static KernelID div() { return KernelID::K_SCALAR_FLOAT_DIV; }
+  static DPU_SCALAR wrap(float v) {
+    DPU_SCALAR s;
+    s.f = v;
+    return s;
+  }
+};
+
+// int specialization
+template <>
+struct ScalarKernelSelector<int> {
+  static KernelID add() { return KernelID::K_SCALAR_INT_ADD; }
+  static KernelID sub() { return KernelID::K_SCALAR_INT_SUB; }
+  static KernelID rsub() { return KernelID::K_SCALAR_INT_RSUB; }
+  static KernelID mul() { return KernelID::K_SCALAR_INT_MUL; }
+  static KernelID div() { return KernelID::K_SCALAR_INT_DIV; }
+  static KernelID mod() { return KernelID::K_SCALAR_INT_MOD; }
+  static DPU_SCALAR wrap(int v) {
+    DPU_SCALAR s;
+    s.i = v;
+    return s;
+  }
+};
+
+// acc_type is what the DPUs accumulate in and the host combines their
+// results in
+template <typename T>
+struct ReduceKernelSelector;
+
+// float specialization
+template <>
+struct ReduceKernelSelector<float> {
+  using acc_type = float;
+  static KernelID sum() { return KernelID::K_REDUCE_FLOAT_SUM; }
+  static KernelID min() { return KernelID::K_REDUCE_FLOAT_MIN; }
+  static KernelID max() { return KernelID::K_REDUCE_FLOAT_MAX; }
+  static KernelID dot() { return KernelID::K_REDUCE_FLOAT_DOT; }
+  static float value(const DPU_REDUCE_RESULT& r) { return r.f; }
+};
+
+// int specialization
+template <>
+struct ReduceKernelSelector<int> {
+  using acc_type = int64_t;
+  static KernelID sum() { return KernelID::K_REDUCE_INT_SUM; }
+  static KernelID min() { return KernelID::K_REDUCE_INT_MIN; }
+  static KernelID max() { return KernelID::K_REDUCE_INT_MAX; }
+  static KernelID dot() { return KernelID::K_REDUCE_INT_DOT; }
+  static int64_t value(const DPU_REDUCE_RESULT& r) { return r.i; }
+};
+
+template <typename T>
+using reduce_acc_t = typename ReduceKernelSelector<T>::acc_type;
+
+template <typename T>
+struct FusedKernelSelector;
+
+// float specialization
+template <>
+struct FusedKernelSelector<float> {
+  static KernelID program() { return KernelID::K_FUSED_FLOAT; }
+};
+
+// int specialization
+template <>
+struct FusedKernelSelector<int> {
+  static KernelID program() { return KernelID::K_FUSED_INT; }
+};
+
 // ============================
 // DPU Launch helpers
 // ============================
@@ -94,17 +391,235 @@ dpu_vector<T> launch_binop(const dpu_vector<T>& lhs, const dpu_vector<T>& rhs,
 template <typename T>
 dpu_vector<T> launch_unary(const dpu_vector<T>& a, KernelID kernel_id);
 
+template <typename T>
+dpu_vector<T> launch_scalar(const dpu_vector<T>& a, T scalar,
+                            KernelID kernel_id);
+
+// Push the per-DPU launch args (after the fused program or the command buffer
+// of a batched launch) and launch asynchronously. The vectors must outlive
+// the pushes.
+void push_args_and_launch(DpuStream& stream, vector<DPU_LAUNCH_ARGS>& args);
+void push_program_and_launch(DpuStream& stream, vector<DPU_LAUNCH_ARGS>& args,
+                             vector<DPU_FUSED_PROGRAM>& programs);
+void push_commands_and_launch(DpuStream& stream, vector<DPU_LAUNCH_ARGS>& args,
+                              vector<DPU_COMMAND>& commands);
+
+// Event moving the slices of a vector laid out as desc between cpu_vec and
+// the DPUs of stream: a DPU_TRANSFER to them if to_dpu, else a HOST_TRANSFER
+// from them. cpu_vec and desc must outlive it; the caller sets what it reads
+// or writes and submits it.
+std::shared_ptr<Event> create_vector_xfer(bool to_dpu, DpuStream& stream,
+                                          char* cpu_vec,
+                                          const vector_desc& desc);
+// Pushes the result of the last reduction on every DPU of stream into
+// results, asynchronously
+void reduce_xfer_from_dpu(DpuStream& stream, DPU_REDUCE_RESULT* results);
+
 // ============================
-// Operators
+// Batching
 // ============================
+// Elementwise ops submitted while a dpu_batch is alive are recorded and run
+// by the DPUs as one launch of up to BATCH_MAX_COMMANDS commands, instead of
+// one launch each. Transfers, reductions and waits flush the recorded ops
+// early; the batch flushes the rest when it goes out of scope. A batch
+// covers the ops of one stream, the default one unless given.
+class dpu_batch {
+ public:
+  dpu_batch();
+  explicit dpu_batch(DpuStream& stream);
+  ~dpu_batch();
+  dpu_batch(const dpu_batch&) = delete;
+  dpu_batch& operator=(const dpu_batch&) = delete;
+
+  void flush();
+
+ private:
+  DpuStream* stream_;
+};
+
+// ============================
+// Reductions
+// ============================
+// Each DPU reduces its slice to a single value and only those values are
+// transferred back and combined on the host. Int reductions accumulate and
+// combine in 64 bits: reduce_sum and dot narrow the total to int when they
+// return it, while norm2 takes the root of the 64-bit total. These block
+// until the result is available.
+template <typename T>
+T reduce_sum(const dpu_vector<T>& a);
+
+template <typename T>
+T reduce_min(const dpu_vector<T>& a);
+
 template <typename T>
-dpu_vector<T> operator+(const dpu_vector<T>& lhs, const dpu_vector<T>& rhs);
+T reduce_max(const dpu_vector<T>& a);
 
 template <typename T>
-dpu_vector<T> operator-(const dpu_vector<T>& lhs, const dpu_vector<T>& rhs);
+T dot(const dpu_vector<T>& a, const dpu_vector<T>& b);
 
 template <typename T>
-dpu_vector<T> operator-(const dpu_vector<T>& a);
+double norm2(const dpu_vector<T>& a);
 
+// Launches a reduction (a dot product if is_binary) and the transfer of one
+// result per DPU of the stream into results, without waiting. The returned
+// event has finished once results holds them all; it keeps results alive.
 template <typename T>
-dpu_vector<T> abs(const dpu_vector<T>& a);
+std::shared_ptr<Event> submit_reduce(
+    const dpu_vector<T>& lhs, const dpu_vector<T>& rhs, KernelID kernel_id,
+    bool is_binary, std::shared_ptr<vector<DPU_REDUCE_RESULT>> results);
+
+// Folds the results of DPUs [begin, end) into acc with combine. DPUs without
+// elements only hold the identity of the reduction and are skipped.
+template <typename T, typename Combine>
+void fold_reduce_results(const vector<uint32_t>& sizes,
+                         const DPU_REDUCE_RESULT* results, uint32_t begin,
+                         uint32_t end, Combine combine,
+                         std::optional<reduce_acc_t<T>>& acc) {
+  for (uint32_t i = begin; i < end; i++) {
+    if (sizes[i] == 0) continue;
+    reduce_acc_t<T> value = ReduceKernelSelector<T>::value(results[i]);
+    acc = acc ? combine(*acc, value) : value;
+  }
+}
+
+// ============================
+// Autotuning
+// ============================
+// Sweeps the DMA block size of every kernel on vectors of n elements, keeps
+// the size with the fewest DPU cycles and writes the winners to the tuning
+// file that DpuRuntime::init() loads on the next start.
+void autotune_block_sizes(uint32_t n);
+
+// ============================
+// Operators
+// ============================
+// Elementwise NAME of two operands, or of an operand and a scalar on either
+// side. The scalar is converted to the element type and travels in the launch
+// args; no constant vector is built.
+#define DPU_BINARY_OPERATOR(NAME, OP)                                        \
+  template <typename L, typename R>                                          \
+    requires dpu_operands<L, R>                                              \
+  dpu_expr<dpu_value_t<L>> NAME(const L& lhs, const R& rhs) {                \
+    return dpu_expr<dpu_value_t<L>>(OP, lhs, rhs);                           \
+  }                                                                          \
+                                                                             \
+  template <dpu_operand V>                                                   \
+  dpu_expr<dpu_value_t<V>> NAME(const V& v,                                  \
+                                std::type_identity_t<dpu_value_t<V>> s) {    \
+    using expr = dpu_expr<dpu_value_t<V>>;                                   \
+    expr e(v);                                                               \
+    return expr(OP, e, expr::scalar(s, e.size()));                           \
+  }                                                                          \
+                                                                             \
+  template <dpu_operand V>                                                   \
+  dpu_expr<dpu_value_t<V>> NAME(std::type_identity_t<dpu_value_t<V>> s,      \
+                                const V& v) {                                \
+    using expr = dpu_expr<dpu_value_t<V>>;                                   \
+    expr e(v);                                                               \
+    return expr(OP, expr::scalar(s, e.size()), e);                           \
+  }
+
+DPU_BINARY_OPERATOR(operator+, F_ADD)
+DPU_BINARY_OPERATOR(operator-, F_SUB)
+DPU_BINARY_OPERATOR(operator*, F_MUL)
+DPU_BINARY_OPERATOR(operator/, F_DIV)
+DPU_BINARY_OPERATOR(min, F_MIN)
+DPU_BINARY_OPERATOR(max, F_MAX)
+
+// Comparisons are elementwise too: 1 where they hold and 0 elsewhere, in the
+// element type, so they can be summed or multiplied as masks
+DPU_BINARY_OPERATOR(operator<, F_LT)
+DPU_BINARY_OPERATOR(operator==, F_EQ)
+DPU_BINARY_OPERATOR(operator>, F_GT)
+
+#undef DPU_BINARY_OPERATOR
+
+// Remainder of integer division, truncated toward zero as in C++
+template <typename L, typename R>
+  requires dpu_operands<L, R> && std::integral<dpu_value_t<L>>
+dpu_expr<dpu_value_t<L>> operator%(const L& lhs, const R& rhs) {
+  return dpu_expr<dpu_value_t<L>>(F_MOD, lhs, rhs);
+}
+
+template <dpu_operand V>
+  requires std::integral<dpu_value_t<V>>
+dpu_expr<dpu_value_t<V>> operator%(const V& v,
+                                   std::type_identity_t<dpu_value_t<V>> s) {
+  using expr = dpu_expr<dpu_value_t<V>>;
+  expr e(v);
+  return expr(F_MOD, e, expr::scalar(s, e.size()));
+}
+
+template <dpu_operand V>
+  requires std::integral<dpu_value_t<V>>
+dpu_expr<dpu_value_t<V>> operator%(std::type_identity_t<dpu_value_t<V>> s,
+                                   const V& v) {
+  using expr = dpu_expr<dpu_value_t<V>>;
+  expr e(v);
+  return expr(F_MOD, expr::scalar(s, e.size()), e);
+}
+
+template <dpu_operand A>
+dpu_expr<dpu_value_t<A>> operator-(const A& a) {
+  return dpu_expr<dpu_value_t<A>>(F_NEGATE, a);
+}
+
+template <dpu_operand A>
+dpu_expr<dpu_value_t<A>> abs(const A& a) {
+  return dpu_expr<dpu_value_t<A>>(F_ABS, a);
+}
+
+// A dpu_vector<T>, dpu_expr<T> or a scalar converted to T
+template <typename X, typename T>
+concept dpu_operand_or_scalar =
+    (dpu_operand<X> && std::same_as<dpu_value_t<X>, T>) ||
+    (!dpu_operand<X> && std::convertible_to<X, T>);
+
+template <typename T, typename X>
+dpu_expr<T> as_expr(const X& x, uint32_t size) {
+  if constexpr (dpu_operand<X>) {
+    return dpu_expr<T>(x);
+  } else {
+    return dpu_expr<T>::scalar(static_cast<T>(x), size);
+  }
+}
+
+// Elementwise cond ? a : b, taking a where cond is nonzero. Either value may
+// be a scalar.
+template <dpu_operand C, typename A, typename B>
+  requires dpu_operand_or_scalar<A, dpu_value_t<C>> &&
+           dpu_operand_or_scalar<B, dpu_value_t<C>>
+dpu_expr<dpu_value_t<C>> select(const C& cond, const A& a, const B& b) {
+  using T = dpu_value_t<C>;
+  dpu_expr<T> c(cond);
+  return dpu_expr<T>::select(c, as_expr<T>(a, c.size()),
+                             as_expr<T>(b, c.size()));
+}
+
+// ============================
+// Maps
+// ============================
+// Applies f to the elements of one or more vectors of the same type and
+// length. f receives a dpu_expr per operand and combines them with the
+// operators above, select() and scalars; the expression it builds is
+// compiled into a fused program that the DPUs interpret block by block, so
+// new elementwise formulas need no new kernel:
+//
+//   auto relu_diff = dpu_map([](auto x, auto y) {
+//     return select(x > y, x - y, 0);
+//   }, a, b);
+//
+// The result is a dpu_expr, evaluated when it is assigned or read back, on
+// the stream of the operands even if f ignores them (e.g. returns a
+// constant).
+template <typename F, dpu_operand A, dpu_operand... Rest>
+  requires(std::same_as<dpu_value_t<A>, dpu_value_t<Rest>> && ...) &&
+          std::invocable<F&, dpu_expr<dpu_value_t<A>>,
+                         dpu_expr<dpu_value_t<Rest>>...>
+dpu_expr<dpu_value_t<A>> dpu_map(F&& f, const A& a, const Rest&... rest) {
+  using T = dpu_value_t<A>;
+  dpu_expr<T> first(a);
+  dpu_expr<T> res = as_expr<T>(f(first, dpu_expr<T>(rest)...), first.size());
+  DpuStream* stream = first.stream();
+  return res.stream() == nullptr && stream != nullptr ? res.on(*stream) : res;
+}
@@ -1,9 +1,15 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
 #include <functional>
 #include <memory>
+#include <optional>
+#include <stdexcept>
+#include <utility>
 
 #include "logger.h"
 #include "runtime.h"
@@ -15,91 +21,122 @@
 #define CHECK_UPMEM(x) DPU_ASSERT(x)
 #endif
 
+// ============================
+// DPU Buffer
+// ============================
+dpu_buffer::~dpu_buffer() {
+  auto& runtime = DpuRuntime::get();
+  // Buffers that outlive the runtime went away with its allocator
+  if (runtime.is_initialized()) {
+    stream->get_allocator().deallocate_upmem_vector(desc);
+  }
+}
+
+// The first vector initializes the runtime
+DpuStream& default_stream() {
+  auto& runtime = DpuRuntime::get();
+  if (runtime.is_initialized() == false) {
+    // throw std::runtime_error("DPU runtime not initialized!");
+    runtime.init();
+  }
+  return runtime.default_stream();
+}
+
 // ============================
 // DPU Vector
 // ============================
 template <typename T>
 dpu_vector<T>::dpu_vector(uint32_t n, std::string_view name,
                           std::source_location loc)
-    : size_(n),
-      debug_name(name.data()),
+    : dpu_vector(n, default_stream(), name, loc) {}
+
+template <typename T>
+dpu_vector<T>::dpu_vector(uint32_t n, DpuStream& stream, std::string_view name,
+                          std::source_location loc)
+    : debug_name(name.data()),
       debug_file(loc.file_name()),
       debug_line(loc.line()) {
-  auto& runtime = DpuRuntime::get();
-
-  if (runtime.is_initialized() == false) {
-    // throw std::runtime_error("DPU runtime not initialized!");
-    runtime.init(NR_DPUS);
-  }
-  Logger& logger = runtime.get_logger();
-  logger.lock() << "[dpu_vector] ALLOCATING DPU VECTOR " << debug_name
-                << " OF SIZE " << n << " FROM " << debug_file << ":"
-                << debug_line << std::endl;
-  data_ = runtime.get_allocator().allocate_upmem_vector(n, sizeof(T));
+  reallocate(n, stream);
 
-#if ENABLE_DPU_LOGGING >= 1
-  log_allocation(typeid(T), n, debug_name, debug_file, debug_line);
+#if DPU_LOG_LEVEL >= 1
+  log_allocation(typeid(T), n, stream.id(), debug_name, debug_file,
+                 debug_line);
 #endif
 }
 
 template <typename T>
-dpu_vector<T>::dpu_vector(const dpu_vector& other) {
+dpu_vector<T>::dpu_vector(const dpu_vector& other)
+    : buffer_(other.buffer_),
+      size_(other.size_),
+      debug_name(other.debug_name),
+      debug_file(other.debug_file),
+      debug_line(other.debug_line) {
+  if (buffer_) buffer_->handles++;
+  DPU_LOG(2, "[dpu_vector] COPY CONSTRUCTOR at ", debug_name, " OF SIZE ",
+          size_, " FROM ", debug_file, ":", debug_line);
+}
+
+template <typename T>
+dpu_vector<T>& dpu_vector<T>::operator=(const dpu_vector& other) {
   if (this != &other) {
-    data_ = other.data_;
+    if (other.buffer_) other.buffer_->handles++;
+    release();
+    buffer_ = other.buffer_;
     size_ = other.size_;
     debug_name = other.debug_name;
     debug_file = other.debug_file;
     debug_line = other.debug_line;
-    copied = true;
   }
-#if ENABLE_DPU_LOGGING >= 2
-  Logger& logger = DpuRuntime::get().get_logger();
-  logger.lock() << "[dpu_vector] COPY CONSTRUCTOR at " << debug_name
-                << " OF SIZE " << size_ << " FROM " << debug_file << ":"
-                << debug_line << std::endl;
-#endif
+  DPU_LOG(2, "[dpu_vector] COPY ASSIGNMENT at ", debug_name, " OF SIZE ",
+          size_, " FROM ", debug_file, ":", debug_line);
+  return *this;
 }
 
 template <typename T>
-dpu_vector<T>& dpu_vector<T>::operator=(const dpu_vector& other) {
+dpu_vector<T>::dpu_vector(dpu_vector&& other) noexcept
+    : buffer_(std::move(other.buffer_)),
+      size_(std::exchange(other.size_, 0)),
+      debug_name(other.debug_name),
+      debug_file(other.debug_file),
+      debug_line(other.debug_line) {}
+
+template <typename T>
+dpu_vector<T>& dpu_vector<T>::operator=(dpu_vector&& other) noexcept {
   if (this != &other) {
-    data_ = other.data_;
-    size_ = other.size_;
+    release();
+    buffer_ = std::move(other.buffer_);
+    size_ = std::exchange(other.size_, 0);
     debug_name = other.debug_name;
     debug_file = other.debug_file;
     debug_line = other.debug_line;
-    copied = true;
   }
-#if ENABLE_DPU_LOGGING >= 2
-  Logger& logger = DpuRuntime::get().get_logger();
-  logger.lock() << "[dpu_vector] COPY ASSIGNMENT at " << debug_name
-                << " OF SIZE " << size_ << " FROM " << debug_file << ":"
-                << debug_line << std::endl;
-#endif
   return *this;
 }
 
 template <typename T>
 dpu_vector<T>::~dpu_vector() {
-  if (copied == true) {
-    // Nothing to deallocate
-    return;
-  }
-  auto& runtime = DpuRuntime::get();
-#if ENABLE_DPU_LOGGING >= 2
-  Logger& logger = runtime.get_logger();
-  logger.lock() << "[dpu_vector] DEALLOCATING DPU VECTOR " << debug_name
-                << " FROM " << debug_file << ":" << debug_line << std::endl;
-#endif
-  runtime.get_allocator().deallocate_upmem_vector(data_);
+  release();
+}
+
+template <typename T>
+void dpu_vector<T>::reallocate(uint32_t n, DpuStream& stream) {
+  release();
+  size_ = n;
+  buffer_ = std::make_shared<dpu_buffer>(
+      stream, stream.get_allocator().allocate_upmem_vector(n, sizeof(T)));
 }
 
+// Drops this handle. The buffer itself is freed once no handle and no event
+// refers to it any more.
 template <typename T>
-vector<uint32_t> dpu_vector<T>::data() const {
-  // data_ is vector_desc std::pair<vector<uint32_t>, vector<uint32_t>>
-  // where first element is vector of pointers to DPU memory per DPU
-  // and second element is vector of sizes per DPU
-  return data_.first;
+void dpu_vector<T>::release() {
+  if (!buffer_) return;
+  if (buffer_->handles == 1) {
+    DPU_LOG(2, "[dpu_vector] DEALLOCATING DPU VECTOR ", debug_name, " FROM ",
+            debug_file, ":", debug_line);
+  }
+  buffer_->handles--;
+  buffer_.reset();
 }
 
 template <typename T>
@@ -107,224 +144,1009 @@ uint32_t dpu_vector<T>::size() const {
   return size_;
 }
 
-void vec_xfer_to_dpu(char* cpu_vec, vector_desc& desc) {
-  auto& runtime = DpuRuntime::get();
-  dpu_set_t& dpu_set = runtime.dpu_set();
-  dpu_set_t dpu;
+// MRAM transfers move whole 8-byte words, while the slices of neighbouring
+// DPUs are contiguous on the host and need not be a multiple of 8 bytes. A
+// slice is therefore moved in two pushes: the 8-byte aligned bulk that every
+// DPU has, straight from or into host memory, and the rest of each slice (its
+// tail) through a staging buffer with tail_bytes per DPU.
+struct xfer_layout {
+  uint32_t bulk_bytes;
+  uint32_t tail_bytes;
+};
 
-  uint32_t idx_dpu = 0;
-  size_t element = 0;
+xfer_layout get_xfer_layout(const vector_desc& desc) {
+  // The first DPUs hold the largest slices and the last one the smallest
+  uint32_t bulk = desc.second.back() & ~7U;
+  return {bulk, DMA_ALIGN(desc.second.front() - bulk)};
+}
 
-  DPU_FOREACH(dpu_set, dpu, idx_dpu) {
-    CHECK_UPMEM(dpu_prepare_xfer(dpu, &(cpu_vec[element])));
-    element += desc.second[idx_dpu];
+// Copies the tails of the slices of DPUs begin ... end - 1 between host memory
+// and the staging buffer
+void copy_tails(char* cpu_vec, char* staging, const vector_desc& desc,
+                bool to_staging, uint32_t begin, uint32_t end) {
+  xfer_layout layout = get_xfer_layout(desc);
+  if (layout.tail_bytes == 0) return;
+
+  size_t offset = 0;
+  for (uint32_t i = 0; i < begin; i++) offset += desc.second[i];
+  for (uint32_t i = begin; i < end; i++) {
+    char* tail = cpu_vec + offset + layout.bulk_bytes;
+    char* staged = staging + i * layout.tail_bytes;
+    uint32_t bytes = desc.second[i] - layout.bulk_bytes;
+    if (to_staging) {
+      std::memcpy(staged, tail, bytes);
+      std::memset(staged + bytes, 0, layout.tail_bytes - bytes);
+    } else {
+      std::memcpy(tail, staged, bytes);
+    }
+    offset += desc.second[i];
   }
+}
 
+void vec_xfer(DpuStream& stream, dpu_xfer_t direction, char* cpu_vec,
+              char* staging, const vector_desc& desc) {
   uint32_t mram_location = desc.first[0];
-  size_t xfer_size = desc.second[0];
+  xfer_layout layout = get_xfer_layout(desc);
 
-  CHECK_UPMEM(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU,
-                            DPU_MRAM_HEAP_POINTER_NAME, mram_location,
-                            xfer_size, DPU_XFER_ASYNC));
-}
-
-void vec_xfer_from_dpu(char* cpu_vec, vector_desc& desc) {
-  auto& runtime = DpuRuntime::get();
-  dpu_set_t& dpu_set = runtime.dpu_set();
-  dpu_set_t dpu;
+  // Host offset of every slice
+  vector<size_t> offsets(desc.second.size());
+  for (size_t i = 1; i < offsets.size(); i++) {
+    offsets[i] = offsets[i - 1] + desc.second[i - 1];
+  }
 
-  uint32_t idx_dpu = 0;
-  size_t element = 0;
+  // Each rank's buffers are prepared and pushed on its own host thread
+  stream.for_each_rank([&](uint32_t r) {
+    dpu_set_t& rank = stream.rank_set(r);
+    uint32_t first = stream.rank_first_dpu(r);
+    dpu_set_t dpu;
+    uint32_t idx_dpu = 0;
 
-  DPU_FOREACH(dpu_set, dpu, idx_dpu) {
-    CHECK_UPMEM(dpu_prepare_xfer(dpu, &(cpu_vec[element])));
-    element += desc.second[idx_dpu];
-  }
+    if (layout.bulk_bytes > 0) {
+      DPU_FOREACH(rank, dpu, idx_dpu) {
+        CHECK_UPMEM(dpu_prepare_xfer(dpu, &cpu_vec[offsets[first + idx_dpu]]));
+      }
+      CHECK_UPMEM(dpu_push_xfer(rank, direction, DPU_MRAM_HEAP_POINTER_NAME,
+                                mram_location, layout.bulk_bytes,
+                                DPU_XFER_ASYNC));
+    }
+    if (layout.tail_bytes > 0) {
+      DPU_FOREACH(rank, dpu, idx_dpu) {
+        CHECK_UPMEM(dpu_prepare_xfer(
+            dpu, &staging[(first + idx_dpu) * layout.tail_bytes]));
+      }
+      CHECK_UPMEM(dpu_push_xfer(rank, direction, DPU_MRAM_HEAP_POINTER_NAME,
+                                mram_location + layout.bulk_bytes,
+                                layout.tail_bytes, DPU_XFER_ASYNC));
+    }
+  });
+}
 
-  uint32_t mram_location = desc.first[0];
-  size_t xfer_size = desc.second[0];
+std::shared_ptr<Event> create_vector_xfer(bool to_dpu, DpuStream& stream,
+                                          char* cpu_vec,
+                                          const vector_desc& desc) {
+  auto staging = DpuRuntime::get().staging_buffer(
+      desc.second.size() * get_xfer_layout(desc).tail_bytes);
+  std::shared_ptr<Event> e =
+      Event::create(to_dpu ? Event::OperationType::DPU_TRANSFER
+                           : Event::OperationType::HOST_TRANSFER);
+  for (uint32_t bytes : desc.second) e->bytes += bytes;
+  e->host_data = cpu_vec;
 
-  CHECK_UPMEM(dpu_push_xfer(dpu_set, DPU_XFER_FROM_DPU,
-                            DPU_MRAM_HEAP_POINTER_NAME, mram_location,
-                            xfer_size, DPU_XFER_ASYNC));
+  if (to_dpu) {
+    copy_tails(cpu_vec, staging->data(), desc, true, 0, desc.second.size());
+    e->cb = [&stream, cpu_vec, staging, &desc] {
+      vec_xfer(stream, DPU_XFER_TO_DPU, cpu_vec, staging->data(), desc);
+    };
+    return e;
+  }
+  e->cb = [&stream, cpu_vec, staging, &desc] {
+    vec_xfer(stream, DPU_XFER_FROM_DPU, cpu_vec, staging->data(), desc);
+  };
+  // The slices of a rank are complete as soon as its part has arrived
+  e->on_rank_finish = [&stream, cpu_vec, staging, &desc](uint32_t r) {
+    copy_tails(cpu_vec, staging->data(), desc, false, stream.rank_first_dpu(r),
+               stream.rank_first_dpu(r + 1));
+  };
+  return e;
 }
 
+// The transfer is only enqueued: cpu_vec must stay alive and unmodified until
+// the vector is read back with to_cpu() or the event queue is waited on. Only
+// the tails are copied, into a pooled staging buffer.
 template <typename T>
-dpu_vector<T> dpu_vector<T>::from_cpu(std::vector<T>& cpu_vec,
+dpu_vector<T> dpu_vector<T>::from_cpu(std::span<const T> cpu_vec,
                                       std::string_view name,
                                       std::source_location loc) {
-  dpu_vector<T> vec(cpu_vec.size(), name, loc);
+  return from_cpu(cpu_vec, default_stream(), name, loc);
+}
+
+template <typename T>
+dpu_vector<T> dpu_vector<T>::from_cpu(std::span<const T> cpu_vec,
+                                      DpuStream& stream, std::string_view name,
+                                      std::source_location loc) {
+  dpu_vector<T> vec(cpu_vec.size(), stream, name, loc);
+  vec.assign(cpu_vec);
+  return vec;
+}
+
+template <typename T>
+void dpu_vector<T>::assign(std::span<const T> cpu_vec) {
+  assert(cpu_vec.size() == size());
+  if (buffer_->handles > 1) reallocate(size_, stream());
   // .data returns a std::pair<vector<uint32_t>, vector<uint32_t>>
   // the first element is vector of pointers to DPU memory per DPU
   // the second element is vector of sizes per DPU
-  auto desc = vec.data_desc();
+  const auto& desc = data_desc();
 
-#if ENABLE_DPU_LOGGING >= 2
+#if DPU_LOG_LEVEL >= 2
   print_vector_desc(desc);
 #endif
 
-  char* cpu_buffer = reinterpret_cast<char*>(cpu_vec.data());
-  auto bound_cb = std::bind(vec_xfer_to_dpu, cpu_buffer, std::ref(desc));
-
-  auto& runtime = DpuRuntime::get();
-  auto& event_queue = runtime.get_event_queue();
-  std::shared_ptr<Event> e =
-      std::make_shared<Event>(Event::OperationType::DPU_TRANSFER, bound_cb);
+  // The DPU only reads from cpu_vec
+  char* cpu_buffer =
+      const_cast<char*>(reinterpret_cast<const char*>(cpu_vec.data()));
+  DpuStream& stream = this->stream();
+  auto& event_queue = stream.get_event_queue();
+  std::shared_ptr<Event> e = create_vector_xfer(true, stream, cpu_buffer, desc);
+  e->res = buffer_;
+  e->writes = {buffer_id()};
   event_queue.submit(e);
+  event_queue.process_events();
 
-  // TODO have some sort of dependency analysis
-  while (e->finished == false) {
-    event_queue.process_next();
-  }
-
-#if ENABLE_DPU_LOGGING >= 2
-  Logger& logger = DpuRuntime::get().get_logger();
-  logger.lock() << "[queue-append] HOST->DPU XFER " << cpu_vec.size()
-                << " elements to DPUs" << std::endl;
-#endif
-  return vec;
+  DPU_LOG(2, "[queue-append] HOST->DPU XFER ", cpu_vec.size(),
+          " elements to DPUs");
 }
 
 template <typename T>
 vector<T> dpu_vector<T>::to_cpu() {
-  auto desc = this->data_desc();  // pair< vector<uint32_t>, vector<uint32_t> >
+  // Allocate CPU buffer large enough to hold all data
+  vector<T> cpu_vec(this->size());
+  to_cpu_into(cpu_vec);
+  return cpu_vec;
+}
 
-#if ENABLE_DPU_LOGGING >= 2
+template <typename T>
+void dpu_vector<T>::to_cpu_into(std::span<T> cpu_vec) {
+  auto e = to_cpu_async(cpu_vec);
+  // The host needs the data: block until the transfer (and everything it
+  // depends on) has finished.
+  stream().get_event_queue().wait(e);
+}
+
+template <typename T>
+std::shared_ptr<Event> dpu_vector<T>::to_cpu_async(std::span<T> cpu_vec) {
+  assert(cpu_vec.size() >= this->size());
+  // pair< vector<uint32_t>, vector<uint32_t> >
+  const auto& desc = this->data_desc();
+
+#if DPU_LOG_LEVEL >= 2
   print_vector_desc(desc);
 #endif
 
-  // Allocate CPU buffer large enough to hold all data
-  vector<T> cpu_vec(this->size());
   char* cpu_buffer = reinterpret_cast<char*>(cpu_vec.data());
-  auto bound_cb = std::bind(vec_xfer_from_dpu, cpu_buffer, std::ref(desc));
-
-  auto& runtime = DpuRuntime::get();
-  auto& event_queue = runtime.get_event_queue();
-
+  DpuStream& stream = this->stream();
+  auto& event_queue = stream.get_event_queue();
   std::shared_ptr<Event> e =
-      std::make_shared<Event>(Event::OperationType::HOST_TRANSFER, bound_cb);
+      create_vector_xfer(false, stream, cpu_buffer, desc);
+  e->res = buffer_;
+  e->reads = {this->buffer_id()};
   event_queue.submit(e);
+  event_queue.process_events();
+
+  DPU_LOG(2, "[queue-append] DPU->HOST XFER ", this->size(),
+          " elements from DPUs");
+  return e;
+}
 
-  // TODO have some sort of dependency analysis
-  while (e->finished == false) {
-    event_queue.process_next();
+// Pushes data, bytes per DPU in DPU order, to symbol. The allocator places a
+// vector at the same offset on every DPU, so the per-DPU values usually differ
+// only in the element count of the first n % num_dpus DPUs, which hold one
+// element more. The most common of the first and last values is broadcast and
+// only the DPUs whose value differs from it get their own, rank by rank.
+void push_per_dpu(DpuStream& stream, const char* symbol, const void* data,
+                  uint32_t bytes) {
+  uint32_t nr_of_dpus = stream.num_dpus();
+  const char* values = static_cast<const char*>(data);
+
+  uint32_t same_as_first = 0;
+  for (uint32_t i = 0; i < nr_of_dpus; i++) {
+    if (std::memcmp(values + i * bytes, values, bytes) == 0) same_as_first++;
   }
+  const char* common = 2 * same_as_first >= nr_of_dpus
+                           ? values
+                           : values + (nr_of_dpus - 1) * bytes;
 
-#if ENABLE_DPU_LOGGING >= 2
-  Logger& logger = DpuRuntime::get().get_logger();
-  logger.lock() << "[queue-append] DPU->HOST XFER " << cpu_vec.size()
-                << " elements from DPUs" << std::endl;
+  stream.for_each_rank([&](uint32_t r) {
+    dpu_set_t& rank = stream.rank_set(r);
+    CHECK_UPMEM(
+        dpu_broadcast_to(rank, symbol, 0, common, bytes, DPU_XFER_ASYNC));
+    if (same_as_first == nr_of_dpus) return;
+
+    uint32_t first = stream.rank_first_dpu(r);
+    dpu_set_t dpu;
+    uint32_t idx_dpu = 0;
+    bool differs = false;
+    DPU_FOREACH(rank, dpu, idx_dpu) {
+      const char* value = values + (first + idx_dpu) * bytes;
+      if (std::memcmp(value, common, bytes) != 0) {
+        CHECK_UPMEM(dpu_prepare_xfer(dpu, const_cast<char*>(value)));
+        differs = true;
+      }
+    }
+    if (differs) {
+      CHECK_UPMEM(dpu_push_xfer(rank, DPU_XFER_TO_DPU, symbol, 0, bytes,
+                                DPU_XFER_ASYNC));
+    }
+  });
+}
+
+// Pushes one DPU_LAUNCH_ARGS per DPU and launches the kernel. args is owned by
+// the event, so it stays valid until the asynchronous push has completed.
+void push_args_and_launch(DpuStream& stream, vector<DPU_LAUNCH_ARGS>& args) {
+#if DPU_LOG_LEVEL >= 1
+  log_dpu_launch_args(args.data(), args.size());
 #endif
-  return cpu_vec;
+
+  push_per_dpu(stream, "args", args.data(), sizeof(args[0]));
+  stream.launch();
 }
 
+// The launch args of elementwise ops are filled in when the op is submitted,
+// so that the event queue can also record them into a batch.
 template <typename T>
-void internal_launch_binop(dpu_vector<T>& res, const dpu_vector<T>& lhs,
-                           const dpu_vector<T>& rhs, KernelID kernel_id) {
+void fill_binop_args(vector<DPU_LAUNCH_ARGS>& args, const dpu_vector<T>& res,
+                     const dpu_vector<T>& lhs, const dpu_vector<T>& rhs,
+                     KernelID kernel_id) {
   auto& runtime = DpuRuntime::get();
 
-  uint32_t nr_of_dpus = runtime.num_dpus();
-  DPU_LAUNCH_ARGS args[nr_of_dpus];
+  uint32_t nr_of_dpus = res.stream().num_dpus();
+  args.resize(nr_of_dpus);
 
   for (uint32_t i = 0; i < nr_of_dpus; i++) {
     args[i].kernel = static_cast<uint32_t>(kernel_id);
     args[i].is_binary = true;
-    args[i].num_elements = lhs.size();
+    args[i].block_bytes = runtime.block_bytes(kernel_id);
+    args[i].num_elements = lhs.data_desc().second[i] / sizeof(T);
     args[i].size_type = sizeof(T);
     args[i].binary.lhs_offset = reinterpret_cast<uint32_t>(lhs.data()[i]);
     args[i].binary.rhs_offset = reinterpret_cast<uint32_t>(rhs.data()[i]);
     args[i].binary.res_offset = reinterpret_cast<uint32_t>(res.data()[i]);
   }
+}
 
-#ifdef ENABLE_DPU_LOGGING
-  log_dpu_launch_args(args, nr_of_dpus);
-#endif
-
-  dpu_set_t& dpu_set = runtime.dpu_set();
-  dpu_set_t dpu;
-  uint32_t idx_dpu = 0;
+template <typename T>
+void submit_binop(dpu_vector<T>& res, const dpu_vector<T>& lhs,
+                  const dpu_vector<T>& rhs, KernelID kernel_id) {
+  auto& event_queue = res.stream().get_event_queue();
 
-  DPU_FOREACH(dpu_set, dpu, idx_dpu) {
-    CHECK_UPMEM(dpu_prepare_xfer(dpu, &args[idx_dpu]));
-  }
-  CHECK_UPMEM(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU, "args", 0,
-                            sizeof(args[0]), DPU_XFER_DEFAULT));
-  CHECK_UPMEM(dpu_launch(dpu_set, DPU_ASYNCHRONOUS));
+  std::shared_ptr<Event> e = Event::create(Event::OperationType::COMPUTE);
+  fill_binop_args(e->args, res, lhs, rhs, kernel_id);
+  e->cb = std::bind(push_args_and_launch, std::ref(res.stream()),
+                    std::ref(e->args));
+  e->batchable = true;
+  e->res = res.buffer();
+  e->operands = {lhs.buffer(), rhs.buffer()};
+  e->reads = {lhs.buffer_id(), rhs.buffer_id()};
+  e->writes = {res.buffer_id()};
+  event_queue.submit(e);
+  event_queue.process_events();
 }
 
 template <typename T>
 dpu_vector<T> launch_binop(const dpu_vector<T>& lhs, const dpu_vector<T>& rhs,
                            KernelID kernel_id) {
   assert(lhs.size() == rhs.size());
-  dpu_vector<T> res(lhs.size());
+  assert(&lhs.stream() == &rhs.stream());
+  dpu_vector<T> res(lhs.size(), lhs.stream());
+  submit_binop(res, lhs, rhs, kernel_id);
+  return res;
+}
 
-  auto bound_cb = std::bind(internal_launch_binop<T>, res, lhs, rhs, kernel_id);
+template <typename T>
+void fill_unary_args(vector<DPU_LAUNCH_ARGS>& args, const dpu_vector<T>& res,
+                     const dpu_vector<T>& a, KernelID kernel_id) {
   auto& runtime = DpuRuntime::get();
-  auto& event_queue = runtime.get_event_queue();
 
-  std::shared_ptr<Event> e =
-      std::make_shared<Event>(Event::OperationType::COMPUTE, bound_cb);
-  e->res = res;
-  event_queue.submit(e);
+  uint32_t nr_of_dpus = res.stream().num_dpus();
+  args.resize(nr_of_dpus);
 
-  // TODO have some sort of dependency analysis
-  while (e->finished == false) {
-    event_queue.process_next();
+  for (uint32_t i = 0; i < nr_of_dpus; i++) {
+    args[i].kernel = static_cast<uint32_t>(kernel_id);
+    args[i].is_binary = false;
+    args[i].block_bytes = runtime.block_bytes(kernel_id);
+    args[i].num_elements = a.data_desc().second[i] / sizeof(T);
+    args[i].size_type = sizeof(T);
+    args[i].unary.rhs_offset = reinterpret_cast<uint32_t>(a.data()[i]);
+    args[i].unary.res_offset = reinterpret_cast<uint32_t>(res.data()[i]);
   }
+}
+
+template <typename T>
+void submit_unary(dpu_vector<T>& res, const dpu_vector<T>& a,
+                  KernelID kernel_id) {
+  auto& event_queue = res.stream().get_event_queue();
+
+  std::shared_ptr<Event> e = Event::create(Event::OperationType::COMPUTE);
+  fill_unary_args(e->args, res, a, kernel_id);
+  e->cb = std::bind(push_args_and_launch, std::ref(res.stream()),
+                    std::ref(e->args));
+  e->batchable = true;
+  e->res = res.buffer();
+  e->operands = {a.buffer()};
+  e->reads = {a.buffer_id()};
+  e->writes = {res.buffer_id()};
+  event_queue.submit(e);
+  event_queue.process_events();
+}
 
+template <typename T>
+dpu_vector<T> launch_unary(const dpu_vector<T>& a, KernelID kernel_id) {
+  dpu_vector<T> res(a.size(), a.stream());
+  submit_unary(res, a, kernel_id);
   return res;
 }
 
 template <typename T>
-void internal_launch_unary(dpu_vector<T>& res, const dpu_vector<T>& a,
-                           KernelID kernel_id) {
+void fill_scalar_args(vector<DPU_LAUNCH_ARGS>& args, const dpu_vector<T>& res,
+                      const dpu_vector<T>& a, T scalar, KernelID kernel_id) {
   auto& runtime = DpuRuntime::get();
 
-  uint32_t nr_of_dpus = runtime.num_dpus();
-  DPU_LAUNCH_ARGS args[nr_of_dpus];
+  uint32_t nr_of_dpus = res.stream().num_dpus();
+  args.resize(nr_of_dpus);
 
   for (uint32_t i = 0; i < nr_of_dpus; i++) {
     args[i].kernel = static_cast<uint32_t>(kernel_id);
     args[i].is_binary = false;
-    args[i].num_elements = a.size();
+    args[i].block_bytes = runtime.block_bytes(kernel_id);
+    args[i].num_elements = a.data_desc().second[i] / sizeof(T);
     args[i].size_type = sizeof(T);
-    args[i].unary.rhs_offset = reinterpret_cast<uint32_t>(a.data()[i]);
-    args[i].unary.res_offset = reinterpret_cast<uint32_t>(res.data()[i]);
+    args[i].scalar.rhs_offset = reinterpret_cast<uint32_t>(a.data()[i]);
+    args[i].scalar.res_offset = reinterpret_cast<uint32_t>(res.data()[i]);
+    args[i].scalar.value = ScalarKernelSelector<T>::wrap(scalar);
   }
+}
 
-#ifdef ENABLE_DPU_LOGGING
-  log_dpu_launch_args(args, nr_of_dpus);
-#endif
+template <typename T>
+void submit_scalar(dpu_vector<T>& res, const dpu_vector<T>& a, T scalar,
+                   KernelID kernel_id) {
+  auto& event_queue = res.stream().get_event_queue();
 
-  dpu_set_t& dpu_set = runtime.dpu_set();
-  dpu_set_t dpu;
-  uint32_t idx_dpu = 0;
+  std::shared_ptr<Event> e = Event::create(Event::OperationType::COMPUTE);
+  fill_scalar_args(e->args, res, a, scalar, kernel_id);
+  e->cb = std::bind(push_args_and_launch, std::ref(res.stream()),
+                    std::ref(e->args));
+  e->batchable = true;
+  e->res = res.buffer();
+  e->operands = {a.buffer()};
+  e->reads = {a.buffer_id()};
+  e->writes = {res.buffer_id()};
+  event_queue.submit(e);
+  event_queue.process_events();
+}
 
-  DPU_FOREACH(dpu_set, dpu, idx_dpu) {
-    CHECK_UPMEM(dpu_prepare_xfer(dpu, &args[idx_dpu]));
+template <typename T>
+dpu_vector<T> launch_scalar(const dpu_vector<T>& a, T scalar,
+                            KernelID kernel_id) {
+  dpu_vector<T> res(a.size(), a.stream());
+  submit_scalar(res, a, scalar, kernel_id);
+  return res;
+}
+
+// ============================
+// Reductions
+// ============================
+// Pseudo buffer standing for the reduce_result symbol in Event::reads and
+// writes
+constexpr uint32_t REDUCE_RESULT_BUFFER = UINT32_MAX;
+
+template <typename T>
+void internal_launch_reduce(vector<DPU_LAUNCH_ARGS>& args,
+                            const dpu_vector<T>& lhs, const dpu_vector<T>& rhs,
+                            KernelID kernel_id, bool is_binary) {
+  auto& runtime = DpuRuntime::get();
+
+  uint32_t nr_of_dpus = lhs.stream().num_dpus();
+  args.resize(nr_of_dpus);
+
+  for (uint32_t i = 0; i < nr_of_dpus; i++) {
+    args[i].kernel = static_cast<uint32_t>(kernel_id);
+    args[i].is_binary = is_binary;
+    args[i].block_bytes = runtime.block_bytes(kernel_id);
+    args[i].num_elements = lhs.data_desc().second[i] / sizeof(T);
+    args[i].size_type = sizeof(T);
+    if (is_binary) {
+      args[i].binary.lhs_offset = reinterpret_cast<uint32_t>(lhs.data()[i]);
+      args[i].binary.rhs_offset = reinterpret_cast<uint32_t>(rhs.data()[i]);
+      args[i].binary.res_offset = 0;
+    } else {
+      args[i].unary.rhs_offset = reinterpret_cast<uint32_t>(lhs.data()[i]);
+      args[i].unary.res_offset = 0;
+    }
   }
-  CHECK_UPMEM(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU, "args", 0,
-                            sizeof(args[0]), DPU_XFER_DEFAULT));
-  CHECK_UPMEM(dpu_launch(dpu_set, DPU_ASYNCHRONOUS));
+
+  push_args_and_launch(lhs.stream(), args);
+}
+
+void reduce_xfer_from_dpu(DpuStream& stream, DPU_REDUCE_RESULT* results) {
+  stream.for_each_rank([&](uint32_t r) {
+    dpu_set_t& rank = stream.rank_set(r);
+    uint32_t first = stream.rank_first_dpu(r);
+    dpu_set_t dpu;
+    uint32_t idx_dpu = 0;
+    DPU_FOREACH(rank, dpu, idx_dpu) {
+      CHECK_UPMEM(dpu_prepare_xfer(dpu, &results[first + idx_dpu]));
+    }
+    CHECK_UPMEM(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "reduce_result", 0,
+                              sizeof(DPU_REDUCE_RESULT), DPU_XFER_ASYNC));
+  });
 }
 
 template <typename T>
-dpu_vector<T> launch_unary(const dpu_vector<T>& a, KernelID kernel_id) {
-  dpu_vector<T> res(a.size());
+std::shared_ptr<Event> submit_reduce(
+    const dpu_vector<T>& lhs, const dpu_vector<T>& rhs, KernelID kernel_id,
+    bool is_binary, std::shared_ptr<vector<DPU_REDUCE_RESULT>> results) {
+  assert(&lhs.stream() == &rhs.stream());
+  DpuStream& stream = lhs.stream();
+  assert(results->size() >= stream.num_dpus());
+  auto& event_queue = stream.get_event_queue();
 
-  auto bound_cb = std::bind(internal_launch_unary<T>, res, a, kernel_id);
+  std::shared_ptr<Event> e = Event::create(Event::OperationType::COMPUTE);
+  e->cb = std::bind(internal_launch_reduce<T>, std::ref(e->args), lhs, rhs,
+                    kernel_id, is_binary);
+  e->operands = {lhs.buffer(), rhs.buffer()};
+  e->reads = {lhs.buffer_id(), rhs.buffer_id()};
+  e->writes = {REDUCE_RESULT_BUFFER};
+
+  std::shared_ptr<Event> xfer = Event::create(
+      Event::OperationType::HOST_TRANSFER,
+      std::bind(reduce_xfer_from_dpu, std::ref(stream), results->data()));
+  xfer->bytes = stream.num_dpus() * sizeof(DPU_REDUCE_RESULT);
+  xfer->host_data = results->data();
+  xfer->reads = {REDUCE_RESULT_BUFFER};
+  xfer->host_res = std::move(results);
+  // Every reduction leaves its results in the same DPU symbol, so no other
+  // thread's reduction may run before they are read back
+  event_queue.submit(e, xfer);
+  return xfer;
+}
+
+// The combined result, in the type the DPUs accumulated it in
+template <typename T, typename Combine>
+reduce_acc_t<T> launch_reduce(const dpu_vector<T>& lhs,
+                              const dpu_vector<T>& rhs, KernelID kernel_id,
+                              bool is_binary, Combine combine) {
+  DpuStream& stream = lhs.stream();
+  auto results =
+      std::make_shared<vector<DPU_REDUCE_RESULT>>(stream.num_dpus());
+  std::shared_ptr<Event> xfer =
+      submit_reduce(lhs, rhs, kernel_id, is_binary, results);
+
+  // The ranks are combined in order, each as soon as its results are in
+  const vector<uint32_t>& sizes = lhs.data_desc().second;
+  std::optional<reduce_acc_t<T>> total;
+  for (uint32_t r = 0; r < stream.num_ranks(); r++) {
+    stream.get_event_queue().wait(xfer, r);
+    fold_reduce_results<T>(sizes, results->data(), stream.rank_first_dpu(r),
+                           stream.rank_first_dpu(r + 1), combine, total);
+  }
+  return total.value_or(reduce_acc_t<T>{});
+}
+
+template <typename T>
+T reduce_sum(const dpu_vector<T>& a) {
+  return static_cast<T>(
+      launch_reduce(a, a, ReduceKernelSelector<T>::sum(), false,
+                    [](auto x, auto y) { return x + y; }));
+}
+
+template <typename T>
+T reduce_min(const dpu_vector<T>& a) {
+  return static_cast<T>(
+      launch_reduce(a, a, ReduceKernelSelector<T>::min(), false,
+                    [](auto x, auto y) { return std::min(x, y); }));
+}
+
+template <typename T>
+T reduce_max(const dpu_vector<T>& a) {
+  return static_cast<T>(
+      launch_reduce(a, a, ReduceKernelSelector<T>::max(), false,
+                    [](auto x, auto y) { return std::max(x, y); }));
+}
+
+template <typename T>
+T dot(const dpu_vector<T>& a, const dpu_vector<T>& b) {
+  assert(a.size() == b.size());
+  return static_cast<T>(
+      launch_reduce(a, b, ReduceKernelSelector<T>::dot(), true,
+                    [](auto x, auto y) { return x + y; }));
+}
+
+template <typename T>
+double norm2(const dpu_vector<T>& a) {
+  // The dot kernel reads a shared operand only once
+  return std::sqrt(static_cast<double>(
+      launch_reduce(a, a, ReduceKernelSelector<T>::dot(), true,
+                    [](auto x, auto y) { return x + y; })));
+}
+
+// ============================
+// Expression fusion
+// ============================
+template <typename T>
+KernelID native_kernel(FusedOp op) {
+  switch (op) {
+    case F_NEGATE:
+      return UnaryKernelSelector<T>::negate();
+    case F_ABS:
+      return UnaryKernelSelector<T>::abs();
+    case F_ADD:
+      return BinaryKernelSelector<T>::add();
+    case F_SUB:
+      return BinaryKernelSelector<T>::sub();
+    case F_MUL:
+      return BinaryKernelSelector<T>::mul();
+    case F_DIV:
+      return BinaryKernelSelector<T>::div();
+    case F_MOD:
+      if constexpr (std::is_integral_v<T>) {
+        return BinaryKernelSelector<T>::mod();
+      }
+      break;
+    case F_MIN:
+      return BinaryKernelSelector<T>::min();
+    case F_MAX:
+      return BinaryKernelSelector<T>::max();
+    case F_LT:
+      return BinaryKernelSelector<T>::lt();
+    case F_EQ:
+      return BinaryKernelSelector<T>::eq();
+    case F_GT:
+      return BinaryKernelSelector<T>::gt();
+    default:
+      break;
+  }
+  assert(false && "No native kernel for fused op");
+  return KERNEL_COUNT;
+}
+
+// Scalar kernel for op with the scalar on the given side, or KERNEL_COUNT when
+// there is none and the op goes through the fused kernel
+template <typename T>
+KernelID native_scalar_kernel(FusedOp op, bool scalar_lhs) {
+  switch (op) {
+    case F_ADD:
+      return ScalarKernelSelector<T>::add();
+    case F_SUB:
+      return scalar_lhs ? ScalarKernelSelector<T>::rsub()
+                        : ScalarKernelSelector<T>::sub();
+    case F_MUL:
+      return ScalarKernelSelector<T>::mul();
+    case F_DIV:
+      return scalar_lhs ? KERNEL_COUNT : ScalarKernelSelector<T>::div();
+    case F_MOD:
+      if constexpr (std::is_integral_v<T>) {
+        return scalar_lhs ? KERNEL_COUNT : ScalarKernelSelector<T>::mod();
+      }
+      return KERNEL_COUNT;
+    default:
+      return KERNEL_COUNT;
+  }
+}
+
+// Compiles an expression tree into a DPU_FUSED_PROGRAM. The distinct leaves
+// are the program inputs and occupy the first registers, followed by the
+// distinct scalars; the remaining registers hold temporaries and are reused as
+// soon as they are consumed.
+template <typename T>
+class fused_compiler {
+ public:
+  // Returns false if the tree does not fit in a single program
+  bool compile(const expr_node<T>& root) {
+    collect_inputs(root);
+    if (inputs_.size() > FUSED_MAX_INPUTS) return false;
+    if (constants_.size() > FUSED_MAX_CONSTANTS) return false;
+    program_.num_inputs = inputs_.size();
+    program_.num_constants = constants_.size();
+    for (uint32_t c = 0; c < constants_.size(); c++) {
+      program_.constants[c] = ScalarKernelSelector<T>::wrap(constants_[c]);
+    }
+    for (uint32_t r = first_temp(); r < FUSED_MAX_REGS; r++) {
+      free_temps_ |= 1U << r;
+    }
+    int reg = emit(root);
+    if (reg < 0) return false;
+    program_.result_reg = reg;
+    return true;
+  }
+
+  const DPU_FUSED_PROGRAM& program() const { return program_; }
+  const vector<dpu_vector<T>>& inputs() const { return inputs_; }
+
+ private:
+  void collect_inputs(const expr_node<T>& node) {
+    if (node.kind == expr_node<T>::Kind::LEAF) {
+      if (input_reg(*node.leaf) < 0) inputs_.push_back(*node.leaf);
+      return;
+    }
+    if (node.kind == expr_node<T>::Kind::SCALAR) {
+      if (constant_reg(node.value) < 0) constants_.push_back(node.value);
+      return;
+    }
+    if (node.cond) collect_inputs(*node.cond);
+    collect_inputs(*node.lhs);
+    if (node.rhs) collect_inputs(*node.rhs);
+  }
+
+  int input_reg(const dpu_vector<T>& leaf) const {
+    for (size_t i = 0; i < inputs_.size(); i++) {
+      if (inputs_[i].buffer_id() == leaf.buffer_id()) return i;
+    }
+    return -1;
+  }
+
+  int constant_reg(T value) const {
+    for (size_t c = 0; c < constants_.size(); c++) {
+      if (std::memcmp(&constants_[c], &value, sizeof(T)) == 0) {
+        return program_.num_inputs + c;
+      }
+    }
+    return -1;
+  }
+
+  uint32_t first_temp() const {
+    return program_.num_inputs + program_.num_constants;
+  }
+
+  bool is_temp(int reg) const { return reg >= static_cast<int>(first_temp()); }
+
+  int alloc_temp() {
+    if (free_temps_ == 0) return -1;
+    int reg = __builtin_ctz(free_temps_);
+    free_temps_ &= ~(1U << reg);
+    return reg;
+  }
+
+  void free_temp(int reg) { free_temps_ |= 1U << reg; }
+
+  bool push(FusedOp op, int dst, int lhs, int rhs) {
+    if (program_.num_instrs == FUSED_MAX_INSTRS) return false;
+    program_.code[program_.num_instrs++] = FUSED_INSTR{
+        static_cast<uint8_t>(op), static_cast<uint8_t>(dst),
+        static_cast<uint8_t>(lhs), static_cast<uint8_t>(rhs)};
+    return true;
+  }
+
+  // F_SELECT reads its condition from the destination, which therefore has
+  // to be a temporary holding the condition
+  int emit_select(const expr_node<T>& node) {
+    int cond = emit(*node.cond);
+    if (cond < 0) return -1;
+    int lhs = emit(*node.lhs);
+    if (lhs < 0) return -1;
+    int rhs = emit(*node.rhs);
+    if (rhs < 0) return -1;
+
+    int dst = cond;
+    if (!is_temp(cond)) {
+      dst = alloc_temp();
+      if (dst < 0 || !push(F_COPY, dst, cond, 0)) return -1;
+    }
+    if (is_temp(lhs)) free_temp(lhs);
+    if (is_temp(rhs) && rhs != lhs) free_temp(rhs);
+    return push(F_SELECT, dst, lhs, rhs) ? dst : -1;
+  }
+
+  // Returns the register holding the value of node, or -1 on overflow
+  int emit(const expr_node<T>& node) {
+    if (node.kind == expr_node<T>::Kind::LEAF) return input_reg(*node.leaf);
+    if (node.kind == expr_node<T>::Kind::SCALAR) {
+      return constant_reg(node.value);
+    }
+    if (node.kind == expr_node<T>::Kind::SELECT) return emit_select(node);
+
+    int lhs = emit(*node.lhs);
+    if (lhs < 0) return -1;
+    int rhs = 0;
+    if (node.kind == expr_node<T>::Kind::BINARY) {
+      rhs = emit(*node.rhs);
+      if (rhs < 0) return -1;
+    }
+
+    // Elementwise ops may overwrite one of their own operands
+    int dst;
+    if (is_temp(lhs)) {
+      dst = lhs;
+    } else if (node.kind == expr_node<T>::Kind::BINARY && is_temp(rhs)) {
+      dst = rhs;
+    } else {
+      dst = alloc_temp();
+      if (dst < 0) return -1;
+    }
+    if (node.kind == expr_node<T>::Kind::BINARY && is_temp(rhs) && rhs != dst) {
+      free_temp(rhs);
+    }
+
+    return push(node.op, dst, lhs, rhs) ? dst : -1;
+  }
+
+  DPU_FUSED_PROGRAM program_{};
+  vector<dpu_vector<T>> inputs_;
+  vector<T> constants_;
+  uint32_t free_temps_ = 0;  // bitmask of available temporaries
+};
+
+template <typename T>
+void fill_fused_args(vector<DPU_LAUNCH_ARGS>& args,
+                     vector<DPU_FUSED_PROGRAM>& programs,
+                     const dpu_vector<T>& res,
+                     const vector<dpu_vector<T>>& inputs,
+                     const DPU_FUSED_PROGRAM& program) {
   auto& runtime = DpuRuntime::get();
-  auto& event_queue = runtime.get_event_queue();
 
-  std::shared_ptr<Event> e =
-      std::make_shared<Event>(Event::OperationType::COMPUTE, bound_cb);
-  e->res = res;
+  uint32_t nr_of_dpus = res.stream().num_dpus();
+  args.resize(nr_of_dpus);
+  programs.assign(nr_of_dpus, program);
+
+  for (uint32_t i = 0; i < nr_of_dpus; i++) {
+    args[i].kernel = static_cast<uint32_t>(FusedKernelSelector<T>::program());
+    args[i].is_binary = false;
+    args[i].block_bytes =
+        runtime.block_bytes(FusedKernelSelector<T>::program());
+    args[i].num_elements = res.data_desc().second[i] / sizeof(T);
+    args[i].size_type = sizeof(T);
+    args[i].fused.res_offset = reinterpret_cast<uint32_t>(res.data()[i]);
+    for (uint32_t in = 0; in < program.num_inputs; in++) {
+      programs[i].input_offsets[in] = inputs[in].data()[i];
+    }
+  }
+}
+
+void push_program_and_launch(DpuStream& stream, vector<DPU_LAUNCH_ARGS>& args,
+                             vector<DPU_FUSED_PROGRAM>& programs) {
+  push_per_dpu(stream, "program", programs.data(), sizeof(programs[0]));
+  push_args_and_launch(stream, args);
+}
+
+void push_commands_and_launch(DpuStream& stream, vector<DPU_LAUNCH_ARGS>& args,
+                              vector<DPU_COMMAND>& commands) {
+  uint32_t num_commands = commands.size() / stream.num_dpus();
+  push_per_dpu(stream, "commands", commands.data(),
+               num_commands * sizeof(DPU_COMMAND));
+  push_args_and_launch(stream, args);
+}
+
+dpu_batch::dpu_batch() : dpu_batch(default_stream()) {}
+
+dpu_batch::dpu_batch(DpuStream& stream) : stream_(&stream) {
+  stream_->get_event_queue().begin_batch();
+}
+
+dpu_batch::~dpu_batch() { stream_->get_event_queue().end_batch(); }
+
+void dpu_batch::flush() { stream_->get_event_queue().flush_batch(); }
+
+template <typename T>
+void submit_fused(dpu_vector<T>& res, const fused_compiler<T>& compiler) {
+  auto& event_queue = res.stream().get_event_queue();
+
+  std::shared_ptr<Event> e = Event::create(Event::OperationType::COMPUTE);
+  fill_fused_args(e->args, e->programs, res, compiler.inputs(),
+                  compiler.program());
+  e->cb = std::bind(push_program_and_launch, std::ref(res.stream()),
+                    std::ref(e->args), std::ref(e->programs));
+  e->batchable = true;
+  e->res = res.buffer();
+  for (const auto& in : compiler.inputs()) {
+    e->operands.push_back(in.buffer());
+    e->reads.push_back(in.buffer_id());
+  }
+  e->writes = {res.buffer_id()};
   event_queue.submit(e);
+  event_queue.process_events();
+}
+
+// Evaluates node into res with as few launches as possible. res may be one of
+// the leaves: every kernel reads a block before writing it back.
+template <typename T>
+void evaluate(const expr_node<T>& node, dpu_vector<T>& res) {
+  using Kind = typename expr_node<T>::Kind;
+
+  if (node.kind == Kind::LEAF && node.leaf->buffer_id() == res.buffer_id()) {
+    return;
+  }
 
-  // TODO have some sort of dependency analysis
-  while (e->finished == false) {
-    event_queue.process_next();
+  // A single operation on vectors uses its native kernel
+  if (node.kind == Kind::UNARY && node.lhs->kind == Kind::LEAF) {
+    submit_unary(res, *node.lhs->leaf, native_kernel<T>(node.op));
+    return;
+  }
+  if (node.kind == Kind::BINARY && node.lhs->kind == Kind::LEAF &&
+      node.rhs->kind == Kind::LEAF) {
+    submit_binop(res, *node.lhs->leaf, *node.rhs->leaf,
+                 native_kernel<T>(node.op));
+    return;
+  }
+  if (node.kind == Kind::BINARY && node.lhs->kind == Kind::LEAF &&
+      node.rhs->kind == Kind::SCALAR) {
+    KernelID kernel = native_scalar_kernel<T>(node.op, false);
+    if (kernel != KERNEL_COUNT) {
+      submit_scalar(res, *node.lhs->leaf, node.rhs->value, kernel);
+      return;
+    }
+  }
+  if (node.kind == Kind::BINARY && node.lhs->kind == Kind::SCALAR &&
+      node.rhs->kind == Kind::LEAF) {
+    KernelID kernel = native_scalar_kernel<T>(node.op, true);
+    if (kernel != KERNEL_COUNT) {
+      submit_scalar(res, *node.rhs->leaf, node.lhs->value, kernel);
+      return;
+    }
   }
 
-  return res;
-}
\ No newline at end of file
+  fused_compiler<T> compiler;
+  if (compiler.compile(node)) {
+    submit_fused(res, compiler);
+    return;
+  }
+
+  // Too large for one program: materialize the operands first
+  expr_node<T> split{node.kind, node.op,  node.size, nullptr,
+                     node.value, node.lhs, node.rhs,  node.cond,
+                     node.stream};
+  std::unique_ptr<dpu_vector<T>> lhs, rhs, cond;
+  auto is_operand = [](const expr_node<T>& n) {
+    return n.kind == Kind::LEAF || n.kind == Kind::SCALAR;
+  };
+  if (!is_operand(*node.lhs)) {
+    lhs = std::make_unique<dpu_vector<T>>(node.lhs->size, res.stream());
+    evaluate(*node.lhs, *lhs);
+    split.lhs = dpu_expr<T>(*lhs).node();
+  }
+  if (node.rhs && !is_operand(*node.rhs)) {
+    rhs = std::make_unique<dpu_vector<T>>(node.rhs->size, res.stream());
+    evaluate(*node.rhs, *rhs);
+    split.rhs = dpu_expr<T>(*rhs).node();
+  }
+  if (node.cond && !is_operand(*node.cond)) {
+    cond = std::make_unique<dpu_vector<T>>(node.cond->size, res.stream());
+    evaluate(*node.cond, *cond);
+    split.cond = dpu_expr<T>(*cond).node();
+  }
+  evaluate(split, res);
+}
+
+// Stream of the vectors in node, which must all live on the same one
+template <typename T>
+DpuStream* expr_stream(const expr_node<T>& node) {
+  if (node.kind == expr_node<T>::Kind::LEAF) return &node.leaf->stream();
+  if (node.stream != nullptr) return node.stream;
+  DpuStream* lhs = node.lhs ? expr_stream(*node.lhs) : nullptr;
+  DpuStream* rhs = node.rhs ? expr_stream(*node.rhs) : nullptr;
+  DpuStream* cond = node.cond ? expr_stream(*node.cond) : nullptr;
+  assert(lhs == nullptr || rhs == nullptr || lhs == rhs);
+  if (lhs == nullptr) lhs = rhs;
+  assert(lhs == nullptr || cond == nullptr || lhs == cond);
+  return lhs != nullptr ? lhs : cond;
+}
+
+template <typename T>
+DpuStream* dpu_expr<T>::stream() const {
+  return expr_stream(*node_);
+}
+
+template <typename T>
+dpu_expr<T> dpu_expr<T>::on(DpuStream& stream) const {
+  if (this->stream() != nullptr) return *this;
+  const expr_node<T>& n = *node_;
+  return dpu_expr(std::make_shared<expr_node<T>>(
+      expr_node<T>{n.kind, n.op, n.size, nullptr, n.value, n.lhs, n.rhs,
+                   n.cond, &stream}));
+}
+
+// Stream expr is evaluated on
+template <typename T>
+DpuStream& eval_stream(const dpu_expr<T>& expr) {
+  DpuStream* stream = expr.stream();
+  if (stream == nullptr) {
+    throw std::logic_error(
+        "Expression without vectors evaluated with no stream; see "
+        "dpu_expr::on()");
+  }
+  return *stream;
+}
+
+template <typename T>
+dpu_vector<T>::dpu_vector(const dpu_expr<T>& expr, std::string_view name,
+                          std::source_location loc)
+    : dpu_vector(expr.size(), eval_stream(expr), name, loc) {
+  evaluate(*expr.node(), *this);
+}
+
+// Collects the distinct leaves of node that refer to buffer
+template <typename T>
+void collect_leaves(const expr_node<T>& node, uint32_t buffer,
+                    vector<const expr_node<T>*>& leaves) {
+  if (node.kind == expr_node<T>::Kind::LEAF) {
+    if (node.leaf->buffer_id() == buffer &&
+        std::find(leaves.begin(), leaves.end(), &node) == leaves.end()) {
+      leaves.push_back(&node);
+    }
+    return;
+  }
+  if (node.lhs) collect_leaves(*node.lhs, buffer, leaves);
+  if (node.rhs) collect_leaves(*node.rhs, buffer, leaves);
+  if (node.cond) collect_leaves(*node.cond, buffer, leaves);
+}
+
+template <typename T>
+dpu_vector<T>& dpu_vector<T>::operator=(const dpu_expr<T>& expr) {
+  // Evaluate in place unless the buffer has the wrong size or stream, or is
+  // shared with a handle other than the leaves of expr
+  DpuStream& stream = eval_stream(expr);
+  bool in_place =
+      buffer_ && size_ == expr.size() && &this->stream() == &stream;
+  if (in_place && buffer_->handles > 1) {
+    vector<const expr_node<T>*> leaves;
+    collect_leaves(*expr.node(), buffer_id(), leaves);
+    in_place = buffer_->handles == 1 + leaves.size();
+  }
+  if (!in_place) reallocate(expr.size(), stream);
+  evaluate(*expr.node(), *this);
+  return *this;
+}
+
+template <typename T>
+dpu_vector<T>& dpu_vector<T>::operator+=(const dpu_expr<T>& rhs) {
+  return *this = dpu_expr<T>(*this) + rhs;
+}
+
+template <typename T>
+dpu_vector<T>& dpu_vector<T>::operator-=(const dpu_expr<T>& rhs) {
+  return *this = dpu_expr<T>(*this) - rhs;
+}
+
+template <typename T>
+dpu_vector<T>& dpu_vector<T>::operator*=(const dpu_expr<T>& rhs) {
+  return *this = dpu_expr<T>(*this) * rhs;
+}
+
+template <typename T>
+dpu_vector<T>& dpu_vector<T>::operator/=(const dpu_expr<T>& rhs) {
+  return *this = dpu_expr<T>(*this) / rhs;
+}
+
+template <typename T>
+dpu_vector<T>& dpu_vector<T>::operator+=(T scalar) {
+  return *this = dpu_expr<T>(*this) + scalar;
+}
+
+template <typename T>
+dpu_vector<T>& dpu_vector<T>::operator-=(T scalar) {
+  return *this = dpu_expr<T>(*this) - scalar;
+}
+
+template <typename T>
+dpu_vector<T>& dpu_vector<T>::operator*=(T scalar) {
+  return *this = dpu_expr<T>(*this) * scalar;
+}
+
+template <typename T>
+dpu_vector<T>& dpu_vector<T>::operator/=(T scalar) {
+  return *this = dpu_expr<T>(*this) / scalar;
+}
+
+template <typename T>
+dpu_vector<T>& dpu_vector<T>::negate_in_place() {
+  return *this = -dpu_expr<T>(*this);
+}
+
+template <typename T>
+dpu_vector<T>& dpu_vector<T>::abs_in_place() {
+  return *this = abs(dpu_expr<T>(*this));
+}
+
+template <typename T>
+vector<T> dpu_expr<T>::to_cpu() const {
+  dpu_vector<T> res(*this);
+  return res.to_cpu();
+}
@@ -0,0 +1,100 @@
+#include "workers.h"
+
+WorkerPool::WorkerPool(uint32_t num_threads) {
+  for (uint32_t i = 0; i < num_threads; i++) {
+    threads_.emplace_back(&WorkerPool::worker_main, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stop_ = true;
+  }
+  start_.notify_all();
+  for (auto& t : threads_) t.join();
+}
+
+void WorkerPool::parallel_for(uint32_t n,
+                              const std::function<void(uint32_t)>& fn) {
+  if (threads_.empty() || n <= 1) {
+    for (uint32_t i = 0; i < n; i++) fn(i);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    job_ = &fn;
+    job_size_ = n;
+    next_.store(0, std::memory_order_relaxed);
+    busy_ = threads_.size();
+    generation_++;
+  }
+  start_.notify_all();
+  run_job();
+
+  // fn must outlive every worker that may still call it
+  std::unique_lock<std::mutex> lock(lock_);
+  done_.wait(lock, [this] { return busy_ == 0; });
+  job_ = nullptr;
+}
+
+void WorkerPool::run_job() {
+  for (;;) {
+    uint32_t i = next_.fetch_add(1, std::memory_order_relaxed);
+    if (i >= job_size_) return;
+    (*job_)(i);
+  }
+}
+
+void WorkerPool::worker_main() {
+  uint64_t seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      start_.wait(lock, [&] { return stop_ || generation_ != seen; });
+      if (stop_) return;
+      seen = generation_;
+    }
+    run_job();
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      busy_--;
+    }
+    done_.notify_one();
+  }
+}
+
+CompletionThread::CompletionThread()
+    : thread_(&CompletionThread::thread_main, this) {}
+
+CompletionThread::~CompletionThread() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stop_ = true;
+  }
+  ready_.notify_one();
+  thread_.join();
+}
+
+void CompletionThread::post(small_function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    jobs_.push_back(std::move(job));
+  }
+  ready_.notify_one();
+}
+
+void CompletionThread::thread_main() {
+  for (;;) {
+    small_function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      ready_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+      if (jobs_.empty()) return;  // stopped
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    job();
+  }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "small_function.h"
+
+// Host threads that split the per-rank work of a transfer (preparing the
+// buffers of every DPU and pushing them) between themselves. The thread that
+// calls parallel_for works too, so a pool of n threads runs n + 1 at a time.
+class WorkerPool {
+ public:
+  explicit WorkerPool(uint32_t num_threads);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  // Runs fn(0) ... fn(n - 1), each once and in no particular order, and
+  // returns when all of them have returned. Not reentrant.
+  void parallel_for(uint32_t n, const std::function<void(uint32_t)>& fn);
+
+  uint32_t num_threads() const { return threads_.size(); }
+
+ private:
+  void worker_main();
+  // Takes indices of the current job until there are none left
+  void run_job();
+
+  std::vector<std::thread> threads_;
+  std::mutex lock_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+
+  const std::function<void(uint32_t)>* job_ = nullptr;
+  uint32_t job_size_ = 0;
+  uint64_t generation_ = 0;  // bumped for every job
+  uint32_t busy_ = 0;        // workers still in the current job
+  bool stop_ = false;
+  std::atomic<uint32_t> next_{0};
+};
+
+// A host thread that runs the jobs posted to it one after another, in order.
+// Coroutines waiting for an event are resumed on it rather than on the SDK's
+// callback thread, so they may block and submit more work.
+class CompletionThread {
+ public:
+  CompletionThread();
+  // Runs the jobs posted so far, then joins
+  ~CompletionThread();
+
+  CompletionThread(const CompletionThread&) = delete;
+  CompletionThread& operator=(const CompletionThread&) = delete;
+
+  void post(small_function<void()> job);
+
+ private:
+  void thread_main();
+
+  std::mutex lock_;
+  std::condition_variable ready_;
+  std::deque<small_function<void()>> jobs_;
+  bool stop_ = false;
+  std::thread thread_;  // last, started once the rest is initialized
+};
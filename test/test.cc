@@ -11,12 +11,22 @@
    David Krasowska, October 2025
 */
 
+#include <future.h>
+#include <pipeline.h>
+#include <recorder.h>
 #include <runtime.h>
 #include <vectordpu.h>
 
+#include <algorithm>
 #include <cassert>
+#include <climits>
 #include <cmath>
+#include <filesystem>
 #include <iostream>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 
 using test_error = uint32_t;
 
@@ -64,6 +74,71 @@ test_error test_int_add() {
   return compare_cpu_binary(a, b, res, [](int x, int y) { return x + y; });
 }
 
+// The last DPUs hold fewer elements, so their launch args differ from the
+// others
+test_error test_uneven_split() {
+  const uint32_t N = 1024 * 1024 + 37;
+  vector<int> a(N), b(N);
+  for (uint32_t i = 0; i < N; i++) {
+    a[i] = rand() % 100;
+    b[i] = rand() % 100;
+  }
+
+  dpu_vector<int> da = dpu_vector<int>::from_cpu(a);
+  dpu_vector<int> db = dpu_vector<int>::from_cpu(b);
+  dpu_vector<int> res = abs(da - db) + 1;
+
+  return compare_cpu_binary(a, b, res,
+                            [](int x, int y) { return std::abs(x - y) + 1; });
+}
+
+// Slices of an odd number of ints end in the middle of an 8-byte word
+test_error test_span_transfers() {
+  const uint32_t N = 1001 * 32 + 7;
+  vector<int> a(N + 2);
+  for (uint32_t i = 0; i < N + 2; i++) a[i] = rand() % 100;
+
+  std::span<const int> src(a.data() + 1, N);
+  dpu_vector<int> da = dpu_vector<int>::from_cpu(src);
+  dpu_vector<int> res = da + 1;
+
+  // Guard elements around the destination must be left alone
+  vector<int> out(N + 2, -1);
+  res.to_cpu_into(std::span<int>(out.data() + 1, N));
+  if (out.front() != -1 || out.back() != -1) return TEST_ERROR;
+  for (uint32_t i = 0; i < N; i++) {
+    if (out[i + 1] != src[i] + 1) return TEST_ERROR;
+  }
+  return TEST_SUCCESS;
+}
+
+// Each rank's slices can be used as soon as that rank's transfer is done
+test_error test_rank_completion() {
+  const uint32_t N = 1001 * 32 + 7;
+  vector<int> a(N);
+  for (uint32_t i = 0; i < N; i++) a[i] = rand() % 100;
+
+  dpu_vector<int> res = dpu_vector<int>::from_cpu(a) + 1;
+  vector<int> out(N);
+  auto e = res.to_cpu_async(out);
+
+  DpuStream& stream = res.stream();
+  const vector<uint32_t>& sizes = res.data_desc().second;
+  uint32_t element = 0;
+  for (uint32_t r = 0; r < stream.num_ranks(); r++) {
+    stream.get_event_queue().wait(e, r);
+    for (uint32_t d = stream.rank_first_dpu(r);
+         d < stream.rank_first_dpu(r + 1); d++) {
+      for (uint32_t i = 0; i < sizes[d] / sizeof(int); i++, element++) {
+        if (out[element] != a[element] + 1) return TEST_ERROR;
+      }
+    }
+  }
+  if (element != N) return TEST_ERROR;
+  stream.get_event_queue().wait(e);
+  return TEST_SUCCESS;
+}
+
 test_error test_int_sub() {
   const uint32_t N = 1024 * 1024;
   vector<int> a(N), b(N);
@@ -187,8 +262,791 @@ test_error test_chained_operations() {
   return TEST_SUCCESS;
 }
 
+test_error test_independent_operations() {
+  const uint32_t N = 1024 * 1024;
+
+  vector<int> a(N), b(N);
+  for (uint32_t i = 0; i < N; i++) {
+    a[i] = rand() % 200 - 100;
+    b[i] = rand() % 200 - 100;
+  }
+
+  // Nothing below blocks until the results are read back
+  dpu_vector<int> da = dpu_vector<int>::from_cpu(a);
+  dpu_vector<int> db = dpu_vector<int>::from_cpu(b);
+  dpu_vector<int> sum = da + db;
+  dpu_vector<int> diff = da - db;
+  dpu_vector<int> neg = -da;
+
+  DpuRuntime::get().get_event_queue().wait();
+
+  if (compare_cpu_binary(a, b, sum, [](int x, int y) { return x + y; }) !=
+      TEST_SUCCESS)
+    return TEST_ERROR;
+  if (compare_cpu_binary(a, b, diff, [](int x, int y) { return x - y; }) !=
+      TEST_SUCCESS)
+    return TEST_ERROR;
+  return compare_cpu_unary(a, neg, [](int x) { return -x; });
+}
+
+test_error test_large_expression() {
+  const uint32_t N = 1024 * 1024;
+
+  vector<float> a(N), b(N), c(N), d(N), e(N);
+  for (uint32_t i = 0; i < N; i++) {
+    a[i] = (float)rand() / RAND_MAX - 0.5f;
+    b[i] = (float)rand() / RAND_MAX - 0.5f;
+    c[i] = (float)rand() / RAND_MAX - 0.5f;
+    d[i] = (float)rand() / RAND_MAX - 0.5f;
+    e[i] = (float)rand() / RAND_MAX - 0.5f;
+  }
+
+  dpu_vector<float> da = dpu_vector<float>::from_cpu(a);
+  dpu_vector<float> db = dpu_vector<float>::from_cpu(b);
+  dpu_vector<float> dc = dpu_vector<float>::from_cpu(c);
+  dpu_vector<float> dd = dpu_vector<float>::from_cpu(d);
+  dpu_vector<float> de = dpu_vector<float>::from_cpu(e);
+
+  // More inputs than fit in one fused program
+  dpu_vector<float> res = abs(((da - db) + (dc - dd)) - abs(de - da));
+
+  vector<float> final_res = res.to_cpu();
+  for (uint32_t i = 0; i < N; i++) {
+    float expected =
+        std::fabs(((a[i] - b[i]) + (c[i] - d[i])) - std::fabs(e[i] - a[i]));
+    if (final_res[i] != expected) {
+      std::cout << "[error] mismatch at index " << i << ": " << final_res[i]
+                << " != " << expected << std::endl;
+      return TEST_ERROR;
+    }
+  }
+
+  return TEST_SUCCESS;
+}
+
+test_error test_assign_in_place() {
+  const uint32_t N = 1024 * 1024;
+
+  vector<int> a(N), b(N);
+  for (uint32_t i = 0; i < N; i++) {
+    a[i] = rand() % 200 - 100;
+    b[i] = rand() % 200 - 100;
+  }
+
+  dpu_vector<int> da = dpu_vector<int>::from_cpu(a);
+  dpu_vector<int> db = dpu_vector<int>::from_cpu(b);
+
+  // The result overwrites one of the inputs
+  da = -(da - db) + db;
+
+  return compare_cpu_binary(a, b, da,
+                            [](int x, int y) { return -(x - y) + y; });
+}
+
+// An operand dropped right after it is used stays allocated until the op
+// reading it has finished, and no longer
+test_error test_operand_lifetime() {
+  const uint32_t N = 100000;
+  vector<int> a(N);
+  for (uint32_t i = 0; i < N; i++) a[i] = rand() % 200 - 100;
+
+  allocator& heap = default_stream().get_allocator();
+  if (!heap.empty()) return TEST_ERROR;
+  {
+    dpu_vector<int> res(N);
+    {
+      dpu_vector<int> da = dpu_vector<int>::from_cpu(a);
+      res = abs(da) + 1;
+    }
+    vector<int> out = res.to_cpu();
+    for (uint32_t i = 0; i < N; i++) {
+      if (out[i] != std::abs(a[i]) + 1) return TEST_ERROR;
+    }
+  }
+  return heap.empty() ? TEST_SUCCESS : TEST_ERROR;
+}
+
+test_error test_in_place_operators() {
+  const uint32_t N = 1024 * 1024;
+
+  vector<int> a(N), b(N);
+  for (uint32_t i = 0; i < N; i++) {
+    a[i] = rand() % 200 - 100;
+    b[i] = rand() % 200 - 100;
+  }
+
+  dpu_vector<int> da = dpu_vector<int>::from_cpu(a);
+  dpu_vector<int> db = dpu_vector<int>::from_cpu(b);
+  dpu_vector<int> acc = da + db;
+  uint32_t buffer = acc.buffer_id();
+
+  // A single owner is updated in its own buffer
+  acc += db;
+  acc -= 3;
+  acc.negate_in_place();
+  acc.abs_in_place();
+  if (acc.buffer_id() != buffer) return TEST_ERROR;
+
+  // A copy shares the buffer, so the next update leaves it untouched
+  dpu_vector<int> snapshot = acc;
+  acc += 1;
+  if (acc.buffer_id() == buffer || snapshot.buffer_id() != buffer) {
+    return TEST_ERROR;
+  }
+
+  // Moves hand the buffer over
+  dpu_vector<int> moved = std::move(snapshot);
+  if (moved.buffer_id() != buffer) return TEST_ERROR;
+
+  if (compare_cpu_binary(a, b, moved, [](int x, int y) {
+        return std::abs(-(x + 2 * y - 3));
+      })) {
+    return TEST_ERROR;
+  }
+  return compare_cpu_binary(a, b, acc, [](int x, int y) {
+    return std::abs(-(x + 2 * y - 3)) + 1;
+  });
+}
+
+test_error test_scalar_operations() {
+  const uint32_t N = 1024 * 1024;
+
+  vector<int> a(N), b(N);
+  for (uint32_t i = 0; i < N; i++) {
+    a[i] = rand() % 200 - 100;
+    b[i] = rand() % 200 - 100;
+  }
+
+  dpu_vector<int> da = dpu_vector<int>::from_cpu(a);
+  dpu_vector<int> db = dpu_vector<int>::from_cpu(b);
+
+  // Native vector-scalar kernels
+  dpu_vector<int> plus = da + 7;
+  dpu_vector<int> rplus = 7 + da;
+  dpu_vector<int> minus = da - 5;
+  dpu_vector<int> rminus = 5 - da;
+  if (compare_cpu_unary(a, plus, [](int x) { return x + 7; }) ||
+      compare_cpu_unary(a, rplus, [](int x) { return 7 + x; }) ||
+      compare_cpu_unary(a, minus, [](int x) { return x - 5; }) ||
+      compare_cpu_unary(a, rminus, [](int x) { return 5 - x; })) {
+    return TEST_ERROR;
+  }
+
+  // Scalars inside a fused program
+  dpu_vector<int> fused = abs(da - 3) + (10 - db) + 3;
+  return compare_cpu_binary(a, b, fused, [](int x, int y) {
+    return std::abs(x - 3) + (10 - y) + 3;
+  });
+}
+
+test_error test_int_arithmetic() {
+  const uint32_t N = 1024 * 1024;
+
+  // Operands of 8, 16 and 32 bits exercise every multiply path; every fourth
+  // pair is equal
+  vector<int> a(N), b(N);
+  for (uint32_t i = 0; i < N; i++) {
+    int range = i % 3 == 0 ? 200 : i % 3 == 1 ? 60000 : RAND_MAX;
+    a[i] = rand() % range - range / 2;
+    b[i] = i % 4 == 0 ? a[i] : rand() % range - range / 2;
+    if (b[i] == 0) b[i] = 1;
+  }
+
+  dpu_vector<int> da = dpu_vector<int>::from_cpu(a);
+  dpu_vector<int> db = dpu_vector<int>::from_cpu(b);
+  auto wrapping_mul = [](int x, int y) {
+    return static_cast<int>(static_cast<uint32_t>(x) *
+                            static_cast<uint32_t>(y));
+  };
+
+  dpu_vector<int> mul = da * db;
+  dpu_vector<int> div = da / db;
+  dpu_vector<int> mod = da % db;
+  dpu_vector<int> lo = min(da, db);
+  dpu_vector<int> hi = max(da, db);
+  dpu_vector<int> lt = da < db;
+  dpu_vector<int> eq = da == db;
+  dpu_vector<int> gt = da > db;
+  if (compare_cpu_binary(a, b, mul, wrapping_mul) ||
+      compare_cpu_binary(a, b, div, [](int x, int y) { return x / y; }) ||
+      compare_cpu_binary(a, b, mod, [](int x, int y) { return x % y; }) ||
+      compare_cpu_binary(a, b, lo,
+                         [](int x, int y) { return std::min(x, y); }) ||
+      compare_cpu_binary(a, b, hi,
+                         [](int x, int y) { return std::max(x, y); }) ||
+      compare_cpu_binary(a, b, lt, [](int x, int y) { return int(x < y); }) ||
+      compare_cpu_binary(a, b, eq, [](int x, int y) { return int(x == y); }) ||
+      compare_cpu_binary(a, b, gt, [](int x, int y) { return int(x > y); })) {
+    return TEST_ERROR;
+  }
+
+  // Vector-scalar kernels, with and without the power-of-two shifts; the
+  // dividends are negative as often as not
+  dpu_vector<int> mul8 = da * 8;
+  dpu_vector<int> mul7 = 7 * da;
+  dpu_vector<int> div8 = da / 8;
+  dpu_vector<int> div7 = da / 7;
+  dpu_vector<int> mod8 = da % 8;
+  dpu_vector<int> mod7 = da % 7;
+  if (compare_cpu_unary(a, mul8, [&](int x) { return wrapping_mul(x, 8); }) ||
+      compare_cpu_unary(a, mul7, [&](int x) { return wrapping_mul(7, x); }) ||
+      compare_cpu_unary(a, div8, [](int x) { return x / 8; }) ||
+      compare_cpu_unary(a, div7, [](int x) { return x / 7; }) ||
+      compare_cpu_unary(a, mod8, [](int x) { return x % 8; }) ||
+      compare_cpu_unary(a, mod7, [](int x) { return x % 7; })) {
+    return TEST_ERROR;
+  }
+
+  // Scalar divided by a vector, and a mask inside a fused program
+  dpu_vector<int> rdiv = 1000 / db;
+  dpu_vector<int> fused = (da > 0) * da + max(db, -5) % 4;
+  if (compare_cpu_unary(b, rdiv, [](int y) { return 1000 / y; })) {
+    return TEST_ERROR;
+  }
+  return compare_cpu_binary(a, b, fused, [](int x, int y) {
+    return (x > 0) * x + std::max(y, -5) % 4;
+  });
+}
+
+test_error test_float_arithmetic() {
+  const uint32_t N = 1024 * 1024;
+  vector<float> a(N), b(N);
+  for (uint32_t i = 0; i < N; i++) {
+    a[i] = (float)rand() / RAND_MAX - 0.5f;
+    b[i] = i % 4 == 0 ? a[i] : (float)rand() / RAND_MAX + 0.5f;
+  }
+
+  dpu_vector<float> da = dpu_vector<float>::from_cpu(a);
+  dpu_vector<float> db = dpu_vector<float>::from_cpu(b);
+
+  dpu_vector<float> mul = da * db;
+  dpu_vector<float> div = da / db;
+  dpu_vector<float> lo = min(da, db);
+  dpu_vector<float> hi = max(da, db);
+  dpu_vector<float> lt = da < db;
+  dpu_vector<float> eq = da == db;
+  dpu_vector<float> gt = da > db;
+  dpu_vector<float> scaled = da * 2.5f;
+  dpu_vector<float> halved = da / 2.0f;
+  if (compare_cpu_binary(a, b, mul, [](float x, float y) { return x * y; }) ||
+      compare_cpu_binary(a, b, div, [](float x, float y) { return x / y; }) ||
+      compare_cpu_binary(a, b, lo,
+                         [](float x, float y) { return std::min(x, y); }) ||
+      compare_cpu_binary(a, b, hi,
+                         [](float x, float y) { return std::max(x, y); }) ||
+      compare_cpu_binary(a, b, lt,
+                         [](float x, float y) { return float(x < y); }) ||
+      compare_cpu_binary(a, b, eq,
+                         [](float x, float y) { return float(x == y); }) ||
+      compare_cpu_binary(a, b, gt,
+                         [](float x, float y) { return float(x > y); }) ||
+      compare_cpu_unary(a, scaled, [](float x) { return x * 2.5f; }) ||
+      compare_cpu_unary(a, halved, [](float x) { return x / 2.0f; })) {
+    return TEST_ERROR;
+  }
+
+  dpu_vector<float> fused = min(da * db, 0.25f) / (1.0f + db);
+  return compare_cpu_binary(a, b, fused, [](float x, float y) {
+    return std::min(x * y, 0.25f) / (1.0f + y);
+  });
+}
+
+test_error test_map_and_select() {
+  const uint32_t N = 1024 * 1024;
+  vector<int> a(N), b(N), c(N);
+  vector<float> x(N), y(N), z(N);
+  for (uint32_t i = 0; i < N; i++) {
+    a[i] = rand() % 200 - 100;
+    b[i] = rand() % 200 - 100;
+    c[i] = rand() % 2;
+    x[i] = (float)rand() / RAND_MAX - 0.5f;
+    y[i] = (float)rand() / RAND_MAX;
+    z[i] = (float)rand() / RAND_MAX;
+  }
+
+  dpu_vector<int> da = dpu_vector<int>::from_cpu(a);
+  dpu_vector<int> db = dpu_vector<int>::from_cpu(b);
+  dpu_vector<int> dc = dpu_vector<int>::from_cpu(c);
+  dpu_vector<float> dx = dpu_vector<float>::from_cpu(x);
+  dpu_vector<float> dy = dpu_vector<float>::from_cpu(y);
+  dpu_vector<float> dz = dpu_vector<float>::from_cpu(z);
+
+  // A condition that is an input is copied before the select
+  dpu_vector<int> picked = select(dc, da, db);
+  dpu_vector<int> diff = dpu_map(
+      [](auto p, auto q) { return select(p > q, p - q, 0); }, da, db);
+  vector<int> picked_cpu = picked.to_cpu();
+  for (uint32_t i = 0; i < N; i++) {
+    if (picked_cpu[i] != (c[i] ? a[i] : b[i])) return TEST_ERROR;
+  }
+  if (compare_cpu_binary(a, b, diff,
+                         [](int p, int q) { return p > q ? p - q : 0; })) {
+    return TEST_ERROR;
+  }
+
+  // Three inputs and four constants overflow the registers, so the program
+  // is split and part of it materialized
+  dpu_vector<float> mapped = dpu_map(
+      [](auto p, auto q, auto r) {
+        return select(p < 0.0f, q * 2.0f + 1.0f, max(r, 0.5f) - p);
+      },
+      dx, dy, dz);
+  vector<float> mapped_cpu = mapped.to_cpu();
+  for (uint32_t i = 0; i < N; i++) {
+    float expected =
+        x[i] < 0.0f ? y[i] * 2.0f + 1.0f : std::max(z[i], 0.5f) - x[i];
+    if (mapped_cpu[i] != expected) return TEST_ERROR;
+  }
+
+  // Maps that ignore their operands run on the operands' stream
+  dpu_vector<int> fives = dpu_map([](auto) { return 5; }, da);
+  dpu_vector<int> sevens = dpu_map(
+      [](auto p) {
+        return select(dpu_expr<int>::scalar(1, p.size()), 7, 3);
+      },
+      da);
+  vector<int> fives_cpu = fives.to_cpu();
+  vector<int> sevens_cpu = sevens.to_cpu();
+  for (uint32_t i = 0; i < N; i++) {
+    if (fives_cpu[i] != 5 || sevens_cpu[i] != 7) return TEST_ERROR;
+  }
+  // Without vectors there is no stream to take
+  try {
+    dpu_vector<int> none(dpu_expr<int>::scalar(5, N));
+    return TEST_ERROR;
+  } catch (const std::logic_error&) {
+  }
+  return TEST_SUCCESS;
+}
+
+test_error test_batched_operations() {
+  const uint32_t N = 64 * 1024;
+  const int steps = 3 * BATCH_MAX_COMMANDS / 2;  // fills one batch and a half
+
+  vector<int> a(N), b(N);
+  for (uint32_t i = 0; i < N; i++) {
+    a[i] = rand() % 200 - 100;
+    b[i] = rand() % 200 - 100;
+  }
+
+  dpu_vector<int> da = dpu_vector<int>::from_cpu(a);
+  dpu_vector<int> db = dpu_vector<int>::from_cpu(b);
+  dpu_vector<int> acc = da + 0;
+  int sum;
+  {
+    dpu_batch batch;
+    for (int s = 0; s < steps; s++) acc = acc + 1;
+    acc = abs(acc - db) + da;  // fused
+    sum = reduce_sum(acc);     // flushes the batch
+    acc = -acc;
+  }
+
+  long long cpu_sum = 0;
+  for (uint32_t i = 0; i < N; i++) {
+    cpu_sum += std::abs(a[i] + steps - b[i]) + a[i];
+  }
+  if (sum != static_cast<int>(cpu_sum)) return TEST_ERROR;
+  return compare_cpu_binary(a, b, acc, [](int x, int y) {
+    return -(std::abs(x + steps - y) + x);
+  });
+}
+
+test_error test_kernel_profiles() {
+  const uint32_t N = 64 * 1024;
+  const int steps = 10;
+  auto& runtime = DpuRuntime::get();
+
+  vector<int> a(N, 1);
+  dpu_vector<int> da = dpu_vector<int>::from_cpu(a);
+  dpu_vector<int> acc = da + 0;
+  runtime.get_event_queue().wait();
+
+  runtime.set_profiling(true);
+  runtime.reset_kernel_profiles();
+  acc = da - acc;  // on its own
+  {
+    dpu_batch batch;  // every command counts as a launch
+    for (int s = 0; s < steps; s++) acc = acc + 1;
+  }
+  int sum = reduce_sum(acc);
+  runtime.set_profiling(false);
+  if (sum != static_cast<int>(N) * steps) return TEST_ERROR;
+
+  uint32_t num_dpus = acc.stream().num_dpus();
+  KernelProfile sub = runtime.kernel_profile(K_BINARY_INT_SUB);
+  KernelProfile add = runtime.kernel_profile(K_SCALAR_INT_ADD);
+  KernelProfile reduce = runtime.kernel_profile(K_REDUCE_INT_SUM);
+  if (sub.launches != 1 || add.launches != steps || reduce.launches != 1) {
+    return TEST_ERROR;
+  }
+  for (const KernelProfile& p : {sub, add, reduce}) {
+    if (p.dpu_runs != p.launches * num_dpus) return TEST_ERROR;
+    if (p.min_cycles > p.avg_cycles() || p.avg_cycles() > p.max_cycles) {
+      return TEST_ERROR;
+    }
+    if (p.critical_cycles < p.launches * p.min_cycles) return TEST_ERROR;
+    if (p.imbalance() < 1 - 1e-9 || p.dma_cycles > p.busy_cycles) {
+      return TEST_ERROR;
+    }
+  }
+  if (runtime.kernel_profile(K_UNARY_INT_ABS).launches != 0) return TEST_ERROR;
+  return TEST_SUCCESS;
+}
+
+test_error test_event_trace() {
+  const uint32_t N = 64 * 1024;
+  auto& runtime = DpuRuntime::get();
+  vector<int> a(N, 2);
+
+  runtime.reset_trace();
+  runtime.set_tracing(true);
+  dpu_vector<int> da = dpu_vector<int>::from_cpu(a);
+  dpu_vector<int> db = -da;
+  vector<int> back = db.to_cpu();
+  runtime.set_tracing(false);
+  if (back[N - 1] != -2) return TEST_ERROR;
+
+  // Finished in submission order, as every rank runs them in that order
+  vector<EventTrace> events = runtime.tracer().events();
+  if (events.size() != 3) return TEST_ERROR;
+  if (std::string(events[0].category) != "dpu_transfer" ||
+      std::string(events[1].category) != "compute" ||
+      std::string(events[2].category) != "host_transfer") {
+    return TEST_ERROR;
+  }
+  if (events[0].bytes != N * sizeof(int) ||
+      events[2].bytes != N * sizeof(int)) {
+    return TEST_ERROR;
+  }
+  for (const EventTrace& t : events) {
+    if (t.num_dpus != da.stream().num_dpus() ||
+        t.rank_completed.size() != da.stream().num_ranks()) {
+      return TEST_ERROR;
+    }
+    if (t.submitted > t.issued || t.issued > t.issue_done ||
+        t.issue_done > t.completed || t.completed > t.callback_done) {
+      return TEST_ERROR;
+    }
+    for (uint64_t done : t.rank_completed) {
+      if (done < t.issue_done || done > t.completed) return TEST_ERROR;
+    }
+  }
+
+  std::ostringstream json;
+  runtime.tracer().write(json);
+  if (json.str().rfind("{\"displayTimeUnit\"", 0) != 0) return TEST_ERROR;
+  if (json.str().find("\"name\":\"rank 0\"") == std::string::npos) {
+    return TEST_ERROR;
+  }
+  return TEST_SUCCESS;
+}
+
+test_error test_command_replay() {
+  const uint32_t N = 64 * 1024 + 5;  // uneven slices
+  auto& runtime = DpuRuntime::get();
+  std::string path =
+      (std::filesystem::temp_directory_path() / "vectordpu_test.cmds").string();
+  vector<int> a(N), back;
+  for (uint32_t i = 0; i < N; i++) a[i] = i % 100 + 1;
+
+  vector_desc desc;
+  runtime.start_recording(path, true);
+  {
+    dpu_vector<int> da = dpu_vector<int>::from_cpu(a);
+    desc = da.data_desc();
+    dpu_vector<int> db = da + da;
+    dpu_vector<int> dc = da * db + da;  // fused
+    if (reduce_sum(dc) == 0) return TEST_ERROR;
+    {
+      dpu_batch batch;
+      db += 1;
+      db += 2;
+    }
+    back = db.to_cpu();
+  }
+  runtime.stop_recording();
+  if (back[N - 1] != 2 * a[N - 1] + 3) return TEST_ERROR;
+
+  CommandRecording recording = CommandRecorder::read(path);
+  const auto& records = recording.records;
+  if (recording.header.num_dpus != runtime.num_dpus() ||
+      !recording.header.checksums || records.size() != 7) {
+    return TEST_ERROR;
+  }
+  using Op = Event::OperationType;
+  const Op ops[] = {Op::DPU_TRANSFER, Op::COMPUTE, Op::COMPUTE, Op::COMPUTE,
+                    Op::HOST_TRANSFER, Op::COMPUTE, Op::HOST_TRANSFER};
+  for (uint32_t i = 0; i < records.size(); i++) {
+    if (records[i].op != ops[i]) return TEST_ERROR;
+    if (i > 0 && (records[i].issue_number <= records[i - 1].issue_number ||
+                  records[i].issued < records[i - 1].issued)) {
+      return TEST_ERROR;
+    }
+  }
+  // Transfers of vectors with their layout and the data they moved
+  const uint64_t bytes = N * sizeof(int);
+  if (!records[0].vector_transfer || records[0].desc != desc ||
+      records[0].bytes != bytes ||
+      records[0].checksum != CommandRecorder::checksum(a.data(), bytes)) {
+    return TEST_ERROR;
+  }
+  if (!records[6].vector_transfer ||
+      records[6].checksum != CommandRecorder::checksum(back.data(), bytes)) {
+    return TEST_ERROR;
+  }
+  // Launches with the args of every DPU, the fused program and the commands
+  // of the batch
+  if (records[1].args.size() != desc.first.size() ||
+      records[1].args[0].kernel != K_BINARY_INT_ADD ||
+      records[1].args.back().binary.lhs_offset != desc.first.back()) {
+    return TEST_ERROR;
+  }
+  if (records[2].programs.size() != desc.first.size() ||
+      records[3].args[0].kernel != K_REDUCE_INT_SUM ||
+      records[4].vector_transfer) {
+    return TEST_ERROR;
+  }
+  if (records[5].commands.size() != 2 * desc.first.size()) return TEST_ERROR;
+
+  // Replays give the same results every time
+  vector<ReplayedCommand> first = replay_commands(recording);
+  vector<ReplayedCommand> second = replay_commands(recording, true);
+  std::filesystem::remove(path);
+  if (first.size() != records.size() || second.size() != records.size()) {
+    return TEST_ERROR;
+  }
+  if (std::string(first[1].name) != "BINARY_INT_ADD" ||
+      std::string(first[5].name) != "batch") {
+    return TEST_ERROR;
+  }
+  for (uint32_t i = 0; i < first.size(); i++) {
+    if (first[i].checksum != second[i].checksum) return TEST_ERROR;
+    if (first[i].service > first[i].latency ||
+        first[i].recorded_service > first[i].recorded_latency) {
+      return TEST_ERROR;
+    }
+  }
+  return TEST_SUCCESS;
+}
+
+test_error test_streaming() {
+  const uint32_t N = 1024 * 1024 + 123;
+  const uint32_t CHUNK = 100 * 1000;  // the last chunk is partial
+
+  vector<int> a(N), out(N);
+  long long cpu_sum = 0;
+  for (uint32_t i = 0; i < N; i++) {
+    a[i] = rand() % 200 - 100;
+    cpu_sum += a[i];
+  }
+
+  pipeline_stats stats = stream_map<int>(
+      span_source<int>(a), span_sink<int>(out), CHUNK,
+      [](const dpu_vector<int>& x) { return abs(x) + 1; });
+  if (stats.chunks != (N + CHUNK - 1) / CHUNK) return TEST_ERROR;
+  for (uint32_t i = 0; i < N; i++) {
+    if (out[i] != std::abs(a[i]) + 1) return TEST_ERROR;
+  }
+
+  long long sum = stream_reduce<int>(
+      span_source<int>(a), CHUNK,
+      [](const dpu_vector<int>& x) { return reduce_sum_async(x); },
+      [](long long acc, int s) { return acc + s; }, 0LL);
+  return sum == cpu_sum ? TEST_SUCCESS : TEST_ERROR;
+}
+
+// Host work overlapping with the DPUs through futures and a coroutine
+dpu_task<long long> sum_of_abs_plus_one(vector<int> a) {
+  dpu_vector<int> da = co_await from_cpu_async(std::move(a));
+  dpu_vector<int> res = co_await evaluate_async(abs(da) + 1);
+  vector<int> out = co_await to_cpu_async(res);
+  long long host_sum = std::accumulate(out.begin(), out.end(), 0LL);
+  int dpu_sum = co_await reduce_sum_async(res);
+  co_return host_sum == dpu_sum ? host_sum : -1;
+}
+
+test_error test_futures() {
+  const uint32_t N = 100000;
+  vector<int> a(N);
+  for (uint32_t i = 0; i < N; i++) a[i] = rand() % 200 - 100;
+
+  dpu_future<dpu_vector<int>> upload = from_cpu_async(a);
+  dpu_vector<int> da = upload.get();
+  dpu_future<vector<int>> download = to_cpu_async(da + da);
+  dpu_future<int> max = reduce_max_async(da);
+  dpu_future<double> norm = norm2_async(da);
+
+  long long sum = 0, sq = 0;
+  int cpu_max = a[0];
+  for (int x : a) {
+    sum += std::abs(x) + 1;
+    sq += (long long)x * x;
+    cpu_max = std::max(cpu_max, x);
+  }
+
+  vector<int> out = download.get();
+  for (uint32_t i = 0; i < N; i++) {
+    if (out[i] != 2 * a[i]) return TEST_ERROR;
+  }
+  if (max.get() != cpu_max) return TEST_ERROR;
+  if (std::fabs(norm.get() - std::sqrt((double)sq)) > 1e-6 * std::sqrt(sq)) {
+    return TEST_ERROR;
+  }
+
+  dpu_task<long long> task = sum_of_abs_plus_one(a);
+  return task.get() == sum ? TEST_SUCCESS : TEST_ERROR;
+}
+
+// Several host threads submitting to the same queue at once
+test_error test_concurrent_submission() {
+  const uint32_t THREADS = 8;
+  vector<test_error> results(THREADS, TEST_ERROR);
+  vector<std::thread> jobs;
+  for (uint32_t t = 0; t < THREADS; t++) {
+    jobs.emplace_back([&, t] {
+      const uint32_t N = 4096 + t;
+      vector<int> a(N);
+      for (uint32_t i = 0; i < N; i++) a[i] = i % 100 - 50;
+
+      auto da = dpu_vector<int>::from_cpu(a);
+      dpu_vector<int> res = abs(da) + static_cast<int>(t);
+      {
+        dpu_batch batch;
+        for (uint32_t k = 0; k < 16; k++) res += 1;
+      }
+      vector<int> out = res.to_cpu();
+      for (uint32_t i = 0; i < N; i++) {
+        if (out[i] != std::abs(a[i]) + static_cast<int>(t) + 16) return;
+      }
+      if (reduce_sum(da) != std::accumulate(a.begin(), a.end(), 0)) return;
+      results[t] = TEST_SUCCESS;
+    });
+  }
+  for (auto& job : jobs) job.join();
+
+  for (test_error r : results) {
+    if (r != TEST_SUCCESS) return TEST_ERROR;
+  }
+  return TEST_SUCCESS;
+}
+
+// Independent jobs on streams of one rank each, submitted from their own
+// host threads
+test_error test_dpu_streams() {
+  auto& runtime = DpuRuntime::get();
+  runtime.partition(1);
+
+  vector<test_error> results(runtime.num_streams(), TEST_ERROR);
+  vector<std::thread> jobs;
+  for (uint32_t s = 0; s < runtime.num_streams(); s++) {
+    jobs.emplace_back([&, s] {
+      DpuStream& stream = runtime.stream(s);
+      const uint32_t N = 10000 + s;
+      vector<int> a(N);
+      for (uint32_t i = 0; i < N; i++) a[i] = i % 100 - 50;
+
+      auto da = dpu_vector<int>::from_cpu(a, stream);
+      dpu_vector<int> res = abs(da) + static_cast<int>(s);
+      if (&res.stream() != &stream) return;
+      vector<int> out = res.to_cpu();
+      for (uint32_t i = 0; i < N; i++) {
+        if (out[i] != std::abs(a[i]) + static_cast<int>(s)) return;
+      }
+      if (reduce_sum(da) != std::accumulate(a.begin(), a.end(), 0)) return;
+      results[s] = TEST_SUCCESS;
+    });
+  }
+  for (auto& job : jobs) job.join();
+
+  runtime.partition(0);
+  for (test_error r : results) {
+    if (r != TEST_SUCCESS) return TEST_ERROR;
+  }
+  return TEST_SUCCESS;
+}
+
+test_error test_int_reductions() {
+  const uint32_t N = 1024 * 1024;
+
+  vector<int> a(N), b(N);
+  for (uint32_t i = 0; i < N; i++) {
+    a[i] = rand() % 200 - 100;
+    b[i] = rand() % 200 - 100;
+  }
+
+  dpu_vector<int> da = dpu_vector<int>::from_cpu(a);
+  dpu_vector<int> db = dpu_vector<int>::from_cpu(b);
+
+  int sum = 0, min = a[0], max = a[0], prod = 0;
+  for (uint32_t i = 0; i < N; i++) {
+    sum += a[i];
+    min = std::min(min, a[i]);
+    max = std::max(max, a[i]);
+    prod += a[i] * b[i];
+  }
+
+  if (reduce_sum(da) != sum) return TEST_ERROR;
+  if (reduce_min(da) != min) return TEST_ERROR;
+  if (reduce_max(da) != max) return TEST_ERROR;
+  if (dot(da, db) != prod) return TEST_ERROR;
+
+  // Past INT_MAX: the sum of squares of a, about 3.3e9, and every square of c
+  long long sq_a = 0, sq_c = 0;
+  vector<int> c(N);
+  for (uint32_t i = 0; i < N; i++) {
+    c[i] = 50000 + i % 1000;
+    sq_a += (long long)a[i] * a[i];
+    sq_c += (long long)c[i] * c[i];
+  }
+  if (sq_a <= INT_MAX) return TEST_ERROR;
+  dpu_vector<int> dc = dpu_vector<int>::from_cpu(c);
+  auto close = [](double x, double y) { return std::fabs(x - y) <= 1e-9 * y; };
+  if (!close(norm2(da), std::sqrt((double)sq_a))) return TEST_ERROR;
+  if (!close(norm2(dc), std::sqrt((double)sq_c))) return TEST_ERROR;
+  if (!close(norm2_async(da).get(), std::sqrt((double)sq_a))) return TEST_ERROR;
+  if (!close(norm2_async(dc).get(), std::sqrt((double)sq_c))) return TEST_ERROR;
+  return TEST_SUCCESS;
+}
+
+test_error test_float_reductions() {
+  const uint32_t N = 1024 * 1024;
+
+  vector<float> a(N), b(N);
+  for (uint32_t i = 0; i < N; i++) {
+    a[i] = (float)rand() / RAND_MAX - 0.5f;
+    b[i] = (float)rand() / RAND_MAX - 0.5f;
+  }
+
+  dpu_vector<float> da = dpu_vector<float>::from_cpu(a);
+  dpu_vector<float> db = dpu_vector<float>::from_cpu(b);
+
+  double sum = 0, prod = 0, sq = 0;
+  float min = a[0], max = a[0];
+  for (uint32_t i = 0; i < N; i++) {
+    sum += a[i];
+    prod += a[i] * b[i];
+    sq += a[i] * a[i];
+    min = std::min(min, a[i]);
+    max = std::max(max, a[i]);
+  }
+
+  // Sums are accumulated in a different order on the DPUs
+  auto close = [](double x, double y) {
+    return std::fabs(x - y) <= 1e-3 * std::max(1.0, std::fabs(y));
+  };
+  if (!close(reduce_sum(da), sum)) return TEST_ERROR;
+  if (!close(dot(da, db), prod)) return TEST_ERROR;
+  if (!close(norm2(da), std::sqrt(sq))) return TEST_ERROR;
+  if (reduce_min(da) != min) return TEST_ERROR;
+  if (reduce_max(da) != max) return TEST_ERROR;
+  return TEST_SUCCESS;
+}
+
 int main(void) {
   assert(test_int_add() == TEST_SUCCESS);
+  assert(test_uneven_split() == TEST_SUCCESS);
+  assert(test_span_transfers() == TEST_SUCCESS);
+  assert(test_rank_completion() == TEST_SUCCESS);
   assert(test_int_sub() == TEST_SUCCESS);
   assert(test_float_add() == TEST_SUCCESS);
   assert(test_float_sub() == TEST_SUCCESS);
@@ -197,6 +1055,25 @@ int main(void) {
   assert(test_float_negate() == TEST_SUCCESS);
   assert(test_float_abs() == TEST_SUCCESS);
   assert(test_chained_operations() == TEST_SUCCESS);
+  assert(test_independent_operations() == TEST_SUCCESS);
+  assert(test_large_expression() == TEST_SUCCESS);
+  assert(test_assign_in_place() == TEST_SUCCESS);
+  assert(test_operand_lifetime() == TEST_SUCCESS);
+  assert(test_in_place_operators() == TEST_SUCCESS);
+  assert(test_scalar_operations() == TEST_SUCCESS);
+  assert(test_int_arithmetic() == TEST_SUCCESS);
+  assert(test_float_arithmetic() == TEST_SUCCESS);
+  assert(test_map_and_select() == TEST_SUCCESS);
+  assert(test_batched_operations() == TEST_SUCCESS);
+  assert(test_kernel_profiles() == TEST_SUCCESS);
+  assert(test_event_trace() == TEST_SUCCESS);
+  assert(test_command_replay() == TEST_SUCCESS);
+  assert(test_streaming() == TEST_SUCCESS);
+  assert(test_futures() == TEST_SUCCESS);
+  assert(test_concurrent_submission() == TEST_SUCCESS);
+  assert(test_dpu_streams() == TEST_SUCCESS);
+  assert(test_int_reductions() == TEST_SUCCESS);
+  assert(test_float_reductions() == TEST_SUCCESS);
 
   DpuRuntime::get().shutdown();
   std::cout << "All DPU vector tests passed successfully." << std::endl;
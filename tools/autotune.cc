@@ -0,0 +1,22 @@
+/* Autotunes the DMA block size of every kernel and writes the tuning file
+   that DpuRuntime::init() loads. The file goes to VECTORDPU_TUNING_FILE, or
+   ./vectordpu.tuning when that is not set.
+
+   usage: autotune [elements]
+*/
+
+#include <runtime.h>
+#include <vectordpu.h>
+
+#include <cstdlib>
+#include <iostream>
+
+int main(int argc, char** argv) {
+  uint32_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1u << 22;
+
+  autotune_block_sizes(n);
+  std::cout << "Wrote " << DpuRuntime::tuning_file_path() << std::endl;
+
+  DpuRuntime::get().shutdown();
+  return 0;
+}
@@ -0,0 +1,101 @@
+/* Replays a command recording, made with VECTORDPU_RECORD=<file> or
+   DpuRuntime::start_recording(), and prints how long every event took when
+   it was recorded and now. This reproduces the DPU work of an application
+   without it, to bisect performance changes of the library. The DPUs are
+   allocated from the environment as usual (VECTORDPU_PROFILE selects the
+   simulator or hardware), as many as the recording was made on.
+
+   Latency is from submission to completion; service leaves out the time an
+   event was queued behind the one before it on its stream. With --serial,
+   every event is waited for before the next one is submitted.
+
+   usage: replay [--serial] [--csv] <recording>
+*/
+
+#include <recorder.h>
+#include <runtime.h>
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string>
+
+int main(int argc, char** argv) {
+  bool serial = false;
+  bool csv = false;
+  std::string path;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--serial") == 0) {
+      serial = true;
+    } else if (std::strcmp(argv[i], "--csv") == 0) {
+      csv = true;
+    } else if (path.empty() && argv[i][0] != '-') {
+      path = argv[i];
+    } else {
+      path.clear();
+      break;
+    }
+  }
+  if (path.empty()) {
+    std::fprintf(stderr, "usage: %s [--serial] [--csv] <recording>\n",
+                 argv[0]);
+    return 1;
+  }
+
+  CommandRecording recording;
+  std::vector<ReplayedCommand> replayed;
+  try {
+    recording = CommandRecorder::read(path);
+    replayed = replay_commands(recording, serial);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  auto& runtime = DpuRuntime::get();
+  bool checksums = recording.header.checksums;
+
+  if (csv) {
+    std::printf("event,name,stream,bytes,recorded_latency_us,"
+                "recorded_service_us,latency_us,service_us%s\n",
+                checksums ? ",checksum" : "");
+  } else {
+    std::printf("%zu events recorded on %u DPUs with %u tasklets, replayed "
+                "on %u DPUs with %u tasklets (times in us)\n",
+                replayed.size(), recording.header.num_dpus,
+                recording.header.num_tasklets, runtime.num_dpus(),
+                runtime.num_tasklets());
+    std::printf("%8s %-20s %6s %12s %25s %25s\n", "event", "name", "stream",
+                "bytes", "recorded latency/service",
+                "replayed latency/service");
+  }
+
+  uint64_t recorded_service = 0, service = 0;
+  for (std::size_t i = 0; i < replayed.size(); i++) {
+    const ReplayedCommand& c = replayed[i];
+    recorded_service += c.recorded_service;
+    service += c.service;
+    if (csv) {
+      std::printf("%zu,%s,%u,%llu,%.3f,%.3f,%.3f,%.3f", i, c.name, c.stream,
+                  static_cast<unsigned long long>(c.bytes),
+                  c.recorded_latency / 1e3, c.recorded_service / 1e3,
+                  c.latency / 1e3, c.service / 1e3);
+      if (checksums) {
+        std::printf(",%016llx", static_cast<unsigned long long>(c.checksum));
+      }
+      std::printf("\n");
+    } else {
+      std::printf("%8zu %-20s %6u %12llu %12.1f %12.1f %12.1f %12.1f\n", i,
+                  c.name, c.stream, static_cast<unsigned long long>(c.bytes),
+                  c.recorded_latency / 1e3, c.recorded_service / 1e3,
+                  c.latency / 1e3, c.service / 1e3);
+    }
+  }
+  if (!csv) {
+    std::printf("service summed over every event: recorded %.1f us, "
+                "replayed %.1f us\n",
+                recorded_service / 1e3, service / 1e3);
+  }
+
+  runtime.shutdown();
+  return 0;
+}